@@ -0,0 +1,285 @@
+#include "fem_data_generator.h"
+#include "process_events.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef USE_PYBIND11
+    #include <pybind11/embed.h>
+#endif
+
+/*
+ * Throughput benchmark of the decoder stages. Runs on a given data file or
+ * generates a synthetic one, and reports MB/s and events/s for each stage,
+ *  - open_file:     ProcessEvents::OpenFile
+ *  - get_event:     ProcessEvents::GetEvent over the whole file, no charge ROIs
+ *  - get_event_cks: the same with the FEM checksums verified
+ *  - get_event_100: the same decoding 1 in 100 events, the rest skipped on their FEM headers
+ *  - scan_headers:  ProcessEvents::ScanHeaders, the FEM headers of the whole file
+ *  - charge_roi:    ProcessEvents::ChargeRoi over the decoded charge channels
+ *  - fill_fem_dict: ProcessEvents::FillFemDict of the charge ROI events
+ *  - adc_pack:      PackedWaveforms::Pack of the charge waveforms
+ *  - adc_unpack:    PackedWaveforms::Unpack of them
+ *  - light_wvfm:    decoder::light::ReconstructBatch of the full light waveforms
+ *  - py_export:     the python dict/NumPy export of get_events (python builds only)
+ * MB/s is in terms of the file size for the decoding and scan stages, the size of the
+ * reconstructed waveforms for light_wvfm and the size of the charge waveforms
+ * for the others.
+ */
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct StageResult {
+        std::string name;
+        double seconds;
+        size_t bytes;
+        size_t events;
+    };
+
+    size_t FileSize(const std::string &file_name) {
+        std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+        return file ? static_cast<size_t>(file.tellg()) : 0;
+    }
+
+    double Seconds(const Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    void PrintResults(const std::vector<StageResult> &results) {
+        std::printf("\n%-15s %12s %12s %14s\n", "stage", "time [s]", "MB/s", "events/s");
+        for (const auto &result : results) {
+            const double seconds = std::max(result.seconds, 1e-9);
+            std::printf("%-15s %12.4f %12.1f %14.1f\n", result.name.c_str(), result.seconds,
+                        static_cast<double>(result.bytes) / 1e6 / seconds,
+                        static_cast<double>(result.events) / seconds);
+        }
+    }
+
+    void PrintStats(const DecoderStats &stats) {
+        std::printf("\nDecoded %llu events, %llu FEMs, %llu words\n", static_cast<unsigned long long>(stats.events),
+                    static_cast<unsigned long long>(stats.fems), static_cast<unsigned long long>(stats.words_scanned));
+        for (size_t slot = 0; slot < DecoderStats::num_slots_; slot++) {
+            if (stats.slot_words[slot] == 0) continue;
+            std::printf("  slot %2zu: %llu words\n", slot, static_cast<unsigned long long>(stats.slot_words[slot]));
+        }
+        std::printf("Light ROIs kept %llu, missing end %llu, truncated header %llu, unexpected words %llu\n",
+                    static_cast<unsigned long long>(stats.light_rois_kept),
+                    static_cast<unsigned long long>(stats.light_rois_missing_end),
+                    static_cast<unsigned long long>(stats.light_rois_truncated_header),
+                    static_cast<unsigned long long>(stats.unexpected_light_words));
+        std::printf("Checksums verified %llu, bad %llu\n", static_cast<unsigned long long>(stats.checksums_verified),
+                    static_cast<unsigned long long>(stats.bad_checksums));
+    }
+
+    // Threshold each channel some counts above its median so only pulses make ROIs
+    std::vector<uint16_t> ChannelThresholds(const std::vector<std::vector<uint16_t>> &waveforms) {
+        std::vector<uint16_t> thresholds;
+        for (auto waveform : waveforms) {
+            uint16_t median = 0;
+            if (!waveform.empty()) {
+                std::nth_element(waveform.begin(), waveform.begin() + waveform.size() / 2, waveform.end());
+                median = waveform[waveform.size() / 2];
+            }
+            thresholds.push_back(static_cast<uint16_t>(median + 20));
+        }
+        return thresholds;
+    }
+}
+
+int main(const int argc, char **argv) {
+#ifdef USE_PYBIND11
+    py::scoped_interpreter guard;
+#endif
+
+    std::string file_name;
+    GeneratorConfig config;
+    size_t max_roi_events = 200;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--events" && i + 1 < argc) config.num_events = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--samples" && i + 1 < argc) config.samples_per_channel = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--roi-events" && i + 1 < argc) max_roi_events = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--help") {
+            std::cout << "Usage: decoder_benchmark [file.dat] [--events N] [--samples N] [--roi-events N]\n"
+                      << "  Without a file a synthetic one is generated with N events." << std::endl;
+            return 0;
+        }
+        else file_name = arg;
+    }
+    if (file_name.empty()) {
+        file_name = "decoder_benchmark_synthetic.dat";
+        if (!WriteFemDataFile(file_name, config)) return 1;
+    }
+
+    const uint16_t light_slot = config.light_slot;
+    std::vector<StageResult> results;
+
+    const size_t file_bytes = FileSize(file_name);
+
+    // OpenFile
+    {
+        ProcessEvents events(light_slot, false, {}, false);
+        const auto start = Clock::now();
+        if (!events.OpenFile(file_name)) return 1;
+        results.push_back({"open_file", Seconds(start), file_bytes, 0});
+    }
+
+    // GetEvent, keeping the charge waveforms of the first events for the next stages
+    std::vector<std::vector<std::vector<uint16_t>>> event_waveforms;
+    DecoderStats decode_stats;
+    {
+        ProcessEvents events(light_slot, false, {}, false);
+        events.OpenFile(file_name);
+        size_t num_events = 0;
+        double seconds = 0;
+        auto start = Clock::now();
+        while (events.GetEvent()) {
+            seconds += Seconds(start);
+            num_events++;
+            if (event_waveforms.size() < max_roi_events) {
+                event_waveforms.emplace_back();
+                for (const auto waveform : events.GetEventStruct().charge_adc) {
+                    event_waveforms.back().emplace_back(waveform.begin(), waveform.end());
+                }
+            }
+            start = Clock::now();
+        }
+        results.push_back({"get_event", seconds, file_bytes, num_events});
+        decode_stats = events.GetStats();
+    }
+
+    // GetEvent verifying the checksums
+    {
+        ProcessEvents events(light_slot, false, {}, false);
+        events.VerifyChecksum(true);
+        events.OpenFile(file_name);
+        size_t num_events = 0;
+        const auto start = Clock::now();
+        while (events.GetEvent()) num_events++;
+        results.push_back({"get_event_cks", Seconds(start), file_bytes, num_events});
+        const DecoderStats stats = events.GetStats();
+        decode_stats.checksums_verified = stats.checksums_verified;
+        decode_stats.bad_checksums = stats.bad_checksums;
+    }
+    // GetEvent sampling 1 in 100 events
+    {
+        ProcessEvents events(light_slot, false, {}, false);
+        events.UseEventStride(true);
+        events.SetEventStride(100);
+        events.OpenFile(file_name);
+        size_t num_events = 0;
+        const auto start = Clock::now();
+        while (events.GetEvent()) num_events++;
+        results.push_back({"get_event_100", Seconds(start), file_bytes, num_events});
+    }
+    // The FEM header table
+    {
+        ProcessEvents events(light_slot, false, {}, false);
+        events.OpenFile(file_name);
+        FemHeaderTable table;
+        const auto start = Clock::now();
+        events.ScanHeaders(table);
+        results.push_back({"scan_headers", Seconds(start), file_bytes, table.NumEvents()});
+    }
+    if (event_waveforms.empty() || event_waveforms.front().empty()) {
+        std::cerr << "No charge data found in " << file_name << std::endl;
+        PrintResults(results);
+        return 0;
+    }
+
+    // ChargeRoi and FillFemDict
+    {
+        const auto thresholds = ChannelThresholds(event_waveforms.front());
+        ProcessEvents events(light_slot, true, thresholds, false);
+        size_t waveform_bytes = 0;
+        double roi_seconds = 0;
+        double fill_seconds = 0;
+        for (const auto &waveforms : event_waveforms) {
+            events.ClearFemVectors();
+            auto start = Clock::now();
+            for (size_t channel = 0; channel < waveforms.size() && channel < thresholds.size(); channel++) {
+                events.ChargeRoi(static_cast<uint16_t>(channel), waveforms[channel]);
+            }
+            roi_seconds += Seconds(start);
+            for (const auto &waveform : waveforms) waveform_bytes += waveform.size() * sizeof(uint16_t);
+
+            start = Clock::now();
+            events.FillFemDict();
+            fill_seconds += Seconds(start);
+        }
+        results.push_back({"charge_roi", roi_seconds, waveform_bytes, event_waveforms.size()});
+        results.push_back({"fill_fem_dict", fill_seconds, waveform_bytes, event_waveforms.size()});
+    }
+
+    // Pack and unpack the charge waveforms
+    size_t packed_bytes = 0;
+    size_t unpacked_bytes = 0;
+    {
+        WaveformArena arena;
+        PackedWaveforms packed;
+        double pack_seconds = 0;
+        double unpack_seconds = 0;
+        for (const auto &waveforms : event_waveforms) {
+            arena.clear();
+            for (const auto &waveform : waveforms) arena.AppendRow(waveform);
+            auto start = Clock::now();
+            packed.Pack(arena);
+            pack_seconds += Seconds(start);
+            start = Clock::now();
+            packed.Unpack(arena);
+            unpack_seconds += Seconds(start);
+            packed_bytes += packed.NumBytes();
+            unpacked_bytes += arena.Samples().size() * sizeof(uint16_t);
+        }
+        results.push_back({"adc_pack", pack_seconds, unpacked_bytes, event_waveforms.size()});
+        results.push_back({"adc_unpack", unpack_seconds, unpacked_bytes, event_waveforms.size()});
+    }
+
+    // Full light waveforms of the first events, ~2MB each
+    {
+        constexpr size_t max_light_events = 50;
+        ProcessEvents events(light_slot, false, {}, false);
+        events.OpenFile(file_name);
+        EventBatch batch;
+        events.GetEvents(std::min(max_roi_events, max_light_events), batch);
+        const decoder::light::Geometry geometry{};
+        std::vector<uint16_t> waveforms;
+        std::vector<uint32_t> first_frames;
+        const auto start = Clock::now();
+        decoder::light::ReconstructBatch(batch, geometry, waveforms, first_frames);
+        results.push_back({"light_wvfm", Seconds(start), waveforms.size() * sizeof(uint16_t), batch.NumEvents()});
+    }
+
+#ifdef USE_PYBIND11
+    // The python export is the difference between the batch decode with and without building the arrays
+    {
+        constexpr size_t batch_size = 100;
+        ProcessEvents events(light_slot, false, {}, false);
+        events.OpenFile(file_name);
+        EventBatch batch;
+        size_t num_events = 0;
+        auto start = Clock::now();
+        while (events.GetEvents(batch_size, batch) > 0) num_events += batch.NumEvents();
+        const double batch_seconds = Seconds(start);
+
+        events.RestartFile();
+        start = Clock::now();
+        while (py::len(events.GetEventsDict(batch_size)["event_index"]) > 0) {}
+        const double export_seconds = Seconds(start) - batch_seconds;
+        results.push_back({"py_export", export_seconds, file_bytes, num_events});
+    }
+#endif
+
+    PrintResults(results);
+    PrintStats(decode_stats);
+    std::printf("Charge waveforms packed to %.1f%% of their size\n",
+                100. * static_cast<double>(packed_bytes) / static_cast<double>(std::max<size_t>(unpacked_bytes, 1)));
+    return 0;
+}
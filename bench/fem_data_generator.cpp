@@ -0,0 +1,141 @@
+#include "fem_data_generator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+
+namespace {
+
+    // Pack a 24b value into a header word, 12b per 16b word each with the 0xF header nibble
+    uint32_t PackHeader24(const uint32_t value) {
+        const uint32_t upper = 0xF000 | ((value >> 12) & 0xFFF);
+        const uint32_t lower = 0xF000 | (value & 0xFFF);
+        return upper | (lower << 16);
+    }
+
+    void AppendFemHeader(std::vector<uint32_t> &words, const uint32_t slot, const size_t num_payload_words,
+                         const uint32_t event_number, const uint32_t frame_number, const uint32_t checksum,
+                         const uint32_t trigger_sample, const uint32_t trigger_frame) {
+        // Header 1: [0xFFFF, 0xF | full | overflow | test | fem_id | slot]
+        words.push_back(0xFFFF | ((0xF000 | (slot & 0x1F)) << 16));
+        words.push_back(PackHeader24(static_cast<uint32_t>(num_payload_words - 1)));
+        words.push_back(PackHeader24(event_number));
+        words.push_back(PackHeader24(frame_number));
+        words.push_back(PackHeader24(checksum));
+        // Header 6: [0xF | pad | trig frame lower 4b | trig sample upper 4b, 0xF | pad | trig sample lower 8b]
+        const uint32_t header6_r = 0xF000 | ((trigger_frame & 0xF) << 4) | ((trigger_sample >> 8) & 0xF);
+        const uint32_t header6_l = 0xF000 | (trigger_sample & 0xFF);
+        words.push_back(header6_r | (header6_l << 16));
+    }
+
+    // Add the 16b payload words as 32b words, right word first, padding to a 32b boundary
+    void AppendPayload(std::vector<uint32_t> &words, const std::vector<uint16_t> &payload) {
+        for (size_t i = 0; i < payload.size(); i += 2) {
+            const uint32_t right = payload[i];
+            const uint32_t left = (i + 1) < payload.size() ? payload[i + 1] : 0x0;
+            words.push_back(right | (left << 16));
+        }
+    }
+
+    uint32_t Checksum(const std::vector<uint16_t> &payload) {
+        uint32_t sum = 0;
+        for (const uint16_t word : payload) sum += word;
+        return sum & 0xFFFFFF;
+    }
+
+    uint16_t ClampAdc(const double value) {
+        return static_cast<uint16_t>(std::clamp(std::lround(value), 1L, 4095L));
+    }
+}
+
+void GenerateFemData(const GeneratorConfig &config, std::vector<uint32_t> &words) {
+    std::mt19937 rng(config.seed);
+    std::normal_distribution<double> noise(0., config.noise_rms);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::poisson_distribution<size_t> num_rois(config.light_rois_per_event);
+
+    // A fixed baseline per channel, like the 2044/2042/.../460 in real data
+    const size_t num_charge_channels = config.num_charge_fems * config.channels_per_fem;
+    std::vector<double> baseline(num_charge_channels);
+    for (auto &base : baseline) base = uniform(rng) < 0.7 ? 2040. + 8. * uniform(rng) : 455. + 20. * uniform(rng);
+
+    std::vector<uint16_t> payload;
+    for (size_t event = 0; event < config.num_events; event++) {
+        const auto frame_number = static_cast<uint32_t>(config.first_frame_number + event);
+        const uint32_t trigger_frame = frame_number + 1;
+        const auto trigger_sample = static_cast<uint32_t>(uniform(rng) * 4096) & 0xFFF;
+
+        words.push_back(0xFFFFFFFF);
+
+        for (size_t fem = 0; fem < config.num_charge_fems; fem++) {
+            payload.clear();
+            for (size_t channel = 0; channel < config.channels_per_fem; channel++) {
+                const double base = baseline[fem * config.channels_per_fem + channel];
+                const bool has_pulse = uniform(rng) < config.pulse_probability;
+                const double pulse_start = uniform(rng) * static_cast<double>(config.samples_per_channel);
+                const double amplitude = 200. + 600. * uniform(rng);
+
+                payload.push_back(static_cast<uint16_t>(0x4000 | (channel & 0x3F)));
+                for (size_t sample = 0; sample < config.samples_per_channel; sample++) {
+                    double value = base + noise(rng);
+                    const double dt = static_cast<double>(sample) - pulse_start;
+                    if (has_pulse && dt >= 0) value += amplitude * (dt / 4.) * std::exp(1. - dt / 4.);
+                    payload.push_back(ClampAdc(value));
+                }
+                payload.push_back(static_cast<uint16_t>(0x5000 | (channel & 0x3F)));
+            }
+            AppendFemHeader(words, static_cast<uint32_t>(config.first_charge_slot + fem), payload.size(),
+                            static_cast<uint32_t>(event), frame_number, Checksum(payload), trigger_sample, trigger_frame);
+            AppendPayload(words, payload);
+        }
+
+        payload.clear();
+        payload.push_back(0x4000);
+        const size_t rois = num_rois(rng);
+        for (size_t roi = 0; roi < rois; roi++) {
+            const auto channel = static_cast<uint16_t>(uniform(rng) * static_cast<double>(config.num_light_channels));
+            const auto trigger_id = static_cast<uint16_t>(uniform(rng) * 4);
+            const auto roi_frame = static_cast<uint16_t>(frame_number + static_cast<uint32_t>(uniform(rng) * 3));
+            const auto roi_sample = static_cast<uint32_t>(uniform(rng) * 255 * 32);
+            // ROI header 1: word tag 0x2, header tag 0x1, trigger id, channel
+            payload.push_back(static_cast<uint16_t>(0x9000 | ((trigger_id & 0x7) << 9) | (channel & 0x3F)));
+            // ROI header 2 and 3: frame number lower 3b and the 17b sample number
+            payload.push_back(static_cast<uint16_t>(0xA000 | ((roi_frame & 0x7) << 5) | ((roi_sample >> 12) & 0x1F)));
+            payload.push_back(static_cast<uint16_t>(0xA000 | (roi_sample & 0xFFF)));
+            const double amplitude = 500. + 1000. * uniform(rng);
+            for (size_t sample = 0; sample < config.light_roi_samples; sample++) {
+                const double dt = static_cast<double>(sample) - 2.;
+                double value = 2049. + noise(rng);
+                if (dt >= 0) value += amplitude * (dt / 3.) * std::exp(1. - dt / 3.);
+                payload.push_back(static_cast<uint16_t>(0xA000 | ClampAdc(value)));
+            }
+            payload.push_back(0xB000);
+        }
+        payload.push_back(0xC000);
+        AppendFemHeader(words, static_cast<uint32_t>(config.light_slot), payload.size(),
+                        static_cast<uint32_t>(event), frame_number, Checksum(payload), trigger_sample, trigger_frame);
+        AppendPayload(words, payload);
+
+        words.push_back(0xE0000000);
+    }
+}
+
+bool WriteFemDataFile(const std::string &file_name, const GeneratorConfig &config) {
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+
+    FILE *file = fopen(file_name.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Could not open file: " << file_name << std::endl;
+        return false;
+    }
+    const bool ok = fwrite(words.data(), sizeof(uint32_t), words.size(), file) == words.size();
+    if (fclose(file) != 0 || !ok) {
+        std::cerr << "Error writing file: " << file_name << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << config.num_events << " events, " << words.size() * sizeof(uint32_t)
+              << " bytes to " << file_name << std::endl;
+    return true;
+}
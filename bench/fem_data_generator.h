@@ -0,0 +1,45 @@
+#ifndef FEM_DATA_GENERATOR_H
+#define FEM_DATA_GENERATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Generate synthetic readout data in the binary format described in
+ * charge_light_decoder.h, so the decoder can be exercised and benchmarked
+ * without detector data.
+ *
+ * Each event is an event start word, then for each FEM the 6 FEM header words
+ * followed by the FEM payload of 16b words, and finally the event end word.
+ *  - Charge FEM: for each channel a channel start word (0x4000 | channel), the
+ *    12b ADC samples and a channel end word (0x5000 | channel).
+ *  - Light FEM: a light channel start word (0x4000), then for each ROI the 3 ROI
+ *    header words (tags 0x9, 0xA, 0xA), the ADC samples (tag 0xA), the ROI end
+ *    word (0xB000) and finally the light channel end word (0xC000).
+ * The FEM payload is padded with a zero 16b word to end on a 32b boundary. The
+ * header word count is the number of 16b payload words minus one and the
+ * checksum is the 24b sum of the 16b payload words.
+ */
+struct GeneratorConfig {
+    size_t num_events = 100;
+    size_t num_charge_fems = 3;
+    size_t first_charge_slot = 13;
+    size_t light_slot = 16;
+    size_t channels_per_fem = 64;
+    size_t samples_per_channel = 763;
+    size_t num_light_channels = 32;
+    double light_rois_per_event = 5.;
+    size_t light_roi_samples = 20;
+    double pulse_probability = 0.05;  // chance a charge channel has a pulse in an event
+    double noise_rms = 1.5;           // ADC counts
+    uint32_t first_frame_number = 100;
+    uint32_t seed = 42;
+};
+
+// Append the 32b words of the whole file to words
+void GenerateFemData(const GeneratorConfig &config, std::vector<uint32_t> &words);
+bool WriteFemDataFile(const std::string &file_name, const GeneratorConfig &config);
+
+#endif //FEM_DATA_GENERATOR_H
@@ -0,0 +1,47 @@
+#include "fem_data_generator.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+    void Usage() {
+        std::cout << "Usage: generate_fem_data <output.dat> [options]\n"
+                  << "  --events N           number of events (100)\n"
+                  << "  --charge-fems N      number of charge FEMs (3)\n"
+                  << "  --samples N          samples per charge channel (763)\n"
+                  << "  --light-rois X       mean light ROIs per event (5)\n"
+                  << "  --roi-samples N      samples per light ROI (20)\n"
+                  << "  --pulse-prob X       chance of a charge pulse per channel (0.05)\n"
+                  << "  --light-slot N       slot number of the light FEM (16)\n"
+                  << "  --seed N             random seed (42)" << std::endl;
+    }
+}
+
+int main(const int argc, char **argv) {
+    if (argc < 2 || std::strcmp(argv[1], "--help") == 0) {
+        Usage();
+        return argc < 2 ? 1 : 0;
+    }
+
+    GeneratorConfig config;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        const char *value = argv[i + 1];
+        if (option == "--events") config.num_events = std::strtoul(value, nullptr, 10);
+        else if (option == "--charge-fems") config.num_charge_fems = std::strtoul(value, nullptr, 10);
+        else if (option == "--samples") config.samples_per_channel = std::strtoul(value, nullptr, 10);
+        else if (option == "--light-rois") config.light_rois_per_event = std::strtod(value, nullptr);
+        else if (option == "--roi-samples") config.light_roi_samples = std::strtoul(value, nullptr, 10);
+        else if (option == "--pulse-prob") config.pulse_probability = std::strtod(value, nullptr);
+        else if (option == "--light-slot") config.light_slot = std::strtoul(value, nullptr, 10);
+        else if (option == "--seed") config.seed = static_cast<uint32_t>(std::strtoul(value, nullptr, 10));
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            Usage();
+            return 1;
+        }
+    }
+
+    return WriteFemDataFile(argv[1], config) ? 0 : 1;
+}
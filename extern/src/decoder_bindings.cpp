@@ -2,6 +2,8 @@
 // Created by Jon Sensenig on 3/14/25.
 //
 
+#include "adc_codec.h"
+#include "light_waveforms.h"
 #include "process_events.h"
 #include "process_events_py.h"
 #include <pybind11/pybind11.h>
@@ -10,71 +12,164 @@
 
 namespace py = pybind11;
 
-py::array_t<uint16_t> ExtReconstructLightWaveforms(uint16_t channel, py::array_t<uint16_t> &channels, double min_frame_number,
-    py::array_t<double> &samples, py::array_t<double> &frames, py::array_t<uint16_t> &adc_words, uint16_t time_size) {
+template <typename T>
+using ArrayIn = py::array_t<T, py::array::c_style | py::array::forcecast>;
 
-    constexpr int samples_per_frame = 255 * 32; // timesize * 32MHz
-    std::array<uint16_t, 4 * samples_per_frame> channel_full_waveform{};
+// The ROIs of an event dict, adc_words is the padded [ROIs x samples] array
+decoder::light::Rois LightRoisFromArrays(const ArrayIn<uint16_t> &channels, const ArrayIn<uint16_t> &samples,
+    const ArrayIn<uint32_t> &frames, const ArrayIn<uint16_t> &adc_words) {
 
-    for (auto &sample : channel_full_waveform) { sample = 2048; }
-
-    //######################
-    // Get buffer info
-    const py::buffer_info buf_ch = channels.request();
-    const py::buffer_info buf_sample = samples.request();
-    const py::buffer_info buf_frame = frames.request();
     const py::buffer_info buf_adc_word = adc_words.request();
+    const auto num_rois = static_cast<size_t>(channels.size());
+    if (static_cast<size_t>(samples.size()) != num_rois || static_cast<size_t>(frames.size()) != num_rois) {
+        throw py::value_error("ROI arrays differ in size");
+    }
+    decoder::light::Rois rois;
+    rois.channel = channels.data();
+    rois.sample_number = samples.data();
+    rois.frame_number = frames.data();
+    rois.adc_words = adc_words.data();
+    rois.roi_length = buf_adc_word.ndim == 2 ? buf_adc_word.shape[1] : 0;
+    rois.num_rois = rois.roi_length > 0 && num_rois <= static_cast<size_t>(buf_adc_word.shape[0]) ? num_rois : 0;
+    return rois;
+}
+
+decoder::light::Geometry LightGeometry(const size_t num_channels, const size_t num_frames, const size_t time_size) {
+    decoder::light::Geometry geometry;
+    geometry.num_channels = num_channels;
+    geometry.num_frames = num_frames;
+    geometry.time_size = time_size;
+    return geometry;
+}
+
+py::array_t<uint16_t> ExtReconstructLightWaveforms(uint16_t channel, ArrayIn<uint16_t> &channels, double min_frame_number,
+    ArrayIn<uint16_t> &samples, ArrayIn<uint32_t> &frames, ArrayIn<uint16_t> &adc_words, uint16_t time_size,
+    size_t num_frames) {
+
+    decoder::light::Geometry geometry = LightGeometry(1, num_frames, time_size);
+    geometry.first_channel = channel;
+    const decoder::light::Rois rois = LightRoisFromArrays(channels, samples, frames, adc_words);
 
-    // Access data
-    auto* channel_ptr = static_cast<uint16_t*>(buf_ch.ptr);
-    auto* sample_ptr = static_cast<double*>(buf_sample.ptr);
-    auto* frame_ptr = static_cast<double*>(buf_frame.ptr);
-    auto* adc_word_ptr = static_cast<uint16_t*>(buf_adc_word.ptr);
-    //########################
-
-    //const auto min_it = std::min_element(frame_ptr, frame_ptr + buf_frame.size);
-    //double min_frame_number = min_it != (frame_ptr + buf_frame.size) ? *min_it : 0;
-
-    for (size_t roi = 0; roi < buf_ch.size; roi++) {
-        if (channel_ptr[roi] != channel) continue;
-        size_t frame_offset = (frame_ptr[roi] - min_frame_number) * samples_per_frame;
-        size_t start_idx = sample_ptr[roi] + frame_offset;
-        size_t end_idx = std::min((start_idx + buf_adc_word.shape[1]), channel_full_waveform.size());
-        for (size_t idx = start_idx; idx < end_idx; idx++) {
-            channel_full_waveform.at(idx) = adc_word_ptr[(roi*buf_adc_word.shape[1]) + (idx - start_idx)];
+    std::vector<uint16_t> channel_full_waveform(geometry.NumWaveformSamples());
+    decoder::light::Reconstruct(rois, static_cast<uint32_t>(min_frame_number), geometry, channel_full_waveform.data());
+    return vector_to_numpy_array_1d(std::move(channel_full_waveform));
+}
+
+// Every channel of an event in one pass, [num_channels x num_frames * time_size * 32]. The waveforms
+// start at min_frame_number, by default the earliest frame with an ROI.
+py::array_t<uint16_t> ExtReconstructAllLightWaveforms(ArrayIn<uint16_t> &channels, ArrayIn<uint16_t> &samples,
+    ArrayIn<uint32_t> &frames, ArrayIn<uint16_t> &adc_words, std::optional<uint32_t> min_frame_number,
+    size_t time_size, size_t num_frames, size_t num_channels) {
+
+    const decoder::light::Geometry geometry = LightGeometry(num_channels, num_frames, time_size);
+    const decoder::light::Rois rois = LightRoisFromArrays(channels, samples, frames, adc_words);
+    const uint32_t first_frame = min_frame_number ? *min_frame_number
+                                                  : decoder::light::FirstFrame(rois.frame_number, rois.num_rois);
+
+    std::vector<uint16_t> waveforms(geometry.NumWaveformSamples());
+    {
+        py::gil_scoped_release release;
+        decoder::light::Reconstruct(rois, first_frame, geometry, waveforms.data());
+    }
+    return vector_to_numpy_array_2d(std::move(waveforms), geometry.num_channels, geometry.NumSamples());
+}
+
+// The light waveforms of every event of a get_events()/get_chunk() batch, [events x channels x samples],
+// and the frame each event's waveforms start at
+py::tuple ExtReconstructBatchLightWaveforms(py::dict &batch_dict, size_t time_size, size_t num_frames,
+    size_t num_channels) {
+
+    const auto roi_offset = batch_dict["light_roi_offset"].cast<ArrayIn<uint64_t>>();
+    const auto channels = batch_dict["light_channel"].cast<ArrayIn<uint16_t>>();
+    const auto frames = batch_dict["light_frame_number"].cast<ArrayIn<uint32_t>>();
+    const auto samples = batch_dict["light_readout_sample"].cast<ArrayIn<uint16_t>>();
+    const auto adc_offset = batch_dict["light_adc_offset"].cast<ArrayIn<uint64_t>>();
+    const auto adc_words = batch_dict["light_adc_words"].cast<ArrayIn<uint16_t>>();
+
+    // The offsets are followed blindly below so check them first
+    const auto num_rois = static_cast<uint64_t>(channels.size());
+    const auto num_adc_words = static_cast<uint64_t>(adc_words.size());
+    const uint64_t *roi_offset_ptr = roi_offset.data();
+    const uint64_t *adc_offset_ptr = adc_offset.data();
+    bool valid = roi_offset.size() > 0 && static_cast<uint64_t>(frames.size()) == num_rois &&
+                 static_cast<uint64_t>(samples.size()) == num_rois &&
+                 static_cast<uint64_t>(adc_offset.size()) == num_rois + 1;
+    for (ssize_t idx = 0; valid && idx + 1 < roi_offset.size(); idx++) {
+        valid = roi_offset_ptr[idx] <= roi_offset_ptr[idx + 1];
+    }
+    for (ssize_t idx = 0; valid && idx + 1 < adc_offset.size(); idx++) {
+        valid = adc_offset_ptr[idx] <= adc_offset_ptr[idx + 1];
+    }
+    if (!valid || roi_offset_ptr[roi_offset.size() - 1] != num_rois || adc_offset_ptr[num_rois] > num_adc_words) {
+        throw py::value_error("inconsistent light ROI columns");
+    }
+
+    const decoder::light::Geometry geometry = LightGeometry(num_channels, num_frames, time_size);
+    const size_t num_events = roi_offset.size() - 1;
+    std::vector<uint16_t> waveforms(num_events * geometry.NumWaveformSamples());
+    std::vector<uint32_t> first_frames(num_events);
+    {
+        py::gil_scoped_release release;
+        for (size_t event = 0; event < num_events; event++) {
+            const uint64_t first_roi = roi_offset_ptr[event];
+            decoder::light::Rois rois;
+            rois.channel = channels.data() + first_roi;
+            rois.frame_number = frames.data() + first_roi;
+            rois.sample_number = samples.data() + first_roi;
+            rois.adc_words = adc_words.data();
+            rois.adc_offset = adc_offset_ptr + first_roi;
+            rois.num_rois = roi_offset_ptr[event + 1] - first_roi;
+            first_frames[event] = decoder::light::FirstFrame(rois.frame_number, rois.num_rois);
+            decoder::light::Reconstruct(rois, first_frames[event], geometry,
+                                        waveforms.data() + event * geometry.NumWaveformSamples());
         }
     }
-    return to_numpy_array_1d(channel_full_waveform);
+
+    const size_t num_samples = geometry.NumSamples();
+    auto *owned = new std::vector<uint16_t>(std::move(waveforms));
+    py::capsule free_when_done(owned, [](void *ptr) { delete static_cast<std::vector<uint16_t> *>(ptr); });
+    py::array_t<uint16_t> waveform_array({num_events, num_channels, num_samples},
+        {num_channels * num_samples * sizeof(uint16_t), num_samples * sizeof(uint16_t), sizeof(uint16_t)},
+        owned->data(), free_when_done);
+    return py::make_tuple(waveform_array, vector_to_numpy_array_1d(std::move(first_frames)));
 }
 
 py::array_t<double> ExtReconstructLightAxis(double trig_frame, double trig_sample_clk64,
-    double min_frame_number, double time_size, bool relative_to_trigger) {
+    double min_frame_number, double time_size, bool relative_to_trigger, size_t num_frames) {
 
-    constexpr double samples_per_frame = 255 * 32; // timesize * 32MHz (64MHz clock ticks)
-    constexpr double light_sample_interval = 15.625;
+    const decoder::light::Geometry geometry = LightGeometry(1, num_frames, static_cast<size_t>(time_size));
+    std::vector<double> light_axis(geometry.NumSamples());
+    decoder::light::Axis(geometry, trig_frame, trig_sample_clk64, min_frame_number, relative_to_trigger,
+                         light_axis.data());
+    return vector_to_numpy_array_1d(std::move(light_axis));
+}
 
-    //######################
-    // Get buffer info
-    //const py::buffer_info buf_frame = frames.request();
-    //auto* frame_ptr = static_cast<double*>(buf_frame.ptr);
+// The charge_adc_packed arrays of an event dict back to the charge_adc_words array
+py::array_t<uint16_t> ExtUnpackAdcWords(py::array_t<uint8_t> &packed, py::array_t<uint64_t> &packed_offset,
+    py::array_t<uint64_t> &sample_offset) {
 
-    //const auto min_it = std::min_element(frame_ptr, frame_ptr + buf_frame.size);
-    // double min_frame_number = min_it != (frame_ptr + buf_frame.size) ? *min_it : 0;
+    const py::buffer_info buf_packed = packed.request();
+    const py::buffer_info buf_packed_offset = packed_offset.request();
+    const py::buffer_info buf_sample_offset = sample_offset.request();
+    if (buf_packed_offset.size != buf_sample_offset.size) throw py::value_error("offset arrays differ in size");
 
-    //const double frame_offset = (trig_frame - min_frame_number) * light_sample_interval;
-    double trigger_index = 0;
-    if (relative_to_trigger) {
-        const double frame_offset = (trig_frame - min_frame_number) * samples_per_frame; // frame(s) to 64MHz clock ticks
-        trigger_index = frame_offset + trig_sample_clk64; // in 64MHz clock ticks
-    }
+    auto* packed_ptr = static_cast<uint8_t*>(buf_packed.ptr);
+    auto* packed_offset_ptr = static_cast<uint64_t*>(buf_packed_offset.ptr);
+    auto* sample_offset_ptr = static_cast<uint64_t*>(buf_sample_offset.ptr);
 
-    std::array<double, 4 * static_cast<size_t>(samples_per_frame)> light_axis{};
-    double tick_idx = 0;
-    for (auto &tick : light_axis) {
-        tick = (tick_idx - trigger_index) * light_sample_interval;
-        tick_idx++;
+    WaveformArena arena;
+    for (ssize_t row = 0; row + 1 < buf_packed_offset.size; row++) {
+        const uint64_t first_byte = packed_offset_ptr[row];
+        const uint64_t last_byte = packed_offset_ptr[row + 1];
+        const uint64_t num_samples = sample_offset_ptr[row + 1] - sample_offset_ptr[row];
+        if (first_byte > last_byte || last_byte > static_cast<uint64_t>(buf_packed.size) ||
+            sample_offset_ptr[row + 1] < sample_offset_ptr[row] ||
+            !decoder::codec::DecodeAdc(packed_ptr + first_byte, last_byte - first_byte, num_samples,
+                                       arena.AllocateRow(num_samples))) {
+            throw py::value_error("could not unpack row " + std::to_string(row));
+        }
     }
-    return py::array_t(light_axis.size(), &light_axis[0]);
+    return arena_to_numpy_array_2d(arena);
 }
 
 PYBIND11_MODULE(decoder_bindings, m) {
@@ -83,11 +178,90 @@ PYBIND11_MODULE(decoder_bindings, m) {
         .def(py::init<const uint16_t, bool, const std::vector<uint16_t>, bool>(),
            py::arg("light_slot"), py::arg("use_charge_roi"), py::arg("channel_threshold"), py::arg("skip_beam_roi"))
         .def("open_file", &ProcessEvents::OpenFile, py::arg("filename"))
+        .def("open_run", &ProcessEvents::OpenRun, py::arg("run_number"), py::arg("directory") = ".")
+        .def("open_run_files", &ProcessEvents::OpenRunFiles, py::arg("file_names"))
+        .def("use_memory_map", &ProcessEvents::UseMemoryMap, py::arg("use_mmap"))
+        .def("follow_file", &ProcessEvents::FollowFile, py::arg("follow"), py::arg("poll_seconds") = 0.5,
+             py::arg("timeout_seconds") = 10.)
         .def("get_event", &ProcessEvents::GetEvent)
+        .def("start_prefetch", &ProcessEvents::StartPrefetch, py::arg("max_events_ahead") = 8)
+        .def("stop_prefetch", &ProcessEvents::StopPrefetch)
+        // for event in process: decodes ahead on a background thread while the loop body runs
+        .def("__iter__", [](ProcessEvents &self) -> ProcessEvents & {
+                 self.StartPrefetch();
+                 return self;
+             }, py::return_value_policy::reference_internal)
+        .def("__next__", [](ProcessEvents &self) {
+                 if (!self.GetEvent()) throw py::stop_iteration();
+                 return self.GetEventDict();
+             })
+        .def("build_event_index", &ProcessEvents::BuildEventIndex, py::arg("use_sidecar") = true)
+        .def("get_event_at", &ProcessEvents::GetEventAt, py::arg("event"))
+        .def("seek_event", &ProcessEvents::SeekEvent, py::arg("event"))
+        .def("num_indexed_events", &ProcessEvents::GetNumIndexedEvents)
+        .def("scan_headers", &ProcessEvents::ScanHeadersDict)
+        .def("set_num_threads", &ProcessEvents::SetNumThreads, py::arg("num_threads"))
+        .def("set_events_per_task", &ProcessEvents::SetEventsPerTask, py::arg("events_per_task"))
         .def("get_num_events", &ProcessEvents::GetNumEvents, py::arg("num_events"))
-        .def("charge_roi", &ProcessEvents::ChargeRoi)
-        .def("get_event_dict", &ProcessEvents::GetEventDict);
+        .def("charge_roi", static_cast<void (ProcessEvents::*)(uint16_t, const std::vector<uint16_t> &)>(&ProcessEvents::ChargeRoi))
+        .def("estimate_pedestals", &ProcessEvents::EstimatePedestals, py::arg("estimate_pedestals"))
+        .def("use_pedestal_thresholds", &ProcessEvents::UsePedestalThresholds, py::arg("use_pedestal_thresholds"),
+             py::arg("num_rms") = 5.)
+        .def("set_pedestal_min_events", &ProcessEvents::SetPedestalMinEvents, py::arg("min_events"))
+        .def("reset_pedestals", &ProcessEvents::ResetPedestals)
+        .def("get_pedestals", &ProcessEvents::GetPedestalsDict)
+        .def("save_pedestals", &ProcessEvents::SavePedestals, py::arg("filename"))
+        .def("load_pedestals", &ProcessEvents::LoadPedestals, py::arg("filename"))
+        .def("get_event_dict", &ProcessEvents::GetEventDict)
+        .def("get_events", &ProcessEvents::GetEventsDict, py::arg("num_events"))
+        .def("write_event_file", &ProcessEvents::WriteEventFile, py::arg("filename"), py::arg("events_per_chunk") = 1000,
+             py::arg("pack_adc_words") = false, py::arg("max_events") = SIZE_MAX)
+        .def("get_stats", &ProcessEvents::GetStatsDict)
+        .def("reset_stats", &ProcessEvents::ResetStats)
+        .def("enable_timing", &ProcessEvents::EnableTiming, py::arg("enable_timing"))
+        .def("verify_checksum", &ProcessEvents::VerifyChecksum, py::arg("verify_checksum"))
+        .def("pack_adc_words", &ProcessEvents::PackAdcWords, py::arg("pack_adc_words"))
+        .def("resync_on_error", &ProcessEvents::ResyncOnError, py::arg("resync_on_error"))
+        .def("get_resync_spans", &ProcessEvents::GetResyncSpansDict)
+        .def("set_event_filter", [](ProcessEvents &self, uint32_t min_event_number, uint32_t max_event_number,
+                                    const std::vector<uint16_t> &slots, uint32_t min_trigger_frame,
+                                    uint32_t max_trigger_frame, bool require_light_rois) {
+                 EventFilter event_filter;
+                 event_filter.min_event_number = min_event_number;
+                 event_filter.max_event_number = max_event_number;
+                 event_filter.slot_mask = EventFilter::SlotMask(slots);
+                 event_filter.min_trigger_frame = min_trigger_frame;
+                 event_filter.max_trigger_frame = max_trigger_frame;
+                 event_filter.require_light_rois = require_light_rois;
+                 self.SetEventFilter(event_filter);
+             }, py::arg("min_event_number") = 0, py::arg("max_event_number") = UINT32_MAX,
+             py::arg("slots") = std::vector<uint16_t>{}, py::arg("min_trigger_frame") = 0,
+             py::arg("max_trigger_frame") = UINT32_MAX, py::arg("require_light_rois") = false)
+        .def("clear_event_filter", [](ProcessEvents &self) { self.SetEventFilter(EventFilter{}); })
+        .def("set_event_stride", [](ProcessEvents &self, size_t event_stride) {
+                 self.UseEventStride(event_stride > 1);
+                 self.SetEventStride(event_stride);
+             }, py::arg("event_stride"));
+
+    py::class_<EventFileReader>(m, "EventFile")
+        .def(py::init<>())
+        .def("open", &EventFileReader::Open, py::arg("filename"))
+        .def("close", &EventFileReader::Close)
+        .def("num_chunks", &EventFileReader::NumChunks)
+        .def("num_events", &EventFileReader::NumEvents)
+        .def("chunk_num_events", &EventFileReader::ChunkNumEvents, py::arg("chunk"))
+        .def("get_chunk", &EventFileReader::GetChunkDict, py::arg("chunk"));
 
-        m.def("get_full_light_waveform", &ExtReconstructLightWaveforms);
-        m.def("get_full_light_axis", &ExtReconstructLightAxis);
+        m.def("get_full_light_waveform", &ExtReconstructLightWaveforms, py::arg("channel"), py::arg("channels"),
+              py::arg("min_frame_number"), py::arg("samples"), py::arg("frames"), py::arg("adc_words"),
+              py::arg("time_size") = 255, py::arg("num_frames") = 4);
+        m.def("get_light_waveforms", &ExtReconstructAllLightWaveforms, py::arg("channels"), py::arg("samples"),
+              py::arg("frames"), py::arg("adc_words"), py::arg("min_frame_number") = py::none(),
+              py::arg("time_size") = 255, py::arg("num_frames") = 4, py::arg("num_channels") = 32);
+        m.def("get_batch_light_waveforms", &ExtReconstructBatchLightWaveforms, py::arg("batch"),
+              py::arg("time_size") = 255, py::arg("num_frames") = 4, py::arg("num_channels") = 32);
+        m.def("unpack_adc_words", &ExtUnpackAdcWords, py::arg("packed"), py::arg("packed_offset"), py::arg("sample_offset"));
+        m.def("get_full_light_axis", &ExtReconstructLightAxis, py::arg("trig_frame"), py::arg("trig_sample"),
+              py::arg("min_frame_number"), py::arg("time_size") = 255, py::arg("relative_to_trigger") = true,
+              py::arg("num_frames") = 4);
 }
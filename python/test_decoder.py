@@ -1,20 +1,185 @@
+"""
+Tests of the python bindings on a synthetic file from generate_fem_data, run with
+pytest python/test_decoder.py or python python/test_decoder.py. The generator is
+found with GENERATE_FEM_DATA or in build/ from the root directory.
+"""
+import os
+import subprocess
+import tempfile
+
+import numpy as np
+
 import decoder_bindings
 
-process = decoder_bindings.ProcessEvents(light_slot=16)
+NUM_EVENTS = 40
+LIGHT_SLOT = 16
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+GENERATOR = os.environ.get("GENERATE_FEM_DATA", os.path.join(ROOT_DIR, "build", "generate_fem_data"))
+
+_data_dir = tempfile.TemporaryDirectory()
+_data_files = {}
+
+
+def data_file(samples_per_channel=763):
+    if samples_per_channel not in _data_files:
+        file_name = os.path.join(_data_dir.name, "test_decoder_%d.dat" % samples_per_channel)
+        subprocess.run([GENERATOR, file_name, "--events", str(NUM_EVENTS), "--samples", str(samples_per_channel)],
+                       check=True)
+        _data_files[samples_per_channel] = file_name
+    return _data_files[samples_per_channel]
+
+
+def make_process(use_charge_roi=False, threshold=0, samples_per_channel=763):
+    process = decoder_bindings.ProcessEvents(light_slot=LIGHT_SLOT, use_charge_roi=use_charge_roi,
+                                             channel_threshold=[threshold] * 64, skip_beam_roi=False)
+    process.open_file(data_file(samples_per_channel))
+    return process
+
+
+def get_event_loop():
+    process = make_process()
+    events = []
+    while process.get_event():
+        events.append(process.get_event_dict())
+    return events
+
+
+def assert_dicts_equal(lhs, rhs):
+    assert lhs.keys() == rhs.keys()
+    for key in lhs:
+        np.testing.assert_array_equal(np.asarray(lhs[key]), np.asarray(rhs[key]), err_msg=key)
+
+
+def test_get_event():
+    assert len(get_event_loop()) == NUM_EVENTS
+
+
+def test_iterate():
+    # for event in process decodes on the prefetch thread, it must give the same events as get_event()
+    events = get_event_loop()
+    process = make_process()
+    num_events = 0
+    for event, expected in zip(process, events):
+        assert_dicts_equal(event, expected)
+        num_events += 1
+    assert num_events == NUM_EVENTS
+    # The iterator is exhausted once the file is
+    assert next(iter(process), None) is None
+
+
+def test_stop_prefetch():
+    # Stopping the prefetch part way through continues with the next event on the calling thread
+    events = get_event_loop()
+    process = make_process()
+    iterator = iter(process)
+    for expected in events[:NUM_EVENTS // 2]:
+        assert_dicts_equal(next(iterator), expected)
+    process.stop_prefetch()
+    for expected in events[NUM_EVENTS // 2:]:
+        assert process.get_event()
+        assert_dicts_equal(process.get_event_dict(), expected)
+    assert not process.get_event()
+
+
+def test_light_waveforms():
+    time_size, num_frames = 255, 4
+    num_samples = num_frames * time_size * 32
+    rois = None
+    for event in get_event_loop():
+        if len(event["light_channel"]) == 0:
+            continue
+        rois = event["light_channel"], event["light_readout_sample"], event["light_frame_number"], event["light_adc_words"]
+        channels, samples, frames, adc_words = rois
+        waveforms = decoder_bindings.get_light_waveforms(channels, samples, frames, adc_words,
+                                                         time_size=time_size, num_frames=num_frames)
+        assert waveforms.shape == (32, num_samples)
+
+        # One channel at a time gives the same rows, also from float arrays as the old signature took
+        min_frame = int(frames.min())
+        for channel in map(int, np.unique(channels)):
+            waveform = decoder_bindings.get_full_light_waveform(channel, channels, min_frame, samples, frames,
+                                                                adc_words, time_size=time_size,
+                                                                num_frames=num_frames)
+            np.testing.assert_array_equal(waveform, waveforms[channel])
+            waveform = decoder_bindings.get_full_light_waveform(channel, channels, min_frame,
+                                                                samples.astype(np.float64),
+                                                                frames.astype(np.float64), adc_words)
+            np.testing.assert_array_equal(waveform, waveforms[channel])
+    assert rois is not None
+
+    # time_size and num_frames set the waveform length
+    waveforms = decoder_bindings.get_light_waveforms(*rois, time_size=100, num_frames=2, num_channels=16)
+    assert waveforms.shape == (16, 2 * 100 * 32)
+
+
+def test_charge_roi_rows():
+    # ROIs cut short by the start or end of their waveform make the rows ragged, every row is
+    # padded to the longest with 2^16-1 and none is cut
+    batch = make_process(use_charge_roi=True, threshold=2100, samples_per_channel=300).get_events(NUM_EVENTS)
+    rows = np.split(batch["charge_adc_words"], batch["charge_adc_offset"][1:-1])
+    idx_rows = np.split(batch["charge_adc_idx"], batch["charge_adc_offset"][1:-1])
+    process = make_process(use_charge_roi=True, threshold=2100, samples_per_channel=300)
+    num_ragged = 0
+    for event in range(NUM_EVENTS):
+        assert process.get_event()
+        event_dict = process.get_event_dict()
+        first, last = batch["charge_offset"][event], batch["charge_offset"][event + 1]
+        lengths = [len(row) for row in rows[first:last]]
+        if not lengths:
+            continue
+        num_ragged += min(lengths) != max(lengths)
+        for name, expected_rows in (("charge_adc_words", rows[first:last]), ("charge_adc_idx", idx_rows[first:last])):
+            padded = event_dict[name]
+            assert padded.shape == (len(lengths), max(lengths))
+            for row, expected in zip(padded, expected_rows):
+                np.testing.assert_array_equal(row[:len(expected)], expected)
+                assert np.all(row[len(expected):] == 0xFFFF)
+    assert num_ragged > 0
+
+
+def check_event_file(pack_adc_words):
+    file_name = os.path.join(_data_dir.name, "test_decoder_packed.evf" if pack_adc_words else "test_decoder.evf")
+    events_per_chunk = 16
+    process = make_process()
+    process.write_event_file(file_name, events_per_chunk=events_per_chunk, pack_adc_words=pack_adc_words)
+
+    event_file = decoder_bindings.EventFile()
+    assert event_file.open(file_name)
+    assert event_file.num_events() == NUM_EVENTS
+    assert event_file.num_chunks() == (NUM_EVENTS + events_per_chunk - 1) // events_per_chunk
+
+    process = make_process()
+    for chunk in range(event_file.num_chunks()):
+        num_events = event_file.chunk_num_events(chunk)
+        batch = process.get_events(num_events)
+        assert_dicts_equal(event_file.get_chunk(chunk), batch)
+    event_file.close()
+
+
+def test_event_file():
+    check_event_file(pack_adc_words=False)
+
+
+def test_event_file_packed():
+    check_event_file(pack_adc_words=True)
+
 
-test_file = "/Users/jonsensenig/work/grams/daq_ana/jon_test/pGRAMS_bin_992.dat"
-process.open_file(test_file)
+def test_unpack_adc_words():
+    events = get_event_loop()
+    process = make_process()
+    process.pack_adc_words(True)
+    for expected in events:
+        assert process.get_event()
+        event = process.get_event_dict()
+        charge_adc_words = decoder_bindings.unpack_adc_words(event["charge_adc_packed"],
+                                                             event["charge_adc_packed_offset"],
+                                                             event["charge_adc_sample_offset"])
+        np.testing.assert_array_equal(charge_adc_words, expected["charge_adc_words"])
 
-# Can either set the number of events to read
-# if the end of file is reached before number of
-# requested events, then it will just stop and close file
-num_events = 5
-process.get_num_events(num_events)
 
-# ..OR iterate through file, one event at a time
-# it will return False until the last event is processed
-# in which case it will return True
-event_num = 0
-while process.get_event():
-    print(event_num)
-    event_num += 1
+if __name__ == "__main__":
+    for name, test in list(globals().items()):
+        if name.startswith("test_") and callable(test):
+            test()
+            print(name, "passed")
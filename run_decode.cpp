@@ -1,25 +1,338 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include "src/process_events.h"
-// #include <pybind11/embed.h>
 
-int main() {
+#ifdef USE_PYBIND11
+    #include <pybind11/embed.h>
+#endif
 
-    // Make sure the python interpreter is initialized
-    // py::scoped_interpreter guard;
+/*
+ * Batch decode of a list of data files and runs into event files (see EventFileWriter).
+ *
+ * Each input becomes one or more work units which are decoded by up to N worker
+ * processes at a time, each forked for one unit. A file larger than the shard size
+ * is split by event range using its event index (built, and saved as the .idx
+ * sidecar, on the first pass). The files of a run are one unit decoded as a single
+ * stream, so the events split across two files stay whole.
+ *
+ * Every unit writes its own event file into the output directory,
+ *   <file>.evf, <file>_<first>-<end>.evf for an event range [first, end), run_<N>.evf
+ * which are merged in input order with --merge. At the end the aggregate throughput
+ * of all the workers is reported.
+ */
 
-    const uint16_t light_slot = 16;
-    const bool use_charge_roi = false;
-    const std::vector<uint16_t> channel_threshold(64, 0);
-    const bool skip_beam_roi = false;
-    ProcessEvents events(light_slot, use_charge_roi, channel_threshold, skip_beam_roi);
+namespace {
+    using Clock = std::chrono::steady_clock;
 
-    // const std::string filename = "/Users/jonsensenig/work/grams/daq_ana/jon_test/pGRAMS_bin_992.dat";
-    // const std::string filename = "/home/pgrams/data/nov2025_integration_data/pGRAMS_bin_435_0.dat";
-    const std::string filename = "/home/pgrams/data/sabertooth2_data/data/readout_data/pGRAMS_bin_196_0.dat";
-    events.OpenFile(filename);
-    events.GetNumEvents(5);
+    struct Options {
+        std::vector<std::string> inputs;
+        size_t num_workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        std::string output_dir = ".";
+        std::string run_dir = ".";
+        size_t shard_mb = 512;
+        uint16_t light_slot = 16;
+        bool use_charge_roi = false;
+        uint16_t charge_threshold = 0;
+        std::string pedestal_file;
+        bool pack_adc_words = false;
+        size_t events_per_chunk = 1000;
+        std::string merge_file;
+        bool verbose = false;
+    };
 
-    // for (size_t i = 0; i < 10; i++) { std::cout << i << " "; events.GetEvent(); }
+    struct WorkUnit {
+        std::vector<std::string> files; // one file, or the files of a run
+        size_t first_event = 0;
+        size_t end_event = SIZE_MAX;    // for a shard of a file
+        std::string output;
+    };
 
+    // Sent back from a worker through a pipe
+    struct UnitResult {
+        uint64_t events = 0;
+        uint64_t words = 0;
+        uint8_t ok = 0;
+    };
+
+    void PrintUsage() {
+        std::cout << "Usage: run_raw_decoder [options] input...\n"
+                  << "  input                 a data file, run:<N> for the files of run N in --run-dir,\n"
+                  << "                        or @list.txt with one input per line\n"
+                  << "  -j N                  worker processes (default: the number of cores)\n"
+                  << "  -o DIR                output directory (default: .)\n"
+                  << "  --run-dir DIR         where the run files are (default: .)\n"
+                  << "  --shard-mb N          split files larger than N MB by event range (default 512, 0 = never)\n"
+                  << "  --light-slot N        slot of the light FEM (default 16)\n"
+                  << "  --charge-roi T        keep only the charge ROIs above threshold T\n"
+                  << "  --pedestals FILE      charge ROI thresholds from a pedestal table (see save_pedestals)\n"
+                  << "  --pack                compress the ADC words in the event files\n"
+                  << "  --events-per-chunk N  events per event file chunk (default 1000)\n"
+                  << "  --merge FILE          merge the outputs, in input order, into one event file\n"
+                  << "  -v                    keep the decoder output of the workers" << std::endl;
+    }
+
+    std::string Stem(const std::string &file_name) {
+        const size_t slash = file_name.find_last_of('/');
+        std::string stem = slash == std::string::npos ? file_name : file_name.substr(slash + 1);
+        const size_t dot = stem.find_last_of('.');
+        return dot == std::string::npos ? stem : stem.substr(0, dot);
+    }
+
+    size_t FileSize(const std::string &file_name) {
+        std::ifstream file(file_name, std::ios::binary | std::ios::ate);
+        return file ? static_cast<size_t>(file.tellg()) : 0;
+    }
+
+    bool ParseArgs(const int argc, char **argv, Options &options) {
+        auto next = [&](int &i) -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            const char *value = nullptr;
+            if (arg.empty()) continue;
+            if (arg == "--help" || arg == "-h") return false;
+            if (arg == "-v") options.verbose = true;
+            else if (arg == "--pack") options.pack_adc_words = true;
+            else if (arg[0] != '-') options.inputs.push_back(arg);
+            else if ((value = next(i)) == nullptr) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            else if (arg == "-j") options.num_workers = std::max<size_t>(std::strtoul(value, nullptr, 10), 1);
+            else if (arg == "-o") options.output_dir = value;
+            else if (arg == "--run-dir") options.run_dir = value;
+            else if (arg == "--shard-mb") options.shard_mb = std::strtoul(value, nullptr, 10);
+            else if (arg == "--light-slot") options.light_slot = static_cast<uint16_t>(std::strtoul(value, nullptr, 10));
+            else if (arg == "--charge-roi") {
+                options.use_charge_roi = true;
+                options.charge_threshold = static_cast<uint16_t>(std::strtoul(value, nullptr, 10));
+            }
+            else if (arg == "--pedestals") {
+                options.use_charge_roi = true;
+                options.pedestal_file = value;
+            }
+            else if (arg == "--events-per-chunk") options.events_per_chunk = std::strtoul(value, nullptr, 10);
+            else if (arg == "--merge") options.merge_file = value;
+            else {
+                std::cerr << "Unknown option " << arg << std::endl;
+                return false;
+            }
+        }
+        return !options.inputs.empty();
+    }
+
+    // Expand the inputs into work units, splitting large files by event range
+    bool PlanUnits(const Options &options, std::vector<WorkUnit> &units) {
+        std::vector<std::string> inputs;
+        for (const auto &input : options.inputs) {
+            if (input[0] != '@') {
+                inputs.push_back(input);
+                continue;
+            }
+            std::ifstream list(input.substr(1));
+            if (!list) {
+                std::cerr << "Could not open input list " << input.substr(1) << std::endl;
+                return false;
+            }
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line[0] != '#') inputs.push_back(line);
+            }
+        }
+
+        const size_t shard_bytes = options.shard_mb * 1000000;
+        for (const auto &input : inputs) {
+            if (input.rfind("run:", 0) == 0) {
+                const size_t run_number = std::strtoul(input.c_str() + 4, nullptr, 10);
+                WorkUnit unit;
+                unit.files = RunReader::FindRunFiles(options.run_dir, run_number);
+                if (unit.files.empty()) {
+                    std::cerr << "No files for run " << run_number << " in " << options.run_dir << std::endl;
+                    return false;
+                }
+                unit.output = options.output_dir + "/run_" + std::to_string(run_number) + ".evf";
+                units.push_back(std::move(unit));
+                continue;
+            }
+
+            if (shard_bytes == 0 || FileSize(input) <= shard_bytes) {
+                units.push_back({{input}, 0, SIZE_MAX, options.output_dir + "/" + Stem(input) + ".evf"});
+                continue;
+            }
+            // Split at event boundaries into shards of about shard_bytes
+            ProcessEvents events(options.light_slot, false, {}, false);
+            if (!events.OpenFile(input) || !events.BuildEventIndex()) return false;
+            const EventIndex &index = events.GetEventIndex();
+            if (index.Empty()) {
+                units.push_back({{input}, 0, SIZE_MAX, options.output_dir + "/" + Stem(input) + ".evf"});
+                continue;
+            }
+            size_t first_event = 0;
+            for (size_t event = 0; event < index.NumEvents(); event++) {
+                const uint64_t shard_words = index.At(event).end_word + 1 - index.At(first_event).start_word;
+                if (shard_words * sizeof(uint32_t) < shard_bytes && event + 1 < index.NumEvents()) continue;
+                const size_t end_event = event + 1;
+                units.push_back({{input}, first_event, end_event,
+                                 options.output_dir + "/" + Stem(input) + "_" + std::to_string(first_event) + "-" +
+                                 std::to_string(end_event) + ".evf"});
+                first_event = end_event;
+            }
+        }
+        return true;
+    }
+
+    UnitResult DecodeUnit(const Options &options, const WorkUnit &unit) {
+        UnitResult result;
+        ProcessEvents events(options.light_slot, options.use_charge_roi,
+                             std::vector<uint16_t>(PedestalTracker::num_channels_, options.charge_threshold), false);
+        if (!options.pedestal_file.empty()) {
+            if (!events.LoadPedestals(options.pedestal_file)) return result;
+            events.UsePedestalThresholds(true);
+        }
+
+        bool ok;
+        if (unit.files.size() > 1) {
+            ok = events.OpenRunFiles(unit.files);
+        } else {
+            ok = events.OpenFile(unit.files.front());
+            if (ok && unit.first_event > 0) ok = events.SeekEvent(unit.first_event);
+            // A shard ends where the next one starts, however many of its events are dropped as corrupt
+            if (ok && unit.end_event != SIZE_MAX) ok = events.SetEndEvent(unit.end_event);
+        }
+        if (ok) ok = events.WriteEventFile(unit.output, options.events_per_chunk, options.pack_adc_words);
+        const DecoderStats stats = events.GetStats();
+        result.events = stats.events;
+        result.words = stats.words_scanned;
+        result.ok = ok;
+        return result;
+    }
+
+    // Run the units on up to num_workers forked processes, results are in unit order
+    std::vector<UnitResult> RunWorkers(const Options &options, const std::vector<WorkUnit> &units) {
+        struct Worker {
+            pid_t pid;
+            int pipe_fd;
+            size_t unit;
+        };
+        std::vector<UnitResult> results(units.size());
+        std::vector<Worker> running;
+        size_t next_unit = 0;
+
+        while (next_unit < units.size() || !running.empty()) {
+            while (next_unit < units.size() && running.size() < options.num_workers) {
+                int fds[2];
+                if (pipe(fds) != 0) {
+                    std::cerr << "Could not create a pipe for unit " << next_unit << std::endl;
+                    next_unit++;
+                    continue;
+                }
+                std::cout.flush();
+                const pid_t pid = fork();
+                if (pid == 0) {
+                    close(fds[0]);
+                    if (!options.verbose) {
+                        const int null_fd = open("/dev/null", O_WRONLY);
+                        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+                    }
+                    const UnitResult result = DecodeUnit(options, units[next_unit]);
+                    std::cout.flush();
+                    const bool sent = write(fds[1], &result, sizeof(result)) == sizeof(result);
+                    close(fds[1]);
+                    _exit(result.ok && sent ? 0 : 1);
+                }
+                close(fds[1]);
+                if (pid < 0) {
+                    std::cerr << "Could not start a worker for unit " << next_unit << std::endl;
+                    close(fds[0]);
+                    next_unit++;
+                    continue;
+                }
+                running.push_back({pid, fds[0], next_unit++});
+            }
+
+            int status;
+            const pid_t pid = wait(&status);
+            if (pid < 0) break;
+            const auto worker = std::find_if(running.begin(), running.end(),
+                                             [pid](const Worker &w) { return w.pid == pid; });
+            if (worker == running.end()) continue;
+            UnitResult &result = results[worker->unit];
+            if (read(worker->pipe_fd, &result, sizeof(result)) != sizeof(result)) result = UnitResult{};
+            close(worker->pipe_fd);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) result.ok = 0;
+
+            const WorkUnit &unit = units[worker->unit];
+            std::printf("[%zu/%zu] %s %s, %llu events\n", worker->unit + 1, units.size(), unit.output.c_str(),
+                        result.ok ? "done" : "FAILED", static_cast<unsigned long long>(result.events));
+            std::fflush(stdout);
+            running.erase(worker);
+        }
+        return results;
+    }
+
+    bool MergeOutputs(const std::vector<WorkUnit> &units, const std::string &merge_file, const bool pack_adc_words) {
+        EventFileWriter writer;
+        if (!writer.Open(merge_file, pack_adc_words)) return false;
+        EventBatch batch;
+        for (const auto &unit : units) {
+            EventFileReader reader;
+            if (!reader.Open(unit.output)) return false;
+            for (size_t chunk = 0; chunk < reader.NumChunks(); chunk++) {
+                if (!reader.ReadChunk(chunk, batch) || !writer.WriteChunk(batch)) return false;
+            }
+        }
+        std::cout << "Merged " << writer.NumEvents() << " events into " << merge_file << std::endl;
+        return writer.Close();
+    }
+}
+
+int main(const int argc, char **argv) {
+#ifdef USE_PYBIND11
+    // The decoder builds python objects when compiled for python
+    py::scoped_interpreter guard;
+#endif
+
+    Options options;
+    if (!ParseArgs(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    const auto start = Clock::now();
+    std::vector<WorkUnit> units;
+    if (!PlanUnits(options, units)) return 1;
+    std::printf("Decoding %zu units on %zu workers\n", units.size(),
+                std::min(options.num_workers, units.size()));
+    std::fflush(stdout);
+
+    const std::vector<UnitResult> results = RunWorkers(options, units);
+    const double seconds = std::max(std::chrono::duration<double>(Clock::now() - start).count(), 1e-9);
+
+    uint64_t events = 0;
+    uint64_t bytes = 0;
+    size_t num_failed = 0;
+    for (const auto &result : results) {
+        events += result.events;
+        bytes += result.words * sizeof(uint32_t);
+        num_failed += !result.ok;
+    }
+    std::printf("\nDecoded %llu events, %.1f MB in %.2f s: %.1f MB/s, %.1f events/s\n",
+                static_cast<unsigned long long>(events), static_cast<double>(bytes) / 1e6, seconds,
+                static_cast<double>(bytes) / 1e6 / seconds, static_cast<double>(events) / seconds);
+    if (num_failed > 0) {
+        std::printf("%zu of %zu units failed\n", num_failed, units.size());
+        return 1;
+    }
+
+    if (!options.merge_file.empty() && !MergeOutputs(units, options.merge_file, options.pack_adc_words)) return 1;
     return 0;
 }
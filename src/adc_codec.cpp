@@ -0,0 +1,115 @@
+#include "adc_codec.h"
+#include "adc_kernels.h"
+#include <algorithm>
+
+namespace {
+    constexpr uint8_t delta_coded_ = 0x80;
+    constexpr uint8_t width_mask_ = 0x1F;
+
+    unsigned BitWidth(const uint16_t value) {
+        return value == 0 ? 0 : 32 - __builtin_clz(value);
+    }
+
+    size_t PackedSize(const size_t num_values, const unsigned width) {
+        return (num_values * width + 7) / 8;
+    }
+
+    // The values are width bits wide, packed LSB first
+    void PackBits(const uint16_t *values, const size_t num_values, const unsigned width, uint8_t *out) {
+        uint64_t acc = 0;
+        unsigned num_bits = 0;
+        for (size_t idx = 0; idx < num_values; idx++) {
+            acc |= static_cast<uint64_t>(values[idx]) << num_bits;
+            num_bits += width;
+            while (num_bits >= 8) {
+                *out++ = static_cast<uint8_t>(acc);
+                acc >>= 8;
+                num_bits -= 8;
+            }
+        }
+        if (num_bits > 0) *out = static_cast<uint8_t>(acc);
+    }
+
+    void UnpackBits(const uint8_t *in, const size_t num_values, const unsigned width, uint16_t *values) {
+        const uint64_t mask = (uint64_t{1} << width) - 1;
+        uint64_t acc = 0;
+        unsigned num_bits = 0;
+        for (size_t idx = 0; idx < num_values; idx++) {
+            while (num_bits < width) {
+                acc |= static_cast<uint64_t>(*in++) << num_bits;
+                num_bits += 8;
+            }
+            values[idx] = static_cast<uint16_t>(acc & mask);
+            acc >>= width;
+            num_bits -= width;
+        }
+    }
+}
+
+namespace decoder::codec {
+
+    size_t MaxEncodedSize(const size_t num_samples) {
+        // A block never takes more than its header and 16b per sample
+        return (num_samples + block_size_ - 1) / block_size_ + num_samples * sizeof(uint16_t);
+    }
+
+    size_t EncodeAdc(const uint16_t *samples, const size_t num_samples, std::vector<uint8_t> &out) {
+        const size_t start = out.size();
+        out.resize(start + MaxEncodedSize(num_samples));
+        uint8_t *dst = out.data() + start;
+
+        uint16_t zigzag[block_size_];
+        for (size_t first = 0; first < num_samples; first += block_size_) {
+            const size_t block_samples = std::min(block_size_, num_samples - first);
+            const uint16_t *block = samples + first;
+
+            const unsigned raw_width = BitWidth(kernels::OrWords(block, block_samples));
+            const unsigned delta_width = BitWidth(kernels::ZigzagDeltas(block, block_samples, zigzag));
+            const size_t raw_size = PackedSize(block_samples, raw_width);
+            const size_t delta_size = sizeof(uint16_t) + PackedSize(block_samples - 1, delta_width);
+
+            if (delta_size < raw_size) {
+                *dst++ = static_cast<uint8_t>(delta_coded_ | delta_width);
+                *dst++ = static_cast<uint8_t>(block[0] & 0xFF);
+                *dst++ = static_cast<uint8_t>(block[0] >> 8);
+                PackBits(zigzag, block_samples - 1, delta_width, dst);
+                dst += delta_size - sizeof(uint16_t);
+            } else {
+                *dst++ = static_cast<uint8_t>(raw_width);
+                PackBits(block, block_samples, raw_width, dst);
+                dst += raw_size;
+            }
+        }
+        out.resize(static_cast<size_t>(dst - out.data()));
+        return out.size() - start;
+    }
+
+    bool DecodeAdc(const uint8_t *in, const size_t num_bytes, const size_t num_samples, uint16_t *samples) {
+        uint16_t zigzag[block_size_];
+        size_t pos = 0;
+        for (size_t first = 0; first < num_samples; first += block_size_) {
+            const size_t block_samples = std::min(block_size_, num_samples - first);
+            if (pos >= num_bytes) return false;
+            const uint8_t header = in[pos++];
+            const unsigned width = header & width_mask_;
+            if (width > 16 || (header & ~(delta_coded_ | width_mask_)) != 0) return false;
+
+            if (header & delta_coded_) {
+                const size_t size = PackedSize(block_samples - 1, width);
+                if (pos + sizeof(uint16_t) + size > num_bytes) return false;
+                const auto first_value = static_cast<uint16_t>(in[pos] | (in[pos + 1] << 8));
+                pos += sizeof(uint16_t);
+                UnpackBits(in + pos, block_samples - 1, width, zigzag);
+                kernels::ZigzagPrefixSum(first_value, zigzag, block_samples, samples + first);
+                pos += size;
+            } else {
+                const size_t size = PackedSize(block_samples, width);
+                if (pos + size > num_bytes) return false;
+                UnpackBits(in + pos, block_samples, width, samples + first);
+                pos += size;
+            }
+        }
+        return pos == num_bytes;
+    }
+
+} // decoder::codec namespace
@@ -0,0 +1,37 @@
+#ifndef ADC_CODEC_H
+#define ADC_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Lossless compression of ADC waveforms.
+ *
+ * The samples are coded in blocks of up to 128, each block on its own so a
+ * waveform can be cut anywhere. A block is either bit packed as is (the 12b ADC
+ * values take 12b instead of 16b) or, when it is smaller, as its first value
+ * followed by the zigzag coded differences between neighbouring samples, bit
+ * packed to the width of the largest. On a flat charge baseline the differences
+ * are the noise, typically 2-3b per sample.
+ *
+ *   block:  1B header (0x80 if delta coded | bit width), [16b first value if delta coded],
+ *           the packed values LSB first, padded to a whole byte
+ *
+ * The differences and the prefix sum undoing them are vectorized (SSE2/NEON).
+ * Any 16b values round trip, including the UINT16_MAX padding of light ROIs.
+ */
+namespace decoder::codec {
+
+    static constexpr size_t block_size_ = 128;
+
+    // Upper bound of the size of num_samples encoded samples
+    size_t MaxEncodedSize(size_t num_samples);
+    // Append the encoded samples to out, returns the number of bytes added
+    size_t EncodeAdc(const uint16_t *samples, size_t num_samples, std::vector<uint8_t> &out);
+    // Decode the num_bytes encoding of num_samples samples, returns false if it is not a valid one
+    bool DecodeAdc(const uint8_t *in, size_t num_bytes, size_t num_samples, uint16_t *samples);
+
+} // decoder::codec namespace
+
+#endif //ADC_CODEC_H
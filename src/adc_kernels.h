@@ -0,0 +1,346 @@
+#ifndef ADC_KERNELS_H
+#define ADC_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
+
+/*
+ * Vectorized kernels for the hot loops over the data words. Each kernel has
+ * an SSE2 (x86-64) and NEON (Apple silicon / aarch64) version with a scalar loop
+ * for the tail and for any other architecture.
+ */
+namespace decoder::kernels {
+
+    // The 16b words are read straight out of the 32b file buffer, 32b = [16b_L, 16b_R]
+    // with the right word first in memory, so this only works on a little endian host.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+    #error "The decoder assumes a little endian host"
+#endif
+
+    // A plain ADC sample is non-zero (zero words are padding) with an empty top nibble,
+    // anything else is a channel marker, header or padding
+    inline bool IsPlainSample(const uint16_t word) { return word != 0 && (word & 0xF000) == 0; }
+
+    // Index of the first word in [0, num_words) which is not a plain ADC sample,
+    // or num_words if they all are. Used to find the charge channel end marker.
+    inline size_t FindNonSample(const uint16_t *words, const size_t num_words) {
+        size_t idx = 0;
+#if defined(__SSE2__)
+        const __m128i nibble = _mm_set1_epi16(static_cast<short>(0xF000));
+        const __m128i zero = _mm_setzero_si128();
+        for (; idx + 8 <= num_words; idx += 8) {
+            const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx));
+            const __m128i empty_nibble = _mm_cmpeq_epi16(_mm_and_si128(w, nibble), zero);
+            const __m128i is_sample = _mm_andnot_si128(_mm_cmpeq_epi16(w, zero), empty_nibble);
+            const int mask = _mm_movemask_epi8(is_sample);
+            if (mask != 0xFFFF) {
+                // 2 mask bits per 16b word
+                return idx + (__builtin_ctz(~mask & 0xFFFF) >> 1);
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint16x8_t nibble = vdupq_n_u16(0xF000);
+        for (; idx + 8 <= num_words; idx += 8) {
+            const uint16x8_t w = vld1q_u16(words + idx);
+            const uint16x8_t not_sample = vorrq_u16(vtstq_u16(w, nibble), vceqzq_u16(w));
+            if (vmaxvq_u16(not_sample) != 0) break; // the scalar loop finds which one
+        }
+#endif
+        for (; idx < num_words; idx++) {
+            if (!IsPlainSample(words[idx])) return idx;
+        }
+        return num_words;
+    }
+
+    // True if all N words are plain ADC samples. N is known at compile time and there is no
+    // early exit so the loop is fully unrolled, used to check a whole channel of known length.
+    template <size_t N>
+    inline bool AllPlainSamples(const uint16_t *words) {
+        size_t idx = 0;
+        bool all_samples = true;
+#if defined(__SSE2__)
+        const __m128i nibble = _mm_set1_epi16(static_cast<short>(0xF000));
+        const __m128i zero = _mm_setzero_si128();
+        __m128i is_sample = _mm_cmpeq_epi16(zero, zero);
+        for (; idx + 8 <= N; idx += 8) {
+            const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx));
+            const __m128i empty_nibble = _mm_cmpeq_epi16(_mm_and_si128(w, nibble), zero);
+            is_sample = _mm_and_si128(is_sample, _mm_andnot_si128(_mm_cmpeq_epi16(w, zero), empty_nibble));
+        }
+        all_samples = _mm_movemask_epi8(is_sample) == 0xFFFF;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint16x8_t nibble = vdupq_n_u16(0xF000);
+        uint16x8_t not_sample = vdupq_n_u16(0);
+        for (; idx + 8 <= N; idx += 8) {
+            const uint16x8_t w = vld1q_u16(words + idx);
+            not_sample = vorrq_u16(not_sample, vorrq_u16(vtstq_u16(w, nibble), vceqzq_u16(w)));
+        }
+        all_samples = vmaxvq_u16(not_sample) == 0;
+#endif
+        for (; idx < N; idx++) all_samples &= IsPlainSample(words[idx]);
+        return all_samples;
+    }
+
+    // Copy the ADC samples keeping only the 12b ADC value
+    inline void MaskAdcWords(const uint16_t *src, const size_t num_words, uint16_t *dst) {
+        size_t idx = 0;
+#if defined(__SSE2__)
+        const __m128i adc_mask = _mm_set1_epi16(0x0FFF);
+        for (; idx + 8 <= num_words; idx += 8) {
+            const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + idx));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + idx), _mm_and_si128(w, adc_mask));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint16x8_t adc_mask = vdupq_n_u16(0x0FFF);
+        for (; idx + 8 <= num_words; idx += 8) {
+            vst1q_u16(dst + idx, vandq_u16(vld1q_u16(src + idx), adc_mask));
+        }
+#endif
+        for (; idx < num_words; idx++) {
+            dst[idx] = src[idx] & 0x0FFF;
+        }
+    }
+
+    // Index of the first word in [begin, num_words) above threshold, or num_words if none are.
+    // SSE2 only has a signed 16b compare so both sides are offset by 0x8000 first.
+    inline size_t FindAboveThreshold(const uint16_t *words, const size_t begin, const size_t num_words,
+                                     const uint16_t threshold) {
+        size_t idx = begin;
+#if defined(__SSE2__)
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i thresh = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(threshold)), bias);
+        for (; idx + 8 <= num_words; idx += 8) {
+            const __m128i w = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx)), bias);
+            const int mask = _mm_movemask_epi8(_mm_cmpgt_epi16(w, thresh));
+            if (mask != 0) return idx + (__builtin_ctz(mask) >> 1);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint16x8_t thresh = vdupq_n_u16(threshold);
+        for (; idx + 8 <= num_words; idx += 8) {
+            if (vmaxvq_u16(vcgtq_u16(vld1q_u16(words + idx), thresh)) != 0) break;
+        }
+#endif
+        for (; idx < num_words; idx++) {
+            if (words[idx] > threshold) return idx;
+        }
+        return num_words;
+    }
+
+    // Sum of the 16b words, modulo 2^32 so any lower bits (e.g. the 24b FEM checksum) are exact.
+    // SSE2 only has a signed multiply-add so the words are offset by 0x8000 and it is added back after.
+    inline uint32_t SumWords(const uint16_t *words, const size_t num_words) {
+        size_t idx = 0;
+        uint32_t sum = 0;
+#if defined(__SSE2__)
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i acc = _mm_setzero_si128();
+        for (; idx + 8 <= num_words; idx += 8) {
+            const __m128i w = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx)), bias);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(w, ones));
+        }
+        alignas(16) uint32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+        sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] + static_cast<uint32_t>(idx) * 0x8000u;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; idx + 8 <= num_words; idx += 8) {
+            acc = vpadalq_u16(acc, vld1q_u16(words + idx));
+        }
+        sum = vaddvq_u32(acc);
+#endif
+        for (; idx < num_words; idx++) {
+            sum += words[idx];
+        }
+        return sum;
+    }
+
+    // Sum and sum of squares of 12b ADC samples. A pair of squares fits in a signed 32b lane so
+    // SSE2 multiply-adds them and widens to 64b each block, the sums are exact for any length.
+    inline void SumAndSquares(const uint16_t *samples, const size_t num_samples, uint64_t &sum, uint64_t &sum_sq) {
+        size_t idx = 0;
+        sum = 0;
+        sum_sq = 0;
+#if defined(__SSE2__)
+        const __m128i ones = _mm_set1_epi16(1);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc_sum = _mm_setzero_si128();
+        __m128i acc_sq = _mm_setzero_si128();
+        for (; idx + 8 <= num_samples; idx += 8) {
+            const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + idx));
+            const __m128i pair_sum = _mm_madd_epi16(s, ones);
+            const __m128i pair_sq = _mm_madd_epi16(s, s);
+            acc_sum = _mm_add_epi64(acc_sum, _mm_add_epi64(_mm_unpacklo_epi32(pair_sum, zero),
+                                                           _mm_unpackhi_epi32(pair_sum, zero)));
+            acc_sq = _mm_add_epi64(acc_sq, _mm_add_epi64(_mm_unpacklo_epi32(pair_sq, zero),
+                                                         _mm_unpackhi_epi32(pair_sq, zero)));
+        }
+        alignas(16) uint64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc_sum);
+        sum = lanes[0] + lanes[1];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc_sq);
+        sum_sq = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint64x2_t acc_sum = vdupq_n_u64(0);
+        uint64x2_t acc_sq = vdupq_n_u64(0);
+        for (; idx + 8 <= num_samples; idx += 8) {
+            const uint16x8_t s = vld1q_u16(samples + idx);
+            acc_sum = vpadalq_u32(acc_sum, vpaddlq_u16(s));
+            acc_sq = vpadalq_u32(acc_sq, vmull_u16(vget_low_u16(s), vget_low_u16(s)));
+            acc_sq = vpadalq_u32(acc_sq, vmull_high_u16(s, s));
+        }
+        sum = vaddvq_u64(acc_sum);
+        sum_sq = vaddvq_u64(acc_sq);
+#endif
+        for (; idx < num_samples; idx++) {
+            sum += samples[idx];
+            sum_sq += static_cast<uint64_t>(samples[idx]) * samples[idx];
+        }
+    }
+
+    // OR of the words, it has the bit width of the largest
+    inline uint16_t OrWords(const uint16_t *words, const size_t num_words) {
+        size_t idx = 0;
+        uint16_t bits = 0;
+#if defined(__SSE2__)
+        __m128i acc = _mm_setzero_si128();
+        for (; idx + 8 <= num_words; idx += 8) {
+            acc = _mm_or_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx)));
+        }
+        alignas(16) uint16_t lanes[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+        for (const uint16_t lane : lanes) bits |= lane;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint16x8_t acc = vdupq_n_u16(0);
+        for (; idx + 8 <= num_words; idx += 8) {
+            acc = vorrq_u16(acc, vld1q_u16(words + idx));
+        }
+        bits = vmaxvq_u16(acc); // same bit width as the OR of the lanes
+#endif
+        for (; idx < num_words; idx++) {
+            bits |= words[idx];
+        }
+        return bits;
+    }
+
+    // Zigzag coded differences between neighbouring words, zigzag[i] for words[i+1] - words[i],
+    // so num_words - 1 of them. The 16b difference wraps around, which the prefix sum undoes.
+    // Returns the OR of the coded differences.
+    inline uint16_t ZigzagDeltas(const uint16_t *words, const size_t num_words, uint16_t *zigzag) {
+        if (num_words < 2) return 0;
+        const size_t num_deltas = num_words - 1;
+        size_t idx = 0;
+        uint16_t bits = 0;
+#if defined(__SSE2__)
+        __m128i acc = _mm_setzero_si128();
+        for (; idx + 8 <= num_deltas; idx += 8) {
+            const __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx + 1));
+            const __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + idx));
+            const __m128i delta = _mm_sub_epi16(next, prev);
+            const __m128i coded = _mm_xor_si128(_mm_slli_epi16(delta, 1), _mm_srai_epi16(delta, 15));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(zigzag + idx), coded);
+            acc = _mm_or_si128(acc, coded);
+        }
+        alignas(16) uint16_t lanes[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), acc);
+        for (const uint16_t lane : lanes) bits |= lane;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        uint16x8_t acc = vdupq_n_u16(0);
+        for (; idx + 8 <= num_deltas; idx += 8) {
+            const uint16x8_t delta = vsubq_u16(vld1q_u16(words + idx + 1), vld1q_u16(words + idx));
+            const uint16x8_t sign = vreinterpretq_u16_s16(vshrq_n_s16(vreinterpretq_s16_u16(delta), 15));
+            const uint16x8_t coded = veorq_u16(vshlq_n_u16(delta, 1), sign);
+            vst1q_u16(zigzag + idx, coded);
+            acc = vorrq_u16(acc, coded);
+        }
+        bits = vmaxvq_u16(acc);
+#endif
+        for (; idx < num_deltas; idx++) {
+            const auto delta = static_cast<uint16_t>(words[idx + 1] - words[idx]);
+            const auto coded = static_cast<uint16_t>((delta << 1) ^ ((delta & 0x8000) ? 0xFFFF : 0));
+            zigzag[idx] = coded;
+            bits |= coded;
+        }
+        return bits;
+    }
+
+    // Undo ZigzagDeltas, words[0] = first and each word after it adds the next difference
+    inline void ZigzagPrefixSum(const uint16_t first, const uint16_t *zigzag, const size_t num_words, uint16_t *words) {
+        if (num_words == 0) return;
+        words[0] = first;
+        const size_t num_deltas = num_words - 1;
+        size_t idx = 0;
+        uint16_t prev = first;
+#if defined(__SSE2__)
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i zero = _mm_setzero_si128();
+        for (; idx + 8 <= num_deltas; idx += 8) {
+            const __m128i coded = _mm_loadu_si128(reinterpret_cast<const __m128i *>(zigzag + idx));
+            __m128i delta = _mm_xor_si128(_mm_srli_epi16(coded, 1), _mm_sub_epi16(zero, _mm_and_si128(coded, one)));
+            // In lane prefix sum in 3 shift and add steps, then carry in the last word
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+            const __m128i sum = _mm_add_epi16(delta, _mm_set1_epi16(static_cast<short>(prev)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(words + idx + 1), sum);
+            prev = static_cast<uint16_t>(_mm_extract_epi16(sum, 7));
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint16x8_t one = vdupq_n_u16(1);
+        const uint16x8_t zero = vdupq_n_u16(0);
+        for (; idx + 8 <= num_deltas; idx += 8) {
+            const uint16x8_t coded = vld1q_u16(zigzag + idx);
+            uint16x8_t delta = veorq_u16(vshrq_n_u16(coded, 1), vsubq_u16(zero, vandq_u16(coded, one)));
+            delta = vaddq_u16(delta, vextq_u16(zero, delta, 7));
+            delta = vaddq_u16(delta, vextq_u16(zero, delta, 6));
+            delta = vaddq_u16(delta, vextq_u16(zero, delta, 4));
+            const uint16x8_t sum = vaddq_u16(delta, vdupq_n_u16(prev));
+            vst1q_u16(words + idx + 1, sum);
+            prev = vgetq_lane_u16(sum, 7);
+        }
+#endif
+        for (; idx < num_deltas; idx++) {
+            const uint16_t coded = zigzag[idx];
+            prev = static_cast<uint16_t>(prev + ((coded >> 1) ^ (0 - (coded & 1))));
+            words[idx + 1] = prev;
+        }
+    }
+
+    // Index of the first 32b word in [begin, end) equal to value, or end if there is none. Used to
+    // find the next event marker, 16 words are compared per loop and the scalar loop finds which one.
+    inline size_t FindWord(const uint32_t *words, size_t begin, const size_t end, const uint32_t value) {
+#if defined(__SSE2__)
+        const __m128i target = _mm_set1_epi32(static_cast<int>(value));
+        for (; begin + 16 <= end; begin += 16) {
+            const auto *block = reinterpret_cast<const __m128i *>(words + begin);
+            const __m128i eq = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(block), target),
+                             _mm_cmpeq_epi32(_mm_loadu_si128(block + 1), target)),
+                _mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(block + 2), target),
+                             _mm_cmpeq_epi32(_mm_loadu_si128(block + 3), target)));
+            if (_mm_movemask_epi8(eq) != 0) break;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint32x4_t target = vdupq_n_u32(value);
+        for (; begin + 16 <= end; begin += 16) {
+            const uint32x4_t eq = vorrq_u32(
+                vorrq_u32(vceqq_u32(vld1q_u32(words + begin), target), vceqq_u32(vld1q_u32(words + begin + 4), target)),
+                vorrq_u32(vceqq_u32(vld1q_u32(words + begin + 8), target), vceqq_u32(vld1q_u32(words + begin + 12), target)));
+            if (vmaxvq_u32(eq) != 0) break;
+        }
+#endif
+        for (; begin < end; begin++) {
+            if (words[begin] == value) return begin;
+        }
+        return end;
+    }
+
+} // decoder::kernels namespace
+
+#endif //ADC_KERNELS_H
@@ -2,6 +2,7 @@
 // Created by Jon Sensenig on 3/12/25.
 //
 #include "charge_light_decoder.h"
+#include "adc_kernels.h"
 #include <iostream>
 
 namespace decoder {
@@ -11,6 +12,16 @@ namespace decoder {
         adc_word_array_.push_back(adc_word_t.adc_word);
     }
 
+    size_t Decoder::GetChargeAdcChunk(const uint16_t *words, const size_t max_words) {
+        const size_t num_samples = kernels::FindNonSample(words, max_words);
+        if (num_samples == 0) return 0;
+        // Size the buffer once for the whole run rather than growing it sample by sample
+        const size_t offset = adc_word_array_.size();
+        adc_word_array_.resize(offset + num_samples);
+        kernels::MaskAdcWords(words, num_samples, adc_word_array_.data() + offset);
+        return num_samples;
+    }
+
     bool Decoder::FemLightDecode(const uint16_t header_word) {
         // There are 3 header words, step through each fo them and get their info
         switch (LightWord) {
@@ -30,49 +41,77 @@ namespace decoder {
                 return true;
             }
             default: {
-                LightWord = 0;
                 std::cerr << "FemLightDecode: Unknown LightWord " << LightWord << std::endl;
+                LightWord = 0;
+                num_unknown_light_states_++;
                 return false;
             }
         }
     }
 
+    void Decoder::DecodeHeader1(const uint32_t word) {
+        const uint32_t header1 = word >> 16;
+        fem_header_.slot_number = static_cast<uint16_t>(header1 & 0x1F);
+        fem_header_.fem_id = static_cast<uint8_t>((header1 >> 5) & 0xF);
+        fem_header_.test = static_cast<uint8_t>((header1 >> 9) & 0x1);
+        fem_header_.overflow = static_cast<uint8_t>((header1 >> 10) & 0x1);
+        fem_header_.full = static_cast<uint8_t>((header1 >> 11) & 0x1);
+    }
+
+    void Decoder::DecodeHeader6(const uint32_t word) {
+        fem_header_.trig_sample_number = ((word & 0xF) << 8) | ((word >> 16) & 0xFF);
+        fem_header_.trig_frame_number_lower = (word >> 4) & 0xF;
+    }
+
+    const FemHeader &Decoder::DecodeFemHeader(const uint32_t *words) {
+        // No state machine and no branches, every field is at a fixed place
+        DecodeHeader1(words[0]);
+        fem_header_.num_adc_words = Header24(words[1]);
+        fem_header_.event_number = Header24(words[2]);
+        fem_header_.event_frame_number = Header24(words[3]);
+        fem_header_.checksum = Header24(words[4]);
+        DecodeHeader6(words[5]);
+        HeaderWord = 0;
+        return fem_header_;
+    }
+
     bool Decoder::FemHeaderDecode(const uint32_t header_word) {
         // There are 6 FEM header words, here we iterate through them
         switch (HeaderWord) {
             case 0: { // header 1
-                std::memcpy(&fem_header1_t, &header_word, sizeof(fem_header1_t));
+                DecodeHeader1(header_word);
                 HeaderWord++;
                 return false;
             }
             case 1: { // header 2
-                std::memcpy(&fem_header2_t, &header_word, sizeof(fem_header2_t));
+                fem_header_.num_adc_words = Header24(header_word);
                 HeaderWord++;
                 return false;
             }
             case 2: { // header 3
-                std::memcpy(&fem_header3_t, &header_word, sizeof(fem_header3_t));
+                fem_header_.event_number = Header24(header_word);
                 HeaderWord++;
                 return false;
             }
             case 3: { // header 4
-                std::memcpy(&fem_header4_t, &header_word, sizeof(fem_header4_t));
+                fem_header_.event_frame_number = Header24(header_word);
                 HeaderWord++;
                 return false;
             }
             case 4: { // header 5
-                std::memcpy(&fem_header5_t, &header_word, sizeof(fem_header5_t));
+                fem_header_.checksum = Header24(header_word);
                 HeaderWord++;
                 return false;
             }
             case 5: { // header 6
-                std::memcpy(&fem_header6_t, &header_word, sizeof(fem_header6_t));
+                DecodeHeader6(header_word);
                 HeaderWord = 0; // reset back to first wod
                 return true;
             }
             default: {
                 std::cerr << "Unknown Header Word: " << HeaderWord << std::endl;
                 HeaderWord = 0;
+                num_unknown_header_states_++;
                 return false;
             }
         }
@@ -80,13 +119,13 @@ namespace decoder {
 
     uint32_t Decoder::GetLightFrameNumber() const {
         const uint32_t frame_num = (GetTriggerFrameNumber() & 0xFFFFF8) | (light_header2_t.frame_num & 0x7);
-        const uint32_t event_frame_number = fem_header4_t.event_frame_number();
+        const uint32_t event_frame_number = fem_header_.event_frame_number;
         return frame_num + CorrectRollover(frame_num, event_frame_number);
     }
 
     uint32_t Decoder::GetTriggerFrameNumber() const {
-        const uint32_t event_frame_number = fem_header4_t.event_frame_number();
-        const uint32_t trig_frame_num = (event_frame_number & 0xFFFFF0) | (fem_header6_t.trig_frame_number_lower & 0xF);
+        const uint32_t event_frame_number = fem_header_.event_frame_number;
+        const uint32_t trig_frame_num = (event_frame_number & 0xFFFFF0) | (fem_header_.trig_frame_number_lower & 0xF);
 
         // return CorrectRollover(event_frame_number, trig_frame_num);
         //return trig_frame_num + CorrectRollover(event_frame_number, trig_frame_num);
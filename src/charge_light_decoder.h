@@ -25,75 +25,34 @@ namespace decoder {
      *
      *  [16bword0_R, 16bword0_L, 16bword1_R, 16bword1_L, ...., 16bword0_N, 16bwordN_L]
      *
-     *  This is the case for all words so the structures assume this order.
+     *  This is the case for all words. Bit 0 is the LSB of the right word,
+     *
+     *  header 1: [15:0] 0xFFFF event start, [20:16] slot number, [24:21] FEM ID,
+     *            [25] test, [26] overflow, [27] full, [31:28] 0xF
+     *  header 2: number of ADC words, 24b split in 12b per 16b word, upper 12b in [11:0],
+     *            lower 12b in [27:16], [15:12] and [31:28] the 0xF header pack nibbles
+     *  header 3: event number, 24b split as in header 2
+     *  header 4: event frame number, 24b split as in header 2
+     *  header 5: checksum, 24b split as in header 2
+     *  header 6: [3:0] trigger sample upper 4b, [7:4] trigger frame lower 4b,
+     *            [23:16] trigger sample lower 8b, [15:12] and [31:28] 0xF
+     *
+     *  The fields are extracted with plain shifts and masks into the FemHeader record.
      */
-
-    // header 1
-    struct FEMHeader1 {
-        uint16_t event_start : 16;
-        uint16_t slot_number : 5; // First 5 bits
-        uint16_t fem_id : 4;
-        uint16_t test : 1;
-        uint16_t overflow : 1;
-        uint16_t full : 1;
-        uint16_t header_start_1 : 4;
-    };
-
-    // header 2
-    struct FEMHeader2 {
-        uint32_t num_adc_words_upper : 12;
-        uint16_t header_pack_0 : 4;
-        uint16_t num_adc_words_lower : 12;
-        uint16_t header_pack_1 : 4;
-        // Make sure the upper word is large enough to hold 12b shifted up by 12b, i.e. must be >=24b
-        uint32_t num_adc_words() const { return ((num_adc_words_upper << 12) & 0xFFF000) | (num_adc_words_lower & 0xFFF); }
+    struct FemHeader {
+        uint16_t slot_number;
+        uint8_t fem_id;
+        uint8_t test;
+        uint8_t overflow;
+        uint8_t full;
+        uint32_t num_adc_words;
+        uint32_t event_number;
+        uint32_t event_frame_number;
+        uint32_t checksum;
+        uint32_t trig_sample_number;
+        uint32_t trig_frame_number_lower;
     };
 
-    // header 3
-    struct FEMHeader3 {
-        uint32_t event_number_upper : 12;
-        uint16_t header_pack_2 : 4;
-        uint16_t event_number_lower : 12;
-        uint16_t header_pack_3 : 4;
-
-        uint32_t event_number() const { return ((event_number_upper << 12) & 0xFFF000) | (event_number_lower & 0xFFF); }
-    };
-
-    // header 4 FIXME this should be trigger frame
-     struct FEMHeader4 {
-        uint32_t frame_number_upper : 12;
-        uint16_t header_pack_4 : 4;
-        uint16_t frame_number_lower : 12;
-        uint16_t header_pack_5 : 4;
-
-        uint32_t event_frame_number() const { return ((frame_number_upper << 12) & 0xFFF000) | (frame_number_lower & 0xFFF); }
-    };
-
-    // header 5
-    struct FEMHeader5 {
-        uint32_t checksum_upper : 12;
-        uint16_t header_pack_6 : 4;
-        uint16_t checksum_lower : 12;
-        uint16_t header_pack_7 : 4;
-
-        uint32_t checksum() const { return ((checksum_upper << 12) & 0xFFF000) | (checksum_lower & 0xFFF); }
-    };
-
-    // header 6
-    struct FEMHeader6 {
-        uint16_t trig_sample_number_upper : 4;
-        uint16_t trig_frame_number_lower : 4;
-        uint16_t pad0 : 4;
-        uint16_t header_pack_8 : 4;
-        uint16_t trig_sample_number_lower : 8;
-        uint16_t pad1 : 4;
-        uint16_t header_pack_9 : 4;
-
-        uint32_t trig_sample_number() const { return ((trig_sample_number_upper << 8) & 0xF00) | (trig_sample_number_lower & 0xFF); }
-        uint32_t trig_frame_number() const { return (trig_frame_number_lower & 0xF); }
-    };
-
-
     // Define the structure for FEM Header
     struct LightHeader1 {
         uint16_t channel : 6;
@@ -124,6 +83,25 @@ namespace decoder {
 
 #pragma pack(pop) // Restore default alignment
 
+    /*
+     * What a 16b data word is only depends on its top nibble, so each FEM type has a 16 entry
+     * table giving the word type. The light ROI words are also flagged if they are missing the
+     * 0x8000 intermediate word tag, the ROI state machine still acts on them.
+     */
+    enum class WordType : uint8_t {
+        ChargeOther, // a sample, if within a channel
+        ChargeChannelStart,
+        ChargeChannelEnd,
+        LightOther,
+        LightChannelStart,
+        LightChannelEnd,
+        LightRoiHeader1,
+        LightRoiHeader2, // ROI header 2, 3 and the samples
+        LightRoiEnd,
+    };
+    static constexpr uint8_t word_type_mask_ = 0x0F;
+    static constexpr uint8_t non_intermediate_word_ = 0x10;
+
     class Decoder {
 
     public:
@@ -143,77 +121,105 @@ namespace decoder {
         static constexpr uint16_t light_roi_header2_ = 0x2000;
         static constexpr uint16_t light_roi_end_ = 0x3000;
 
-        FEMHeader1 fem_header1_t{};
-        FEMHeader2 fem_header2_t{};
-        FEMHeader3 fem_header3_t{};
-        FEMHeader4 fem_header4_t{};
-        FEMHeader5 fem_header5_t{};
-        FEMHeader6 fem_header6_t{};
+        FemHeader fem_header_{};
         AdcWord adc_word_t{};
         LightHeader1 light_header1_t{};
         LightHeader2 light_header2_t{};
         LightHeader3 light_header3_t{};
 
         // Data fmarker checks
-        static bool IsEventStart(const uint32_t word) {return (word & 0xFFFFFFFF) == event_start_;}
-        static bool IsEventEnd(const uint32_t word) {return (word & 0xFFFFFFFF) == event_end_;}
-        static bool IsHeaderWord(const uint16_t word) {return (word & 0xF000) == header_word_;}
-        static bool ChargeChannelStart(const uint16_t word) {return (word & 0xF000) == charge_channel_start_;}
-        static bool ChargeChannelEnd(const uint16_t word) {return (word & 0xF000) == charge_channel_end_;}
-        static bool LightChannelStart(const uint16_t word) {return (word & 0xC000) == light_channel_start_;}
-        static bool LightChannelEnd(const uint16_t word) {return (word & 0xC000) == light_channel_end_;}
-        static bool LightChannelIntmed(const uint16_t word) {return (word & 0xC000) == light_channel_intmed_;}
-        static bool LightRoiHeader1(const uint16_t word) {return (word & 0x3000) == light_roi_header1_;}
-        static bool LightRoiHeader2(const uint16_t word) {return (word & 0x3000) == light_roi_header2_;}
-        static bool LightValidRoiHeader(const uint16_t word) {return (word & 0x3000) != 0x0;} // must be 0x1,0x2 or 0x3
-        static bool LightRoiEnd(const uint16_t word) {return (word & 0x3000) == light_roi_end_;}
+        static constexpr bool IsEventStart(const uint32_t word) {return (word & 0xFFFFFFFF) == event_start_;}
+        static constexpr bool IsEventEnd(const uint32_t word) {return (word & 0xFFFFFFFF) == event_end_;}
+        static constexpr bool IsHeaderWord(const uint16_t word) {return (word & 0xF000) == header_word_;}
+        static constexpr bool ChargeChannelStart(const uint16_t word) {return (word & 0xF000) == charge_channel_start_;}
+        static constexpr bool ChargeChannelEnd(const uint16_t word) {return (word & 0xF000) == charge_channel_end_;}
+        static constexpr bool LightChannelStart(const uint16_t word) {return (word & 0xC000) == light_channel_start_;}
+        static constexpr bool LightChannelEnd(const uint16_t word) {return (word & 0xC000) == light_channel_end_;}
+        static constexpr bool LightChannelIntmed(const uint16_t word) {return (word & 0xC000) == light_channel_intmed_;}
+        static constexpr bool LightRoiHeader1(const uint16_t word) {return (word & 0x3000) == light_roi_header1_;}
+        static constexpr bool LightRoiHeader2(const uint16_t word) {return (word & 0x3000) == light_roi_header2_;}
+        static constexpr bool LightValidRoiHeader(const uint16_t word) {return (word & 0x3000) != 0x0;} // must be 0x1,0x2 or 0x3
+        static constexpr bool LightRoiEnd(const uint16_t word) {return (word & 0x3000) == light_roi_end_;}
+
+        // The word tables are generated from the marker checks above at compile time
+        static constexpr uint8_t ClassifyChargeWord(const uint16_t word) {
+            if (ChargeChannelStart(word)) return static_cast<uint8_t>(WordType::ChargeChannelStart);
+            if (ChargeChannelEnd(word)) return static_cast<uint8_t>(WordType::ChargeChannelEnd);
+            return static_cast<uint8_t>(WordType::ChargeOther);
+        }
+        static constexpr uint8_t ClassifyLightWord(const uint16_t word) {
+            if (LightChannelStart(word)) return static_cast<uint8_t>(WordType::LightChannelStart);
+            if (LightChannelEnd(word)) return static_cast<uint8_t>(WordType::LightChannelEnd);
+            const uint8_t tag = LightChannelIntmed(word) ? 0 : non_intermediate_word_;
+            if (LightRoiHeader1(word)) return tag | static_cast<uint8_t>(WordType::LightRoiHeader1);
+            if (LightRoiHeader2(word)) return tag | static_cast<uint8_t>(WordType::LightRoiHeader2);
+            if (LightRoiEnd(word)) return tag | static_cast<uint8_t>(WordType::LightRoiEnd);
+            return tag | static_cast<uint8_t>(WordType::LightOther);
+        }
+        template <uint8_t (*Classify)(uint16_t)>
+        static constexpr std::array<uint8_t, 16> MakeWordTable() {
+            std::array<uint8_t, 16> table{};
+            for (uint16_t nibble = 0; nibble < 16; nibble++) table[nibble] = Classify(static_cast<uint16_t>(nibble << 12));
+            return table;
+        }
 
+        // The 24b fields of headers 2-5
+        static constexpr uint32_t Header24(const uint32_t word) { return ((word & 0xFFF) << 12) | ((word >> 16) & 0xFFF); }
+        // All 6 FEM header words carry their header nibbles (and header 1 the event start word)
+        static bool IsFemHeader(const uint32_t *words) {
+            uint32_t mismatch = (words[0] & 0xF000FFFF) ^ 0xF000FFFF;
+            for (size_t i = 1; i < 6; i++) mismatch |= (words[i] & 0xF000F000) ^ 0xF000F000;
+            return mismatch == 0;
+        }
+        // The FEM payload in 32b words, num_adc_words is one less than the number of 16b payload
+        // words which are padded to a whole 32b word
+        static constexpr size_t FemPayloadWords(const uint32_t num_adc_words) { return (num_adc_words + 2) / 2; }
+        // Hop over the FEMs of an event from the FEM header at word, calling f(word) on each FEM header
+        // found. Returns the word of the event end marker right after the last FEM, or num_words if the
+        // headers don't chain up to one (corrupt or cut off data).
+        template <typename F>
+        static size_t WalkFemHeaders(const uint32_t *words, const size_t num_words, size_t word, F &&f) {
+            while (word + 6 <= num_words && IsFemHeader(words + word)) {
+                f(word);
+                word += 6 + FemPayloadWords(Header24(words[word + 1]));
+            }
+            return word < num_words && IsEventEnd(words[word]) ? word : num_words;
+        }
+        // Decode the 6 FEM header words in one go
+        const FemHeader &DecodeFemHeader(const uint32_t *words);
+        // Decode the header words one at a time, returns true on the last one
         bool FemHeaderDecode(uint32_t header_word);
         bool FemLightDecode(uint16_t header_word);
         void DecodeAdcWord(uint16_t word);
 
-        // Cast a whole FEM chunk (63 channels with N samples per channel)
-        // currently very slow FIXME
-        template <size_t N>
-        size_t GetChargeAdcChunk(size_t word_idx, size_t short_idx, int *buffer, std::array<std::array<uint16_t, N>, 64> *adc_arr) {
-            // Unfortunately we need this extra step because the buffer is 32b words but the ADC samples are
-            // 16b so there is no guarantee the first ADC word will align with the 32b word
-            uint16_t *tmp_buffer = reinterpret_cast<uint16_t *>(buffer);
-            uint16_t idx = word_idx * 2 + short_idx; // short_idx adjusts the 16b word left or right
-
-            // Cast all the Charge channels and samples at once, since it's fixed size across all events
-            // The buffer index is set to the current position so casting memory chunk [word_idx, word_idx+sizeof(adc_arr)]
-            std::memcpy(adc_arr, &tmp_buffer[idx], sizeof(*adc_arr)/sizeof(uint16_t));
-
-            // Need to increment the word index by the number of 32b words we
-            // just cast. In this case the chunk is 64 channels with N samples.
-            // The number of samples is templated because it's configurable while the
-            // number of channels is a fixed hardware property.
-            return word_idx + (sizeof(adc_arr) / sizeof(uint32_t));
-        }
-
+        // Decode the run of plain ADC samples at the start of words (up to the next
+        // channel end marker or any other non-sample word) in one vectorized pass,
+        // appending them to the ADC word vector. Returns the number of words consumed.
+        size_t GetChargeAdcChunk(const uint16_t *words, size_t max_words);
 
         /*
          * Getter functions for the readout data
          */
 
         // FEM headers and information
+        const FemHeader &GetFemHeader() const { return fem_header_; }
         // Header 1
-        uint16_t GetSlotNumber() const { return fem_header1_t.slot_number; }
+        uint16_t GetSlotNumber() const { return fem_header_.slot_number; }
         // Header 2
-        uint32_t GetNumAdcWords() const { return fem_header2_t.num_adc_words(); }
+        uint32_t GetNumAdcWords() const { return fem_header_.num_adc_words; }
         // Header 3
-        uint32_t GetEventNumber() const { return fem_header3_t.event_number(); }
+        uint32_t GetEventNumber() const { return fem_header_.event_number; }
         // Header 4
-        uint32_t GetEventFrameNumber() const { return fem_header4_t.event_frame_number(); }
+        uint32_t GetEventFrameNumber() const { return fem_header_.event_frame_number; }
         // Header 5
-        uint32_t GetCheckSum() const { return fem_header5_t.checksum(); }
+        uint32_t GetCheckSum() const { return fem_header_.checksum; }
         // Header 6
-        uint32_t GetTriggerSample() const { return fem_header6_t.trig_sample_number(); }
+        uint32_t GetTriggerSample() const { return fem_header_.trig_sample_number; }
         uint32_t GetTriggerFrameNumber() const;
 
         // Charge & Light ADC words
-        std::vector<uint16_t> GetAdcWords () { return std::move(adc_word_array_); }
+        // The vector is reused for every channel/ROI so it keeps its capacity, copy out before resetting
+        const std::vector<uint16_t> &GetAdcWords() const { return adc_word_array_; }
         void ResetAdcWordVector() { adc_word_array_.clear(); }
 
         // Light headers
@@ -232,8 +238,16 @@ namespace decoder {
         int HeaderWord{};
         int LightWord{};
 
+        // Number of times either state machine was found in an unknown state
+        uint64_t GetNumUnknownHeaderStates() const { return num_unknown_header_states_; }
+        uint64_t GetNumUnknownLightStates() const { return num_unknown_light_states_; }
+        void ResetUnknownStateCounts() { num_unknown_header_states_ = 0; num_unknown_light_states_ = 0; }
+
     private:
 
+        void DecodeHeader1(uint32_t word);
+        void DecodeHeader6(uint32_t word);
+
         static int32_t CorrectRollover(const uint32_t word1, const uint32_t word2) {
             const int32_t diff = word1 - word2;
             if (diff > 4) return -8;
@@ -242,9 +256,18 @@ namespace decoder {
         }
 
         std::vector<uint16_t> adc_word_array_;
+        uint64_t num_unknown_header_states_ = 0;
+        uint64_t num_unknown_light_states_ = 0;
 
     };
 
+    inline constexpr std::array<uint8_t, 16> charge_word_table = Decoder::MakeWordTable<Decoder::ClassifyChargeWord>();
+    inline constexpr std::array<uint8_t, 16> light_word_table = Decoder::MakeWordTable<Decoder::ClassifyLightWord>();
+
+    inline WordType ChargeWordType(const uint16_t word) { return static_cast<WordType>(charge_word_table[word >> 12]); }
+    // The word type and the non_intermediate_word_ flag
+    inline uint8_t LightWordClass(const uint16_t word) { return light_word_table[word >> 12]; }
+
 }
 
 #endif //CHARGE_LIGHT_DECODER_H
@@ -0,0 +1,183 @@
+#include "data_buffer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+DataBuffer::~DataBuffer() {
+    Close();
+}
+
+bool DataBuffer::Open(const std::string &file_name, const bool use_mmap) {
+    Close();
+
+    fd_ = open(file_name.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        std::cerr << "Could not open file: " << file_name << std::endl;
+        return false;
+    }
+
+    struct stat file_stat{};
+    if (fstat(fd_, &file_stat) != 0) {
+        std::cerr << "Could not stat file: " << file_name << " [" << errno << "]" << std::endl;
+        Close();
+        return false;
+    }
+    file_size_ = static_cast<size_t>(file_stat.st_size);
+    num_words_ = file_size_ / sizeof(uint32_t);
+    file_name_ = file_name;
+    use_mmap_ = use_mmap;
+    std::cout << "File size: " << file_size_ << std::endl;
+
+    if (use_mmap && MapFile()) return true;
+    if (ReadFile()) return true;
+
+    Close();
+    return false;
+}
+
+bool DataBuffer::MapFile() {
+    if (file_size_ == 0) return false;
+
+    void *addr = mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Could not map file, falling back to read [" << errno << "]" << std::endl;
+        return false;
+    }
+    // The decoder walks the file front to back so let the kernel read ahead aggressively
+    madvise(addr, file_size_, MADV_SEQUENTIAL);
+
+    mapped_ = addr;
+    mapped_size_ = file_size_;
+    data_ = static_cast<const uint32_t *>(mapped_);
+    std::cout << "Mapped file.." << std::endl;
+    return true;
+}
+
+bool DataBuffer::ReadFile() {
+    heap_buffer_.resize(num_words_);
+    std::cout << "Allocated file buffer.." << std::endl;
+
+    if (!ReadWords(0, num_words_)) {
+        heap_buffer_.clear();
+        heap_buffer_.shrink_to_fit();
+        return false;
+    }
+    data_ = heap_buffer_.data();
+    std::cout << "Read file.." << std::endl;
+    return true;
+}
+
+bool DataBuffer::ReadWords(const size_t first_word, const size_t num_words) {
+    auto *dst = reinterpret_cast<char *>(heap_buffer_.data() + first_word);
+    const size_t offset = first_word * sizeof(uint32_t);
+    const size_t num_bytes = num_words * sizeof(uint32_t);
+    size_t bytes_read = 0;
+    while (bytes_read < num_bytes) {
+        const ssize_t ret = pread(fd_, dst + bytes_read, num_bytes - bytes_read, static_cast<off_t>(offset + bytes_read));
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) {
+            std::cerr << "Error reading file: " << file_name_ << std::endl;
+            std::cerr << "Error code: [" << errno << "]" << std::endl;
+            return false;
+        }
+        bytes_read += static_cast<size_t>(ret);
+    }
+    return true;
+}
+
+bool DataBuffer::Refresh() {
+    if (fd_ < 0) return false;
+
+    struct stat file_stat{};
+    if (fstat(fd_, &file_stat) != 0) return false;
+    const auto file_size = static_cast<size_t>(file_stat.st_size);
+    if (file_size < file_size_) {
+        std::cerr << "File " << file_name_ << " shrank from " << file_size_ << " to " << file_size << " bytes!" << std::endl;
+        return false;
+    }
+    // Wait for at least one whole new 32b word
+    const size_t num_words = file_size / sizeof(uint32_t);
+    if (num_words <= num_words_) return false;
+
+    // A file which was empty when opened could not be mapped yet, map it now
+    if (mapped_ != nullptr || (use_mmap_ && num_words_ == 0)) {
+        // Map the grown file and drop the old mapping. The pages already decoded are
+        // not touched again so nothing is read twice.
+        void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (addr != MAP_FAILED) {
+            madvise(addr, file_size, MADV_SEQUENTIAL);
+            if (mapped_ != nullptr) munmap(mapped_, mapped_size_);
+            mapped_ = addr;
+            mapped_size_ = file_size;
+            data_ = static_cast<const uint32_t *>(mapped_);
+            file_size_ = file_size;
+            num_words_ = num_words;
+            return true;
+        }
+        if (mapped_ != nullptr) {
+            std::cerr << "Could not remap file [" << errno << "]" << std::endl;
+            return false;
+        }
+    }
+
+    // Only read the appended words, the vector grows geometrically so following a
+    // file does not copy it over and over
+    const size_t old_num_words = num_words_;
+    heap_buffer_.resize(num_words);
+    if (!ReadWords(old_num_words, num_words - old_num_words)) {
+        heap_buffer_.resize(old_num_words);
+        return false;
+    }
+    data_ = heap_buffer_.data();
+    file_size_ = file_size;
+    num_words_ = num_words;
+    return true;
+}
+
+void DataBuffer::Release(const size_t word_idx) {
+    if (mapped_ == nullptr) return;
+
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t byte_idx = std::min(word_idx * sizeof(uint32_t), mapped_size_);
+    // Rewound, e.g. the file was restarted, start counting the window from here
+    if (byte_idx < released_bytes_) {
+        released_bytes_ = (byte_idx / page_size) * page_size;
+        return;
+    }
+    // Only bother the kernel once a full window has been decoded
+    if (byte_idx < released_bytes_ + release_window_) return;
+
+    const size_t release_end = (byte_idx / page_size) * page_size;
+    if (release_end <= released_bytes_) return;
+    madvise(static_cast<char *>(mapped_) + released_bytes_, release_end - released_bytes_, MADV_DONTNEED);
+    released_bytes_ = release_end;
+}
+
+void DataBuffer::WillNeed() const {
+    if (mapped_ == nullptr) return;
+    madvise(mapped_, std::min(release_window_, mapped_size_), MADV_WILLNEED);
+}
+
+void DataBuffer::Close() {
+    if (mapped_ != nullptr) {
+        munmap(mapped_, mapped_size_);
+        mapped_ = nullptr;
+        mapped_size_ = 0;
+    }
+    heap_buffer_.clear();
+    heap_buffer_.shrink_to_fit();
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    data_ = nullptr;
+    num_words_ = 0;
+    file_size_ = 0;
+    released_bytes_ = 0;
+    file_name_.clear();
+}
@@ -0,0 +1,71 @@
+#ifndef DATA_BUFFER_H
+#define DATA_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only view of a binary data file as a flat array of 32b words.
+ *
+ * By default the file is memory mapped so no data is read up front, pages are
+ * faulted in as the decoder walks the buffer. The pages already decoded can be
+ * handed back to the kernel with Release() so the resident memory stays bounded
+ * by the release window, independent of the file size. If the file can not be
+ * mapped (or mapping is disabled) the whole file is read into a heap buffer.
+ *
+ * A file which is still being written can be followed with Refresh(), which
+ * extends the view to any data appended since. Only the new data is read, but
+ * the view may move so Data() has to be fetched again after it.
+ */
+class DataBuffer {
+public:
+    DataBuffer() = default;
+    ~DataBuffer();
+
+    DataBuffer(const DataBuffer &) = delete;
+    DataBuffer &operator=(const DataBuffer &) = delete;
+
+    bool Open(const std::string &file_name, bool use_mmap = true);
+    void Close();
+    // Pick up the words appended to the file since it was opened, returns true if there are new words
+    bool Refresh();
+
+    const uint32_t *Data() const { return data_; }
+    size_t NumWords() const { return num_words_; }
+    size_t FileSize() const { return file_size_; }
+    bool IsOpen() const { return fd_ >= 0; }
+    bool IsMapped() const { return mapped_ != nullptr; }
+    const std::string &FileName() const { return file_name_; }
+
+    // Drop the mapped pages below word_idx from the resident set. The pages are
+    // faulted back in from the page cache if they are accessed again.
+    void Release(size_t word_idx);
+    void SetReleaseWindow(const size_t num_bytes) { release_window_ = num_bytes; }
+    // Ask the kernel to start reading in the first release window of a mapped file
+    void WillNeed() const;
+
+private:
+    bool MapFile();
+    bool ReadFile();
+    bool ReadWords(size_t first_word, size_t num_words);
+
+    int fd_ = -1;
+    bool use_mmap_ = true;
+    std::string file_name_;
+    const uint32_t *data_ = nullptr;
+    size_t num_words_ = 0;
+    size_t file_size_ = 0;
+
+    // Only one of these owns the data
+    void *mapped_ = nullptr;
+    size_t mapped_size_ = 0;
+    std::vector<uint32_t> heap_buffer_{};
+
+    size_t released_bytes_ = 0;
+    size_t release_window_ = 64 * 1024 * 1024; // 64MB
+};
+
+#endif //DATA_BUFFER_H
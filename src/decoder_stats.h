@@ -0,0 +1,114 @@
+#ifndef DECODER_STATS_H
+#define DECODER_STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Counters of what the decoder saw and dropped, and how long each stage took.
+ * The counters are plain increments on paths the decoder already takes, the
+ * timers read the clock a few times per event and channel so they are off
+ * unless enabled with ProcessEvents::EnableTiming.
+ */
+struct DecoderStats {
+    static constexpr size_t num_slots_ = 32; // the slot number is 5b
+
+    // Data volume
+    uint64_t words_scanned = 0;  // 32b words
+    uint64_t events = 0;
+    uint64_t fems = 0;
+    std::array<uint64_t, num_slots_> slot_words{};  // 32b words per slot, headers included
+
+    // Skipped by the event filter or stride, without decoding the payload where the headers allow
+    uint64_t events_skipped = 0;
+    uint64_t fems_skipped = 0;
+    uint64_t words_skipped = 0;  // 32b words jumped over, part of words_scanned
+
+    // Charge
+    uint64_t charge_channels = 0;
+    uint64_t charge_rois = 0;
+
+    // Light ROIs, kept and dropped by reason
+    uint64_t light_rois_kept = 0;
+    uint64_t light_rois_missing_end = 0;     // a new ROI header arrived before the ROI end marker
+    uint64_t light_rois_truncated_header = 0; // ROI end marker before all 3 ROI header words
+    uint64_t light_rois_beam_skipped = 0;    // beam ROIs dropped with skip_beam_roi
+    uint64_t light_rois_stride_skipped = 0;  // ROIs of events or FEMs the filter or stride dropped after decoding
+    uint64_t unexpected_light_words = 0;     // words that fit nowhere in the light ROI state machine
+    uint64_t non_intermediate_light_words = 0; // words without the 0x8000 light word tag
+
+    // Headers
+    uint64_t bad_fem_headers = 0; // FEM headers not made of 6 words with all the header nibbles set
+    // Events dropped on a bad FEM header or a FEM whose ADC word count does not end on the next
+    // header, and the words jumped over to the next event start marker
+    uint64_t events_resynced = 0;
+    uint64_t words_resynced = 0;
+    uint64_t unknown_header_states = 0;
+    uint64_t unknown_light_states = 0;
+
+    // FEM checksums, only counted with checksum verification enabled
+    uint64_t checksums_verified = 0;
+    uint64_t bad_checksums = 0;
+
+    // Time spent per stage [s], only filled when timing is enabled
+    double decode_seconds = 0;
+    double roi_seconds = 0;
+    double export_seconds = 0;
+
+    double BytesPerSecond() const {
+        return decode_seconds > 0 ? static_cast<double>(words_scanned * sizeof(uint32_t)) / decode_seconds : 0.;
+    }
+
+    void Reset() { *this = DecoderStats{}; }
+
+    DecoderStats &operator+=(const DecoderStats &other) {
+        words_scanned += other.words_scanned;
+        events += other.events;
+        fems += other.fems;
+        for (size_t slot = 0; slot < num_slots_; slot++) slot_words[slot] += other.slot_words[slot];
+        events_skipped += other.events_skipped;
+        fems_skipped += other.fems_skipped;
+        words_skipped += other.words_skipped;
+        charge_channels += other.charge_channels;
+        charge_rois += other.charge_rois;
+        light_rois_kept += other.light_rois_kept;
+        light_rois_missing_end += other.light_rois_missing_end;
+        light_rois_truncated_header += other.light_rois_truncated_header;
+        light_rois_beam_skipped += other.light_rois_beam_skipped;
+        light_rois_stride_skipped += other.light_rois_stride_skipped;
+        unexpected_light_words += other.unexpected_light_words;
+        non_intermediate_light_words += other.non_intermediate_light_words;
+        bad_fem_headers += other.bad_fem_headers;
+        events_resynced += other.events_resynced;
+        words_resynced += other.words_resynced;
+        unknown_header_states += other.unknown_header_states;
+        unknown_light_states += other.unknown_light_states;
+        checksums_verified += other.checksums_verified;
+        bad_checksums += other.bad_checksums;
+        decode_seconds += other.decode_seconds;
+        roi_seconds += other.roi_seconds;
+        export_seconds += other.export_seconds;
+        return *this;
+    }
+};
+
+// Adds the time the scope took to seconds, if enabled
+class StageTimer {
+public:
+    StageTimer(const bool enabled, double &seconds) : enabled_(enabled), seconds_(seconds) {
+        if (enabled_) start_ = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (enabled_) seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    const bool enabled_;
+    double &seconds_;
+    std::chrono::steady_clock::time_point start_{};
+};
+
+#endif //DECODER_STATS_H
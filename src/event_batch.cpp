@@ -0,0 +1,82 @@
+#include "event_batch.h"
+#include "process_events.h"
+
+namespace {
+    template <typename T>
+    void AppendColumn(std::vector<T> &column, const std::vector<T> &values) {
+        column.insert(column.end(), values.begin(), values.end());
+    }
+
+    // The arena is already flat, append its samples and shift its offsets to the batch
+    void AppendRows(std::vector<uint16_t> &flat, std::vector<uint64_t> &offsets, const WaveformArena &rows) {
+        const uint64_t base = flat.size();
+        AppendColumn(flat, rows.Samples());
+        for (size_t row = 1; row < rows.Offsets().size(); row++) {
+            offsets.push_back(base + rows.Offsets()[row]);
+        }
+    }
+}
+
+void EventBatch::Append(const EventStruct &event, const size_t index) {
+    event_index.push_back(index);
+
+    AppendColumn(slot_number, event.slot_number);
+    AppendColumn(num_adc_word, event.num_adc_word);
+    AppendColumn(event_number, event.event_number);
+    AppendColumn(event_frame_number, event.event_frame_number);
+    AppendColumn(trigger_frame_number, event.trigger_frame_number);
+    AppendColumn(check_sum, event.check_sum);
+    AppendColumn(trigger_sample, event.trigger_sample);
+    AppendColumn(check_sum_valid, event.check_sum_valid);
+    fem_offset.push_back(slot_number.size());
+
+    AppendColumn(light_channel, event.light_channel);
+    AppendColumn(light_trigger_id, event.light_trigger_id);
+    AppendColumn(light_header_tag, event.light_header_tag);
+    AppendColumn(light_word_tag, event.light_word_tag);
+    AppendColumn(light_frame_number, event.light_frame_number);
+    AppendColumn(light_sample_number, event.light_sample_number);
+    AppendRows(light_adc_words, light_adc_offset, event.light_adc);
+    light_roi_offset.push_back(light_channel.size());
+
+    AppendColumn(charge_channel, event.charge_channel);
+    if (event.charge_adc_packed.empty()) {
+        AppendRows(charge_adc_words, charge_adc_offset, event.charge_adc);
+    } else {
+        // Decoded by workers set to pack the waveforms
+        WaveformArena charge_adc;
+        event.charge_adc_packed.Unpack(charge_adc);
+        AppendRows(charge_adc_words, charge_adc_offset, charge_adc);
+    }
+    // The sample index rows (charge ROI mode only) line up with the ADC rows so share their offsets
+    AppendColumn(charge_adc_idx, event.charge_adc_idx.Samples());
+    charge_offset.push_back(charge_channel.size());
+}
+
+void EventBatch::Clear() {
+    // Keep the capacity, the batch is meant to be reused
+    event_index.clear();
+    fem_offset.assign(1, 0);
+    light_roi_offset.assign(1, 0);
+    charge_offset.assign(1, 0);
+    slot_number.clear();
+    num_adc_word.clear();
+    event_number.clear();
+    event_frame_number.clear();
+    trigger_frame_number.clear();
+    check_sum.clear();
+    trigger_sample.clear();
+    check_sum_valid.clear();
+    light_channel.clear();
+    light_trigger_id.clear();
+    light_header_tag.clear();
+    light_word_tag.clear();
+    light_frame_number.clear();
+    light_sample_number.clear();
+    light_adc_offset.assign(1, 0);
+    light_adc_words.clear();
+    charge_channel.clear();
+    charge_adc_offset.assign(1, 0);
+    charge_adc_words.clear();
+    charge_adc_idx.clear();
+}
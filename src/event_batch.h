@@ -0,0 +1,89 @@
+#ifndef EVENT_BATCH_H
+#define EVENT_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct EventStruct;
+class WaveformArena;
+
+/*
+ * A chunk of decoded events stored column-wise, one flat vector per field.
+ *
+ * Variable length fields are stored as jagged arrays: an offsets vector with one
+ * more entry than rows, where row i spans [offsets[i], offsets[i+1]) of the
+ * flat vector. There are three levels,
+ *  - events: fem_offset, light_roi_offset and charge_offset index the per FEM,
+ *            per light ROI and per charge channel/ROI columns for each event
+ *  - light ROIs: light_adc_offset indexes light_adc_words for each ROI
+ *  - charge channels/ROIs: charge_adc_offset indexes charge_adc_words (and
+ *            charge_adc_idx when decoding with charge ROIs) for each channel
+ */
+struct EventBatch {
+    // Event
+    std::vector<uint64_t> event_index;
+    std::vector<uint64_t> fem_offset{0};
+    std::vector<uint64_t> light_roi_offset{0};
+    std::vector<uint64_t> charge_offset{0};
+    // FEM data
+    std::vector<uint16_t> slot_number;
+    std::vector<uint32_t> num_adc_word;
+    std::vector<uint32_t> event_number;
+    std::vector<uint32_t> event_frame_number;
+    std::vector<uint32_t> trigger_frame_number;
+    std::vector<uint32_t> check_sum;
+    std::vector<uint32_t> trigger_sample;
+    std::vector<uint8_t> check_sum_valid;
+    // Light
+    std::vector<uint16_t> light_channel;
+    std::vector<uint8_t> light_trigger_id;
+    std::vector<uint8_t> light_header_tag;
+    std::vector<uint8_t> light_word_tag;
+    std::vector<uint32_t> light_frame_number;
+    std::vector<uint16_t> light_sample_number;
+    std::vector<uint64_t> light_adc_offset{0};
+    std::vector<uint16_t> light_adc_words;
+    // Charge
+    std::vector<uint16_t> charge_channel;
+    std::vector<uint64_t> charge_adc_offset{0};
+    std::vector<uint16_t> charge_adc_words;
+    std::vector<uint16_t> charge_adc_idx;
+
+    size_t NumEvents() const { return event_index.size(); }
+    bool Empty() const { return event_index.empty(); }
+
+    void Append(const EventStruct &event, size_t index);
+    void Clear();
+
+    // Call f(name, column) on every column of a (const) batch, in the order they are stored in an event file
+    template <typename Batch, typename F>
+    static void ForEachColumn(Batch &batch, F &&f) {
+        f("event_index", batch.event_index);
+        f("fem_offset", batch.fem_offset);
+        f("light_roi_offset", batch.light_roi_offset);
+        f("charge_offset", batch.charge_offset);
+        f("slot_number", batch.slot_number);
+        f("num_adc_word", batch.num_adc_word);
+        f("event_number", batch.event_number);
+        f("event_frame_number", batch.event_frame_number);
+        f("trigger_frame_number", batch.trigger_frame_number);
+        f("check_sum", batch.check_sum);
+        f("trigger_sample", batch.trigger_sample);
+        f("check_sum_valid", batch.check_sum_valid);
+        f("light_channel", batch.light_channel);
+        f("light_trigger_id", batch.light_trigger_id);
+        f("light_header_tag", batch.light_header_tag);
+        f("light_word_tag", batch.light_word_tag);
+        f("light_frame_number", batch.light_frame_number);
+        f("light_readout_sample", batch.light_sample_number);
+        f("light_adc_offset", batch.light_adc_offset);
+        f("light_adc_words", batch.light_adc_words);
+        f("charge_channel", batch.charge_channel);
+        f("charge_adc_offset", batch.charge_adc_offset);
+        f("charge_adc_words", batch.charge_adc_words);
+        f("charge_adc_idx", batch.charge_adc_idx);
+    }
+};
+
+#endif //EVENT_BATCH_H
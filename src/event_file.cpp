@@ -0,0 +1,357 @@
+#include "event_file.h"
+#include "adc_codec.h"
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#ifdef USE_PYBIND11
+    #include "process_events_py.h"
+#endif
+
+namespace {
+    struct FileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t num_columns;
+    };
+
+    struct ColumnHeader {
+        char name[EventFileWriter::max_name_size_];
+        uint32_t element_size;
+        uint32_t reserved;
+    };
+
+    struct FileTrailer {
+        uint64_t footer_offset;
+        uint64_t magic;
+    };
+
+    template <typename Column>
+    constexpr uint32_t ElementSize() {
+        return sizeof(typename std::decay_t<Column>::value_type);
+    }
+
+    // The ADC word columns which can be packed and the offsets column of their rows
+    const char *AdcRowOffsetsName(const std::string &name) {
+        if (name == "charge_adc_words") return "charge_adc_offset";
+        if (name == "light_adc_words") return "light_adc_offset";
+        return nullptr;
+    }
+
+    const std::vector<uint64_t> *AdcRowOffsets(const EventBatch &batch, const std::string &name) {
+        if (name == "charge_adc_words") return &batch.charge_adc_offset;
+        if (name == "light_adc_words") return &batch.light_adc_offset;
+        return nullptr;
+    }
+
+    size_t AlignUp(const size_t offset) {
+        return (offset + EventFileWriter::alignment_ - 1) / EventFileWriter::alignment_ * EventFileWriter::alignment_;
+    }
+}
+
+EventFileWriter::~EventFileWriter() {
+    Close();
+}
+
+bool EventFileWriter::Open(const std::string &file_name, const bool pack_adc_words) {
+    Close();
+
+    file_ = fopen(file_name.c_str(), "wb");
+    if (file_ == nullptr) {
+        std::cerr << "Could not open file: " << file_name << std::endl;
+        return false;
+    }
+    file_name_ = file_name;
+    pack_adc_words_ = pack_adc_words;
+    offset_ = 0;
+    num_events_ = 0;
+    columns_.clear();
+    chunk_num_events_.clear();
+    column_table_.clear();
+
+    const EventBatch batch{};
+    EventBatch::ForEachColumn(batch, [&](const char *name, const auto &column) {
+        if (pack_adc_words_ && AdcRowOffsetsName(name) != nullptr) {
+            columns_.push_back({std::string(name) + "_packed", sizeof(uint8_t)});
+            columns_.push_back({std::string(name) + "_packed_offset", sizeof(uint64_t)});
+            return;
+        }
+        columns_.push_back({name, ElementSize<decltype(column)>()});
+    });
+
+    const FileHeader header{file_magic_, file_version_, static_cast<uint32_t>(columns_.size())};
+    bool ok = Write(&header, sizeof(header));
+    for (const auto &column : columns_) {
+        ColumnHeader column_header{};
+        std::strncpy(column_header.name, column.name.c_str(), max_name_size_ - 1);
+        column_header.element_size = column.element_size;
+        ok = ok && Write(&column_header, sizeof(column_header));
+    }
+    if (!ok) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+    return ok;
+}
+
+bool EventFileWriter::WriteChunk(const EventBatch &batch) {
+    if (file_ == nullptr) return false;
+    if (batch.Empty()) return true;
+
+    bool ok = true;
+    EventBatch::ForEachColumn(batch, [&](const char *name, const auto &column) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(column)>, std::vector<uint16_t>>) {
+            const std::vector<uint64_t> *row_offsets = AdcRowOffsets(batch, name);
+            if (pack_adc_words_ && row_offsets != nullptr) {
+                ok = ok && WritePackedColumn(column, *row_offsets);
+                return;
+            }
+        }
+        ok = ok && Align();
+        column_table_.push_back(offset_);
+        column_table_.push_back(column.size());
+        ok = ok && Write(column.data(), column.size() * ElementSize<decltype(column)>());
+    });
+    chunk_num_events_.push_back(batch.NumEvents());
+    num_events_ += batch.NumEvents();
+    return ok;
+}
+
+bool EventFileWriter::Close() {
+    if (file_ == nullptr) return true;
+
+    bool ok = Align();
+    const FileTrailer trailer{offset_, file_magic_};
+    const uint64_t num_chunks = chunk_num_events_.size();
+    ok = ok && Write(&num_chunks, sizeof(num_chunks));
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        ok = ok && Write(&chunk_num_events_[chunk], sizeof(uint64_t));
+        ok = ok && Write(&column_table_[chunk * columns_.size() * 2], columns_.size() * 2 * sizeof(uint64_t));
+    }
+    ok = ok && Write(&trailer, sizeof(trailer));
+
+    if (fclose(file_) != 0) ok = false;
+    file_ = nullptr;
+    if (!ok) std::cerr << "Error writing file: " << file_name_ << std::endl;
+    return ok;
+}
+
+bool EventFileWriter::WritePackedColumn(const std::vector<uint16_t> &samples, const std::vector<uint64_t> &row_offsets) {
+    packed_.clear();
+    for (size_t row = 0; row + 1 < row_offsets.size(); row++) {
+        packed_.AppendRow(samples.data() + row_offsets[row], row_offsets[row + 1] - row_offsets[row]);
+    }
+    bool ok = Align();
+    column_table_.push_back(offset_);
+    column_table_.push_back(packed_.NumBytes());
+    ok = ok && Write(packed_.Bytes().data(), packed_.NumBytes());
+    ok = ok && Align();
+    column_table_.push_back(offset_);
+    column_table_.push_back(packed_.ByteOffsets().size());
+    return ok && Write(packed_.ByteOffsets().data(), packed_.ByteOffsets().size() * sizeof(uint64_t));
+}
+
+bool EventFileWriter::Write(const void *data, const size_t num_bytes) {
+    if (num_bytes == 0) return true;
+    if (fwrite(data, 1, num_bytes, file_) != num_bytes) {
+        std::cerr << "Error writing file: " << file_name_ << std::endl;
+        return false;
+    }
+    offset_ += num_bytes;
+    return true;
+}
+
+bool EventFileWriter::Align() {
+    static constexpr char padding[alignment_]{};
+    return Write(padding, AlignUp(offset_) - offset_);
+}
+
+bool EventFileReader::Open(const std::string &file_name) {
+    Close();
+
+    data_buffer_ = std::make_shared<DataBuffer>();
+    if (!data_buffer_->Open(file_name)) {
+        Close();
+        return false;
+    }
+    data_ = reinterpret_cast<const char *>(data_buffer_->Data());
+    const size_t file_size = data_buffer_->FileSize();
+
+    auto invalid = [&](const char *reason) {
+        std::cerr << "Invalid event file " << file_name << ": " << reason << std::endl;
+        Close();
+        return false;
+    };
+
+    FileHeader header{};
+    FileTrailer trailer{};
+    if (file_size < sizeof(header) + sizeof(trailer) || file_size % sizeof(uint64_t) != 0) {
+        return invalid("bad file size");
+    }
+    std::memcpy(&header, data_, sizeof(header));
+    std::memcpy(&trailer, data_ + file_size - sizeof(trailer), sizeof(trailer));
+    if (header.magic != EventFileWriter::file_magic_ || trailer.magic != EventFileWriter::file_magic_) {
+        return invalid("bad magic number, the file may not have been closed");
+    }
+    if (header.version != EventFileWriter::file_version_) return invalid("unknown version");
+
+    const size_t num_columns = header.num_columns;
+    const size_t columns_end = sizeof(header) + num_columns * sizeof(ColumnHeader);
+    const size_t footer_offset = trailer.footer_offset;
+    if (columns_end > footer_offset || footer_offset + sizeof(uint64_t) + sizeof(trailer) > file_size) {
+        return invalid("bad footer offset");
+    }
+    for (size_t column = 0; column < num_columns; column++) {
+        ColumnHeader column_header{};
+        std::memcpy(&column_header, data_ + sizeof(header) + column * sizeof(ColumnHeader), sizeof(column_header));
+        column_header.name[EventFileWriter::max_name_size_ - 1] = '\0';
+        const uint32_t size = column_header.element_size;
+        if (size != 1 && size != 2 && size != 4 && size != 8) return invalid("bad column element size");
+        columns_.push_back({column_header.name, size});
+    }
+
+    uint64_t num_chunks = 0;
+    std::memcpy(&num_chunks, data_ + footer_offset, sizeof(num_chunks));
+    const size_t chunk_entry_size = (1 + 2 * num_columns) * sizeof(uint64_t);
+    const size_t footer_size = file_size - sizeof(trailer) - footer_offset - sizeof(num_chunks);
+    if (footer_size != num_chunks * chunk_entry_size) return invalid("bad footer size");
+
+    const char *entry = data_ + footer_offset + sizeof(num_chunks);
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        uint64_t num_events = 0;
+        std::memcpy(&num_events, entry, sizeof(num_events));
+        chunk_num_events_.push_back(num_events);
+        num_events_ += num_events;
+        for (size_t column = 0; column < num_columns; column++) {
+            uint64_t offset_size[2];
+            std::memcpy(offset_size, entry + (1 + 2 * column) * sizeof(uint64_t), sizeof(offset_size));
+            // Every column has to lie between the header and the footer
+            const uint64_t num_bytes = offset_size[1] * columns_[column].element_size;
+            if (offset_size[0] < columns_end || offset_size[1] > footer_offset ||
+                offset_size[0] + num_bytes > footer_offset) {
+                return invalid("column out of range");
+            }
+            column_table_.push_back(offset_size[0]);
+            column_table_.push_back(offset_size[1]);
+        }
+        entry += chunk_entry_size;
+    }
+    std::cout << "Opened event file with " << num_events_ << " events in " << num_chunks << " chunks" << std::endl;
+    return true;
+}
+
+void EventFileReader::Close() {
+    // Any arrays still viewing the file keep their own reference to the buffer
+    data_buffer_.reset();
+    data_ = nullptr;
+    num_events_ = 0;
+    columns_.clear();
+    chunk_num_events_.clear();
+    column_table_.clear();
+}
+
+int EventFileReader::ColumnIndex(const std::string &name) const {
+    for (size_t column = 0; column < columns_.size(); column++) {
+        if (columns_[column].name == name) return static_cast<int>(column);
+    }
+    return -1;
+}
+
+EventFileColumnView EventFileReader::Column(const size_t chunk, const std::string &name) const {
+    const int column = ColumnIndex(name);
+    if (column < 0 || chunk >= NumChunks()) return {nullptr, 0, 0};
+    const size_t entry = (chunk * columns_.size() + static_cast<size_t>(column)) * 2;
+    return {data_ + column_table_[entry], column_table_[entry + 1], columns_[column].element_size};
+}
+
+bool EventFileReader::ReadChunk(const size_t chunk, EventBatch &batch) const {
+    batch.Clear();
+    if (chunk >= NumChunks()) return false;
+
+    bool ok = true;
+    EventBatch::ForEachColumn(batch, [&](const char *name, auto &column) {
+        const EventFileColumnView view = Column(chunk, name);
+        if (view.data == nullptr) return;
+        if (view.element_size != ElementSize<decltype(column)>()) {
+            std::cerr << "Column " << name << " has elements of " << view.element_size << "B" << std::endl;
+            ok = false;
+            return;
+        }
+        const auto *first = static_cast<const typename std::decay_t<decltype(column)>::value_type *>(view.data);
+        column.assign(first, first + view.size);
+    });
+    ok = ok && UnpackColumn(chunk, "charge_adc_words", batch.charge_adc_offset, batch.charge_adc_words);
+    return ok && UnpackColumn(chunk, "light_adc_words", batch.light_adc_offset, batch.light_adc_words);
+}
+
+bool EventFileReader::UnpackColumn(const size_t chunk, const std::string &name,
+                                   const std::vector<uint64_t> &sample_offsets, std::vector<uint16_t> &samples) const {
+    const EventFileColumnView packed = Column(chunk, name + "_packed");
+    const EventFileColumnView packed_offsets = Column(chunk, name + "_packed_offset");
+    if (packed.data == nullptr) return true; // stored as is
+
+    const size_t num_rows = sample_offsets.empty() ? 0 : sample_offsets.size() - 1;
+    if (packed.element_size != sizeof(uint8_t) || packed_offsets.element_size != sizeof(uint64_t) ||
+        packed_offsets.size != num_rows + 1) {
+        std::cerr << "Column " << name << " is not packed correctly" << std::endl;
+        return false;
+    }
+    const auto *bytes = static_cast<const uint8_t *>(packed.data);
+    const auto *byte_offsets = static_cast<const uint64_t *>(packed_offsets.data);
+    samples.resize(num_rows > 0 ? sample_offsets.back() : 0);
+    for (size_t row = 0; row < num_rows; row++) {
+        const uint64_t first_byte = byte_offsets[row];
+        const uint64_t last_byte = byte_offsets[row + 1];
+        const uint64_t first_sample = sample_offsets[row];
+        const uint64_t last_sample = sample_offsets[row + 1];
+        if (first_byte > last_byte || last_byte > packed.size || first_sample > last_sample ||
+            last_sample > samples.size() ||
+            !decoder::codec::DecodeAdc(bytes + first_byte, last_byte - first_byte, last_sample - first_sample,
+                                       samples.data() + first_sample)) {
+            std::cerr << "Column " << name << " row " << row << " could not be unpacked" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef USE_PYBIND11
+pybind11::dict EventFileReader::GetChunkDict(const size_t chunk) const {
+    namespace py = pybind11;
+    if (chunk >= NumChunks()) throw py::index_error("chunk " + std::to_string(chunk) + " out of range");
+
+    // The arrays share a reference to the mapped file so it stays open as long as any of them is alive
+    auto *owner = new std::shared_ptr<DataBuffer>(data_buffer_);
+    py::capsule base(owner, [](void *ptr) { delete static_cast<std::shared_ptr<DataBuffer> *>(ptr); });
+
+    py::dict chunk_dict;
+    for (const auto &column : columns_) {
+        // Packed columns are unpacked into new arrays
+        const size_t suffix = column.name.rfind("_packed");
+        if (suffix != std::string::npos) {
+            const std::string name = column.name.substr(0, suffix);
+            const char *row_offsets_name = AdcRowOffsetsName(name);
+            if (column.name != name + "_packed" || row_offsets_name == nullptr) continue;
+            const EventFileColumnView row_offsets = Column(chunk, row_offsets_name);
+            if (row_offsets.element_size != sizeof(uint64_t)) throw py::value_error("bad " + name + " offsets");
+            const auto *first = static_cast<const uint64_t *>(row_offsets.data);
+            std::vector<uint16_t> samples;
+            if (!UnpackColumn(chunk, name, std::vector<uint64_t>(first, first + row_offsets.size), samples)) {
+                throw py::value_error("could not unpack " + name);
+            }
+            chunk_dict[name.c_str()] = vector_to_numpy_array_1d(std::move(samples));
+            continue;
+        }
+        const EventFileColumnView view = Column(chunk, column.name);
+        py::dtype dtype = py::dtype::of<uint8_t>();
+        if (view.element_size == 2) dtype = py::dtype::of<uint16_t>();
+        else if (view.element_size == 4) dtype = py::dtype::of<uint32_t>();
+        else if (view.element_size == 8) dtype = py::dtype::of<uint64_t>();
+        py::array array(dtype, {view.size}, {static_cast<size_t>(view.element_size)}, view.data, base);
+        // The mapping is read only
+        array.attr("setflags")(py::arg("write") = false);
+        chunk_dict[column.name.c_str()] = array;
+    }
+    return chunk_dict;
+}
+#endif
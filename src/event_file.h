@@ -0,0 +1,125 @@
+#ifndef EVENT_FILE_H
+#define EVENT_FILE_H
+
+#include "data_buffer.h"
+#include "event_batch.h"
+#include "packed_waveforms.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef USE_PYBIND11
+    #include <pybind11/pybind11.h>
+#endif
+
+/*
+ * Decoded events saved column-wise so they can be read back without decoding
+ * the raw data again.
+ *
+ * The file is a sequence of chunks, each one EventBatch with every column
+ * stored as a flat array, so reading a column of a chunk is a pointer into the
+ * memory mapped file. The offsets columns are relative to the chunk.
+ *
+ *   header:  magic, version, number of columns, then per column its name and element size
+ *   chunks:  the column arrays of each chunk, each aligned to 64B
+ *   footer:  number of chunks, then per chunk its number of events and the
+ *            (byte offset, number of elements) of each column
+ *   trailer: byte offset of the footer, magic
+ *
+ * The footer is written on Close() so chunks are streamed out as they are decoded.
+ * Columns are looked up by name, a reader skips columns it does not know about.
+ *
+ * The ADC word columns can be written compressed (see decoder::codec), each
+ * <name> column is then replaced by <name>_packed with the encoded waveforms and
+ * <name>_packed_offset with where each starts. These are unpacked on reading.
+ */
+struct EventFileColumn {
+    std::string name;
+    uint32_t element_size;
+};
+
+// A column of one chunk, pointing into the file
+struct EventFileColumnView {
+    const void *data;
+    size_t size;        // number of elements
+    uint32_t element_size;
+};
+
+class EventFileWriter {
+public:
+    EventFileWriter() = default;
+    ~EventFileWriter();
+
+    EventFileWriter(const EventFileWriter &) = delete;
+    EventFileWriter &operator=(const EventFileWriter &) = delete;
+
+    static constexpr uint64_t file_magic_ = 0x3130304C4F435047; // "GPCOL001"
+    static constexpr uint32_t file_version_ = 1;
+    static constexpr size_t alignment_ = 64;
+    static constexpr size_t max_name_size_ = 32;
+
+    bool Open(const std::string &file_name, bool pack_adc_words = false);
+    bool WriteChunk(const EventBatch &batch);
+    // Writes the footer, the file is not readable until it is closed
+    bool Close();
+
+    size_t NumChunks() const { return chunk_num_events_.size(); }
+    size_t NumEvents() const { return num_events_; }
+
+private:
+    bool Write(const void *data, size_t num_bytes);
+    bool WritePackedColumn(const std::vector<uint16_t> &samples, const std::vector<uint64_t> &row_offsets);
+    bool Align();
+
+    FILE *file_ = nullptr;
+    std::string file_name_;
+    bool pack_adc_words_ = false;
+    PackedWaveforms packed_{};
+    uint64_t offset_ = 0;
+    size_t num_events_ = 0;
+    std::vector<EventFileColumn> columns_;
+    std::vector<uint64_t> chunk_num_events_;
+    std::vector<uint64_t> column_table_; // (offset, size) per column per chunk
+};
+
+class EventFileReader {
+public:
+    EventFileReader() = default;
+    ~EventFileReader() = default;
+
+    bool Open(const std::string &file_name);
+    void Close();
+
+    size_t NumChunks() const { return chunk_num_events_.size(); }
+    size_t NumEvents() const { return num_events_; }
+    size_t ChunkNumEvents(const size_t chunk) const { return chunk_num_events_.at(chunk); }
+    const std::vector<EventFileColumn> &Columns() const { return columns_; }
+
+    // The column of a chunk, zero copy. The view is empty if the file has no such column,
+    // which includes packed ADC word columns, ReadChunk and GetChunkDict unpack them.
+    EventFileColumnView Column(size_t chunk, const std::string &name) const;
+    // Copy a chunk into a batch
+    bool ReadChunk(size_t chunk, EventBatch &batch) const;
+
+#ifdef USE_PYBIND11
+    // The columns of a chunk as NumPy arrays viewing the mapped file, read only
+    pybind11::dict GetChunkDict(size_t chunk) const;
+#endif
+
+private:
+    int ColumnIndex(const std::string &name) const;
+    bool UnpackColumn(size_t chunk, const std::string &name, const std::vector<uint64_t> &sample_offsets,
+                      std::vector<uint16_t> &samples) const;
+
+    std::shared_ptr<DataBuffer> data_buffer_;
+    const char *data_ = nullptr;
+    size_t num_events_ = 0;
+    std::vector<EventFileColumn> columns_;
+    std::vector<uint64_t> chunk_num_events_;
+    std::vector<uint64_t> column_table_; // (offset, size) per column per chunk
+};
+
+#endif //EVENT_FILE_H
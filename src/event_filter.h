@@ -0,0 +1,50 @@
+#ifndef EVENT_FILTER_H
+#define EVENT_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Which events and FEMs to decode, decided from the FEM headers alone.
+ *
+ * At each event start the decoder hops from FEM header to FEM header using the
+ * number of ADC words in each, checking every hop lands on another FEM header or
+ * the event end marker. An event the filter rejects is then jumped over without
+ * looking at its payload, as is the payload of a FEM from a rejected slot. If the
+ * headers don't chain up (corrupt or cut off data) the event is decoded as usual
+ * and dropped afterwards if rejected, so a filter never changes what is decoded,
+ * only how much is read.
+ */
+struct EventFilter {
+    // Events, on the first FEM header of the event
+    uint32_t min_event_number = 0;
+    uint32_t max_event_number = UINT32_MAX;
+    uint32_t min_trigger_frame = 0;
+    uint32_t max_trigger_frame = UINT32_MAX;
+    // Only events whose light FEM has more than its channel start/end words
+    bool require_light_rois = false;
+    // FEMs, one bit per slot
+    uint32_t slot_mask = UINT32_MAX;
+
+    bool AcceptSlot(const uint16_t slot) const { return (slot_mask >> (slot & 0x1F)) & 0x1; }
+    bool AcceptEvent(const uint32_t event_number, const uint32_t trigger_frame, const bool has_light_rois) const {
+        return event_number >= min_event_number && event_number <= max_event_number &&
+               trigger_frame >= min_trigger_frame && trigger_frame <= max_trigger_frame &&
+               (has_light_rois || !require_light_rois);
+    }
+    bool FiltersEvents() const {
+        return min_event_number > 0 || max_event_number < UINT32_MAX || min_trigger_frame > 0 ||
+               max_trigger_frame < UINT32_MAX || require_light_rois;
+    }
+    bool Active() const { return FiltersEvents() || slot_mask != UINT32_MAX; }
+
+    static uint32_t SlotMask(const std::vector<uint16_t> &slots) {
+        if (slots.empty()) return UINT32_MAX;
+        uint32_t mask = 0;
+        for (const uint16_t slot : slots) mask |= 1u << (slot & 0x1F);
+        return mask;
+    }
+};
+
+#endif //EVENT_FILTER_H
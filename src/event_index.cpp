@@ -0,0 +1,124 @@
+#include "event_index.h"
+#include "charge_light_decoder.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sys/stat.h>
+
+namespace {
+    struct IndexFileHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t entry_size;
+        DataFileId data_file;
+        uint64_t num_events;
+    };
+
+    // FNV-1a over the words
+    uint64_t Checksum(uint64_t hash, const uint32_t *words, const size_t num_words) {
+        for (size_t i = 0; i < num_words; i++) {
+            hash = (hash ^ words[i]) * 0x100000001B3ULL;
+        }
+        return hash;
+    }
+}
+
+DataFileId DataFileId::Of(const std::string &data_file, const uint64_t size, const uint32_t *data,
+                          const size_t num_words) {
+    DataFileId id;
+    id.size = size;
+    struct stat file_stat{};
+    if (stat(data_file.c_str(), &file_stat) == 0) id.mtime = static_cast<int64_t>(file_stat.st_mtime);
+    const size_t num_first = std::min(num_words, checksum_words_);
+    const size_t num_last = std::min(num_words - num_first, checksum_words_);
+    id.checksum = Checksum(0xCBF29CE484222325ULL, data, num_first);
+    id.checksum = Checksum(id.checksum, data + num_words - num_last, num_last);
+    return id;
+}
+
+void EventIndex::Build(const uint32_t *data, const size_t num_words) {
+    entries_.clear();
+
+    // Count the FEMs by walking their headers, payload words (e.g. light ROI tags) can look
+    // like header words. The 3rd header word of the first FEM carries the event number.
+    auto begin_entry = [&](const size_t start_word, const size_t first_fem_word) {
+        EventIndexEntry entry{start_word, 0, 0, 0};
+        decoder::Decoder::WalkFemHeaders(data, num_words, first_fem_word, [&](const size_t fem_word) {
+            if (entry.num_fem == 0) entry.event_number = decoder::Decoder::Header24(data[fem_word + 2]);
+            entry.num_fem++;
+        });
+        return entry;
+    };
+
+    EventIndexEntry entry = begin_entry(0, 0);
+    for (size_t idx = 0; idx < num_words; idx++) {
+        const uint32_t word = data[idx];
+        if (decoder::Decoder::IsEventStart(word)) {
+            entry = begin_entry(idx, idx + 1);
+            continue;
+        }
+        if (decoder::Decoder::IsEventEnd(word)) {
+            entry.end_word = idx;
+            entries_.push_back(entry);
+            // If the next event start marker is missing decoding resumes from here
+            if (idx + 1 < num_words && !decoder::Decoder::IsEventStart(data[idx + 1])) {
+                entry = begin_entry(idx + 1, idx + 1);
+            }
+        }
+    }
+    std::cout << "Indexed " << entries_.size() << " events" << std::endl;
+}
+
+bool EventIndex::Load(const std::string &index_file, const DataFileId &data_file) {
+    FILE *file = fopen(index_file.c_str(), "rb");
+    if (file == nullptr) return false;
+
+    IndexFileHeader header{};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1;
+    valid = valid && header.magic == index_magic_ && header.version == index_version_ &&
+            header.entry_size == sizeof(EventIndexEntry) && header.data_file == data_file;
+    // Every event takes at least its end marker word, and the entries have to be all there
+    valid = valid && header.num_events <= data_file.size / sizeof(uint32_t);
+    if (valid) {
+        const long entries_start = ftell(file);
+        valid = fseek(file, 0, SEEK_END) == 0 &&
+                static_cast<uint64_t>(ftell(file) - entries_start) == header.num_events * sizeof(EventIndexEntry) &&
+                fseek(file, entries_start, SEEK_SET) == 0;
+    }
+    if (valid) {
+        entries_.resize(header.num_events);
+        valid = fread(entries_.data(), sizeof(EventIndexEntry), entries_.size(), file) == entries_.size();
+    }
+    fclose(file);
+
+    if (!valid) {
+        std::cerr << "Ignoring stale or corrupt event index: " << index_file << std::endl;
+        entries_.clear();
+        return false;
+    }
+    std::cout << "Loaded index with " << entries_.size() << " events" << std::endl;
+    return true;
+}
+
+bool EventIndex::Save(const std::string &index_file, const DataFileId &data_file) const {
+    // Write to a temporary file first so a concurrent reader never sees a partial index
+    const std::string tmp_file = index_file + ".tmp";
+    FILE *file = fopen(tmp_file.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Could not write event index: " << index_file << std::endl;
+        return false;
+    }
+
+    const IndexFileHeader header{index_magic_, index_version_, sizeof(EventIndexEntry),
+                                 data_file, entries_.size()};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(entries_.data(), sizeof(EventIndexEntry), entries_.size(), file) == entries_.size();
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && std::rename(tmp_file.c_str(), index_file.c_str()) == 0;
+
+    if (!ok) {
+        std::cerr << "Could not write event index: " << index_file << std::endl;
+        std::remove(tmp_file.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef EVENT_INDEX_H
+#define EVENT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Word offsets of every event in a data file so any event can be decoded
+ * without walking all the events before it.
+ *
+ * The index is built with a single pass over the 32b words looking only for the
+ * event start/end markers, plus a walk over each event's FEM headers for the FEM
+ * count and event number, it does not run the decoder. It can be saved next to the data file as a sidecar,
+ * e.g. pGRAMS_bin_196_0.dat.idx, and is reloaded if the data file is still the same, that is it has the
+ * same size, modification time and checksum of its first and last words (see DataFileId).
+ */
+struct EventIndexEntry {
+    uint64_t start_word;    // event start marker, or the word after the previous event if missing
+    uint64_t end_word;      // event end marker
+    uint32_t event_number;  // FEM event number from the first FEM header in the event
+    uint32_t num_fem;       // number of FEMs with consistent headers from the start of the event
+};
+
+// What a sidecar index is checked against, a rewritten file of the same size is caught by the others
+struct DataFileId {
+    uint64_t size = 0;
+    int64_t mtime = 0;       // seconds
+    uint64_t checksum = 0;   // of the first and last checksum_words_ words
+
+    static constexpr size_t checksum_words_ = 4096;
+    // The words are the file's contents, as mapped or read
+    static DataFileId Of(const std::string &data_file, uint64_t size, const uint32_t *data, size_t num_words);
+    bool operator==(const DataFileId &other) const {
+        return size == other.size && mtime == other.mtime && checksum == other.checksum;
+    }
+};
+
+class EventIndex {
+public:
+    EventIndex() = default;
+    ~EventIndex() = default;
+
+    static constexpr uint64_t index_magic_ = 0x3130305844495047; // "GPIDX001"
+    static constexpr uint32_t index_version_ = 3;
+
+    static std::string IndexFileName(const std::string &data_file) { return data_file + ".idx"; }
+
+    void Build(const uint32_t *data, size_t num_words);
+    bool Load(const std::string &index_file, const DataFileId &data_file);
+    bool Save(const std::string &index_file, const DataFileId &data_file) const;
+    void Clear() { entries_.clear(); }
+
+    bool Empty() const { return entries_.empty(); }
+    size_t NumEvents() const { return entries_.size(); }
+    const EventIndexEntry &At(const size_t event) const { return entries_.at(event); }
+    const std::vector<EventIndexEntry> &Entries() const { return entries_; }
+
+private:
+    std::vector<EventIndexEntry> entries_;
+};
+
+#endif //EVENT_INDEX_H
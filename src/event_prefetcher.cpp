@@ -0,0 +1,101 @@
+#include "event_prefetcher.h"
+#include "process_events.h"
+#include <algorithm>
+
+EventPrefetcher::EventPrefetcher(ProcessEvents &events, const size_t max_events_ahead) :
+    events_(events),
+    max_events_ahead_(std::max<size_t>(max_events_ahead, 1)) {
+}
+
+EventPrefetcher::~EventPrefetcher() {
+    Stop();
+}
+
+void EventPrefetcher::Start() {
+    if (Running()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) return;
+        stop_ = false;
+    }
+    thread_ = std::thread(&EventPrefetcher::DecodeLoop, this);
+}
+
+void EventPrefetcher::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    space_cv_.notify_all();
+    ready_cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+bool EventPrefetcher::Finished() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_;
+}
+
+void EventPrefetcher::DecodeLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_cv_.wait(lock, [this] { return stop_ || ready_.size() < max_events_ahead_; });
+            if (stop_) return;
+        }
+
+        bool decoded = false;
+        std::exception_ptr error;
+        try {
+            decoded = events_.DecodeEvent();
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error) {
+            error_ = error;
+            ready_cv_.notify_all();
+            return;
+        }
+        if (!decoded) {
+            finished_ = true;
+            ready_cv_.notify_all();
+            return;
+        }
+        Item item;
+        if (free_.empty()) {
+            item.event = std::make_unique<EventStruct>();
+        } else {
+            item.event = std::move(free_.back());
+            free_.pop_back();
+        }
+        std::swap(*item.event, events_.event_struct_);
+        item.event_index = events_.event_number_ - 1;
+        item.stats = events_.CurrentStats();
+        ready_.push_back(std::move(item));
+        ready_cv_.notify_all();
+    }
+}
+
+bool EventPrefetcher::NextEvent(EventStruct &event, size_t &event_index, DecoderStats &stats) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_cv_.wait(lock, [this] { return !ready_.empty() || finished_ || error_ || stop_; });
+    if (ready_.empty() && error_) {
+        // Thrown once, the thread has exited and the owner decodes on from where it stopped
+        std::exception_ptr error = std::move(error_);
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+    if (ready_.empty()) return false;
+
+    Item &item = ready_.front();
+    std::swap(event, *item.event);
+    event_index = item.event_index;
+    stats = item.stats;
+    // The event swapped out is the one the consumer is done with
+    if (free_.size() < max_events_ahead_) free_.push_back(std::move(item.event));
+    ready_.pop_front();
+    space_cv_.notify_all();
+    return true;
+}
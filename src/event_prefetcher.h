@@ -0,0 +1,69 @@
+#ifndef EVENT_PREFETCHER_H
+#define EVENT_PREFETCHER_H
+
+#include "decoder_stats.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ProcessEvents;
+struct EventStruct;
+
+/*
+ * Decode the events of a ProcessEvents ahead on a background thread.
+ *
+ * The thread runs the owner's decode (serial or parallel) and queues each event
+ * with the statistics as of that event, it stays at most max_events_ahead events
+ * ahead of the consumer. NextEvent hands them out in order, so whatever the consumer
+ * does with event k (e.g. analysis in python) overlaps with the decode of the next
+ * ones. While the thread runs it owns the decoder state, the owner only touches the
+ * queue. Stopping joins the thread and keeps what is queued.
+ */
+class EventPrefetcher {
+public:
+    EventPrefetcher(ProcessEvents &events, size_t max_events_ahead);
+    ~EventPrefetcher();
+
+    EventPrefetcher(const EventPrefetcher &) = delete;
+    EventPrefetcher &operator=(const EventPrefetcher &) = delete;
+
+    void Start();
+    void Stop();
+    bool Running() const { return thread_.joinable(); }
+    // The decode reached the end of the data (or gave up waiting for a followed file)
+    bool Finished();
+
+    // Waits for the next event, returns false once the queue is empty and the thread is done or stopped.
+    // An exception thrown by the decode is thrown from here after the events queued before it, the
+    // decode state is then where it was thrown so carrying on decoding picks up from there.
+    bool NextEvent(EventStruct &event, size_t &event_index, DecoderStats &stats);
+
+private:
+    struct Item {
+        std::unique_ptr<EventStruct> event;
+        size_t event_index = 0;
+        DecoderStats stats;
+    };
+
+    void DecodeLoop();
+
+    ProcessEvents &events_;
+    const size_t max_events_ahead_;
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::condition_variable space_cv_;
+    std::condition_variable ready_cv_;
+    bool stop_ = false;
+    bool finished_ = false;
+    std::exception_ptr error_;
+    std::deque<Item> ready_;
+    // Handed back events, reused so their buffers keep their capacity
+    std::vector<std::unique_ptr<EventStruct>> free_;
+};
+
+#endif //EVENT_PREFETCHER_H
@@ -0,0 +1,50 @@
+#include "header_table.h"
+#include "adc_kernels.h"
+#include "charge_light_decoder.h"
+#include <algorithm>
+
+void FemHeaderTable::Scan(const uint32_t *data, const size_t num_words) {
+    Clear();
+    decoder::Decoder header_decoder;
+
+    size_t word = decoder::kernels::FindWord(data, 0, num_words, decoder::Decoder::event_start_);
+    while (word < num_words) {
+        event_start_word.push_back(word);
+        const size_t end_word = decoder::Decoder::WalkFemHeaders(data, num_words, word + 1, [&](const size_t fem_word) {
+            const decoder::FemHeader &header = header_decoder.DecodeFemHeader(data + fem_word);
+            fem_start_word.push_back(fem_word);
+            slot_number.push_back(header.slot_number);
+            num_adc_word.push_back(header.num_adc_words);
+            event_number.push_back(header.event_number);
+            event_frame_number.push_back(header.event_frame_number);
+            trigger_frame_number.push_back(header_decoder.GetTriggerFrameNumber());
+            check_sum.push_back(header.checksum);
+            trigger_sample.push_back(header.trig_sample_number);
+        });
+        fem_offset.push_back(slot_number.size());
+
+        // The next event normally starts right after this one ends
+        if (end_word < num_words) {
+            word = end_word + 1;
+            if (word < num_words && decoder::Decoder::IsEventStart(data[word])) continue;
+        } else {
+            num_incomplete_events++;
+            word++;
+        }
+        word = decoder::kernels::FindWord(data, std::min(word, num_words), num_words, decoder::Decoder::event_start_);
+    }
+}
+
+void FemHeaderTable::Clear() {
+    event_start_word.clear();
+    fem_offset.assign(1, 0);
+    fem_start_word.clear();
+    slot_number.clear();
+    num_adc_word.clear();
+    event_number.clear();
+    event_frame_number.clear();
+    trigger_frame_number.clear();
+    check_sum.clear();
+    trigger_sample.clear();
+    num_incomplete_events = 0;
+}
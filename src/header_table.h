@@ -0,0 +1,46 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The FEM headers of a whole file as one columnar table, read without decoding
+ * any payload.
+ *
+ * Scan hops from FEM header to FEM header by the number of ADC words in each
+ * (see decoder::Decoder::WalkFemHeaders), so per FEM only its 6 header words are
+ * read and the payload pages of a memory mapped file are never touched. An event
+ * whose headers don't chain up to its end marker keeps the FEMs found up to the
+ * break, is counted in num_incomplete_events and the scan carries on from the next
+ * event start marker.
+ *
+ * The FEM columns are jagged by event like EventBatch, the FEMs of event i are
+ * [fem_offset[i], fem_offset[i+1]).
+ */
+struct FemHeaderTable {
+    // Event
+    std::vector<uint64_t> event_start_word; // the event start marker
+    std::vector<uint64_t> fem_offset{0};
+    // FEM
+    std::vector<uint64_t> fem_start_word;   // the first FEM header word
+    std::vector<uint16_t> slot_number;
+    std::vector<uint32_t> num_adc_word;
+    std::vector<uint32_t> event_number;
+    std::vector<uint32_t> event_frame_number;
+    std::vector<uint32_t> trigger_frame_number;
+    std::vector<uint32_t> check_sum;
+    std::vector<uint32_t> trigger_sample;
+
+    size_t num_incomplete_events = 0;
+
+    size_t NumEvents() const { return event_start_word.size(); }
+    size_t NumFems() const { return slot_number.size(); }
+
+    // Replace the contents with the headers of the num_words words of data
+    void Scan(const uint32_t *data, size_t num_words);
+    void Clear();
+};
+
+#endif //HEADER_TABLE_H
@@ -0,0 +1,80 @@
+#include "light_waveforms.h"
+#include "event_batch.h"
+#include <algorithm>
+#include <cstring>
+
+namespace decoder::light {
+
+    uint32_t FirstFrame(const uint32_t *frame_number, const size_t num_rois) {
+        if (num_rois == 0) return 0;
+        return *std::min_element(frame_number, frame_number + num_rois);
+    }
+
+    void Reconstruct(const Rois &rois, const uint32_t first_frame, const Geometry &geometry, uint16_t *waveforms) {
+        const auto num_samples = static_cast<int64_t>(geometry.NumSamples());
+        const auto samples_per_frame = static_cast<int64_t>(geometry.SamplesPerFrame());
+        std::fill_n(waveforms, geometry.NumWaveformSamples(), geometry.baseline);
+
+        for (size_t roi = 0; roi < rois.num_rois; roi++) {
+            const size_t row = static_cast<size_t>(rois.channel[roi]) - geometry.first_channel;
+            if (rois.channel[roi] < geometry.first_channel || row >= geometry.num_channels) continue;
+
+            const uint16_t *adc = rois.adc_words;
+            size_t length = rois.roi_length;
+            if (rois.adc_offset != nullptr) {
+                adc += rois.adc_offset[roi];
+                length = rois.adc_offset[roi + 1] - rois.adc_offset[roi];
+            } else {
+                adc += roi * rois.roi_length;
+            }
+            while (length > 0 && adc[length - 1] == UINT16_MAX) length--;
+
+            // Cut the ROI to the span of the waveform
+            int64_t start = (static_cast<int64_t>(rois.frame_number[roi]) - first_frame) * samples_per_frame +
+                            rois.sample_number[roi];
+            const int64_t end = std::min(start + static_cast<int64_t>(length), num_samples);
+            if (std::max<int64_t>(start, 0) >= end) continue;
+            if (start < 0) {
+                adc -= start;
+                start = 0;
+            }
+            std::memcpy(waveforms + row * num_samples + start, adc, (end - start) * sizeof(uint16_t));
+        }
+    }
+
+    void ReconstructBatch(const EventBatch &batch, const Geometry &geometry, std::vector<uint16_t> &waveforms,
+                          std::vector<uint32_t> &first_frames) {
+        const size_t num_events = batch.NumEvents();
+        waveforms.resize(num_events * geometry.NumWaveformSamples());
+        first_frames.resize(num_events);
+
+        for (size_t event = 0; event < num_events; event++) {
+            const size_t first_roi = batch.light_roi_offset[event];
+            Rois rois;
+            rois.channel = batch.light_channel.data() + first_roi;
+            rois.frame_number = batch.light_frame_number.data() + first_roi;
+            rois.sample_number = batch.light_sample_number.data() + first_roi;
+            rois.adc_words = batch.light_adc_words.data();
+            rois.adc_offset = batch.light_adc_offset.data() + first_roi;
+            rois.num_rois = batch.light_roi_offset[event + 1] - first_roi;
+
+            first_frames[event] = FirstFrame(rois.frame_number, rois.num_rois);
+            Reconstruct(rois, first_frames[event], geometry, waveforms.data() + event * geometry.NumWaveformSamples());
+        }
+    }
+
+    void Axis(const Geometry &geometry, const double trigger_frame, const double trigger_sample,
+              const double first_frame, const bool relative_to_trigger, double *axis) {
+        constexpr double light_sample_interval = 15.625; // ns, 64MHz
+
+        double trigger_index = 0;
+        if (relative_to_trigger) {
+            const double frame_offset = (trigger_frame - first_frame) * static_cast<double>(geometry.SamplesPerFrame());
+            trigger_index = frame_offset + trigger_sample;
+        }
+        for (size_t tick = 0; tick < geometry.NumSamples(); tick++) {
+            axis[tick] = (static_cast<double>(tick) - trigger_index) * light_sample_interval;
+        }
+    }
+
+} // decoder::light namespace
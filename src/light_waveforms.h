@@ -0,0 +1,64 @@
+#ifndef LIGHT_WAVEFORMS_H
+#define LIGHT_WAVEFORMS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct EventBatch;
+
+/*
+ * The full light waveform of each channel, put back together from its ROIs.
+ *
+ * Each light ROI is tagged with the frame it was read out in and the sample within
+ * the frame where it starts. A frame is time_size * 32 samples long so ROI j starts
+ * at sample (frame[j] - first_frame) * time_size * 32 + sample[j] of its channel.
+ * All the channels of an event are filled in one pass over the ROIs into a flat
+ * [num_channels x num_frames * time_size * 32] array, samples which no ROI covers
+ * are left at the baseline and ROIs (or parts of them) outside the span are dropped.
+ */
+namespace decoder::light {
+
+    struct Geometry {
+        size_t num_channels = 32;
+        size_t first_channel = 0;  // the channel of row 0
+        size_t num_frames = 4;
+        size_t time_size = 255;    // frame length in 32 sample units
+        uint16_t baseline = 2048;
+
+        size_t SamplesPerFrame() const { return time_size * 32; }
+        size_t NumSamples() const { return num_frames * SamplesPerFrame(); }
+        size_t NumWaveformSamples() const { return num_channels * NumSamples(); }
+    };
+
+    // The light ROIs of an event. The samples of ROI i are adc_words[adc_offset[i], adc_offset[i+1]),
+    // without offsets the ROIs are rows of roi_length samples (NumPy pads them with UINT16_MAX).
+    struct Rois {
+        const uint16_t *channel = nullptr;
+        const uint32_t *frame_number = nullptr;
+        const uint16_t *sample_number = nullptr;
+        const uint16_t *adc_words = nullptr;
+        const uint64_t *adc_offset = nullptr;
+        size_t roi_length = 0;
+        size_t num_rois = 0;
+    };
+
+    // The earliest frame with an ROI, 0 without ROIs
+    uint32_t FirstFrame(const uint32_t *frame_number, size_t num_rois);
+
+    // Fill waveforms, which has room for geometry.NumWaveformSamples(). Trailing UINT16_MAX
+    // padding of an ROI is left out.
+    void Reconstruct(const Rois &rois, uint32_t first_frame, const Geometry &geometry, uint16_t *waveforms);
+
+    // The waveforms of every event of a batch, one after the other, each from its own first frame
+    void ReconstructBatch(const EventBatch &batch, const Geometry &geometry, std::vector<uint16_t> &waveforms,
+                          std::vector<uint32_t> &first_frames);
+
+    // The time of each waveform sample in ns, fill axis with geometry.NumSamples() values. The light
+    // is sampled at 64MHz, relative to the trigger the trigger sample (in 64MHz ticks) is at 0.
+    void Axis(const Geometry &geometry, double trigger_frame, double trigger_sample, double first_frame,
+              bool relative_to_trigger, double *axis);
+
+} // decoder::light namespace
+
+#endif //LIGHT_WAVEFORMS_H
@@ -0,0 +1,52 @@
+#include "packed_waveforms.h"
+#include "adc_codec.h"
+
+void PackedWaveforms::AppendRow(const uint16_t *samples, const size_t num_samples) {
+    decoder::codec::EncodeAdc(samples, num_samples, bytes_);
+    byte_offsets_.push_back(bytes_.size());
+    sample_offsets_.push_back(sample_offsets_.back() + num_samples);
+}
+
+void PackedWaveforms::Pack(const WaveformArena &arena) {
+    clear();
+    byte_offsets_.reserve(arena.size() + 1);
+    sample_offsets_.reserve(arena.size() + 1);
+    for (const auto waveform : arena) AppendRow(waveform.data(), waveform.size());
+}
+
+bool PackedWaveforms::UnpackRow(const size_t row, uint16_t *samples) const {
+    const size_t first_byte = byte_offsets_[row];
+    return decoder::codec::DecodeAdc(bytes_.data() + first_byte, byte_offsets_[row + 1] - first_byte,
+                                     RowLength(row), samples);
+}
+
+bool PackedWaveforms::Unpack(WaveformArena &arena) const {
+    arena.clear();
+    arena.Reserve(size(), NumSamples());
+    for (size_t row = 0; row < size(); row++) {
+        if (!UnpackRow(row, arena.AllocateRow(RowLength(row)))) return false;
+    }
+    return true;
+}
+
+void PackedWaveforms::Release(std::vector<uint8_t> &bytes, std::vector<uint64_t> &byte_offsets,
+                              std::vector<uint64_t> &sample_offsets) {
+    bytes.swap(bytes_);
+    byte_offsets.swap(byte_offsets_);
+    sample_offsets.swap(sample_offsets_);
+    bytes_.clear();
+    byte_offsets_.assign(1, 0);
+    sample_offsets_.assign(1, 0);
+}
+
+void PackedWaveforms::clear() {
+    bytes_.clear();
+    byte_offsets_.resize(1);
+    sample_offsets_.resize(1);
+}
+
+void PackedWaveforms::swap(PackedWaveforms &other) noexcept {
+    bytes_.swap(other.bytes_);
+    byte_offsets_.swap(other.byte_offsets_);
+    sample_offsets_.swap(other.sample_offsets_);
+}
@@ -0,0 +1,48 @@
+#ifndef PACKED_WAVEFORMS_H
+#define PACKED_WAVEFORMS_H
+
+#include "waveform_arena.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * The compressed form of a WaveformArena, each waveform encoded on its own with
+ * decoder::codec so any one can be unpacked without the others. Waveform i is
+ * bytes[byte_offsets[i], byte_offsets[i+1]) holding samples
+ * [sample_offsets[i], sample_offsets[i+1]) of the unpacked arena.
+ */
+class PackedWaveforms {
+public:
+    PackedWaveforms() : byte_offsets_(1, 0), sample_offsets_(1, 0) {}
+
+    // Number of waveforms
+    size_t size() const { return byte_offsets_.size() - 1; }
+    bool empty() const { return byte_offsets_.size() == 1; }
+    size_t RowLength(const size_t row) const { return sample_offsets_[row + 1] - sample_offsets_[row]; }
+    size_t NumSamples() const { return sample_offsets_.back(); }
+    size_t NumBytes() const { return bytes_.size(); }
+
+    const std::vector<uint8_t> &Bytes() const { return bytes_; }
+    const std::vector<uint64_t> &ByteOffsets() const { return byte_offsets_; }
+    const std::vector<uint64_t> &SampleOffsets() const { return sample_offsets_; }
+
+    void AppendRow(const uint16_t *samples, size_t num_samples);
+    // Replace the contents with the waveforms of the arena
+    void Pack(const WaveformArena &arena);
+    // Unpack one waveform into samples, which has room for RowLength(row)
+    bool UnpackRow(size_t row, uint16_t *samples) const;
+    // Unpack all the waveforms, replacing the contents of the arena
+    bool Unpack(WaveformArena &arena) const;
+    // Hand the storage over (e.g. to NumPy), leaving it empty
+    void Release(std::vector<uint8_t> &bytes, std::vector<uint64_t> &byte_offsets, std::vector<uint64_t> &sample_offsets);
+    void clear();
+    void swap(PackedWaveforms &other) noexcept;
+
+private:
+    std::vector<uint8_t> bytes_;
+    std::vector<uint64_t> byte_offsets_;
+    std::vector<uint64_t> sample_offsets_;
+};
+
+#endif //PACKED_WAVEFORMS_H
@@ -0,0 +1,128 @@
+#include "parallel_decoder.h"
+#include "process_events.h"
+#include <algorithm>
+
+ParallelDecoder::ParallelDecoder(std::vector<std::unique_ptr<ProcessEvents>> workers,
+                                 const EventIndex &event_index, const size_t first_event,
+                                 const size_t end_event, const size_t events_per_task,
+                                 PedestalTracker *pedestals) :
+    event_index_(event_index),
+    first_event_(first_event),
+    end_event_(std::min(end_event, event_index.NumEvents())),
+    events_per_task_(std::max<size_t>(events_per_task, 1)),
+    num_tasks_(first_event >= end_event_ ? 0 : (end_event_ - first_event + events_per_task_ - 1) / events_per_task_),
+    max_tasks_ahead_(4 * std::max<size_t>(workers.size(), 1)),
+    pedestals_(pedestals),
+    workers_(std::move(workers)) {
+
+    threads_.reserve(workers_.size());
+    for (auto &worker : workers_) {
+        threads_.emplace_back(&ParallelDecoder::WorkerLoop, this, worker.get());
+    }
+}
+
+ParallelDecoder::~ParallelDecoder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto &thread : threads_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void ParallelDecoder::WorkerLoop(ProcessEvents *worker) {
+    PedestalTracker pedestals_before;
+    // Left empty once handed over, filled again from a recycled task when there is one
+    Task done;
+    while (true) {
+        size_t task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_cv_.wait(lock, [this] {
+                return stop_ || next_task_ >= num_tasks_ || next_task_ < consume_task_ + max_tasks_ahead_;
+            });
+            if (stop_ || next_task_ >= num_tasks_) return;
+            task = next_task_++;
+            if (!free_tasks_.empty()) {
+                done = std::move(free_tasks_.back());
+                free_tasks_.pop_back();
+            }
+            if (pedestals_) pedestals_before = *pedestals_;
+        }
+        if (pedestals_) worker->pedestals_ = pedestals_before;
+
+        const size_t begin = first_event_ + task * events_per_task_;
+        const size_t end = std::min(begin + events_per_task_, end_event_);
+        done.events.resize(end - begin);
+        done.rejected.resize(end - begin);
+        done.error = nullptr;
+        for (size_t event = begin; event < end; event++) {
+            worker->word_idx_ = event_index_.At(event).start_word;
+            worker->event_number_ = event;
+            // An event cut short (e.g. by the end of the data) is dropped like a rejected one. Nothing
+            // after an event which threw is handed out so the rest of the task is not decoded.
+            bool decoded = false;
+            if (!done.error) {
+                try {
+                    decoded = worker->GetEvent();
+                } catch (...) {
+                    done.error = std::current_exception();
+                    done.error_event = event - begin;
+                }
+            }
+            done.rejected[event - begin] = !decoded || worker->event_rejected_;
+            std::swap(done.events[event - begin], worker->event_struct_);
+        }
+        done.stats = worker->GetStats();
+        worker->ResetStats();
+        if (pedestals_) {
+            worker->pedestals_.Remove(pedestals_before);
+            std::swap(done.pedestals, worker->pedestals_);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_tasks_.emplace(task, std::move(done));
+        }
+        result_cv_.notify_all();
+    }
+}
+
+bool ParallelDecoder::NextEvent(EventStruct &event, size_t &event_number, DecoderStats &stats) {
+    while (true) {
+        // Pass over the events the filter rejected
+        const size_t num_events = current_task_.events.size();
+        while (have_task_ && current_idx_ < num_events && current_task_.rejected[current_idx_]) {
+            if (current_task_.error && current_idx_ == current_task_.error_event) {
+                std::rethrow_exception(current_task_.error);
+            }
+            current_idx_++;
+        }
+        if (have_task_ && current_idx_ < num_events) break;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (have_task_) {
+            // Done with this task, let the workers move one task further ahead
+            if (free_tasks_.size() < max_tasks_ahead_) free_tasks_.push_back(std::move(current_task_));
+            consume_task_++;
+            have_task_ = false;
+            task_cv_.notify_all();
+        }
+        if (consume_task_ >= num_tasks_) return false;
+
+        result_cv_.wait(lock, [this] { return done_tasks_.count(consume_task_) > 0; });
+        auto node = done_tasks_.find(consume_task_);
+        current_task_ = std::move(node->second);
+        stats += current_task_.stats;
+        if (pedestals_) pedestals_->Merge(current_task_.pedestals);
+        done_tasks_.erase(node);
+        current_idx_ = 0;
+        have_task_ = true;
+    }
+
+    event_number = first_event_ + consume_task_ * events_per_task_ + current_idx_;
+    std::swap(event, current_task_.events[current_idx_++]);
+    return true;
+}
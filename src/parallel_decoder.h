@@ -0,0 +1,91 @@
+#ifndef PARALLEL_DECODER_H
+#define PARALLEL_DECODER_H
+
+#include "decoder_stats.h"
+#include "event_index.h"
+#include "pedestal_tracker.h"
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ProcessEvents;
+struct EventStruct;
+
+/*
+ * Decode the events of one file on several threads.
+ *
+ * The events [first_event, end_event) of the file are split at the event
+ * boundaries from the EventIndex into tasks of a few consecutive events. Each
+ * worker owns its own ProcessEvents (and so its own decoder::Decoder) sharing
+ * the mapped file buffer, pulls the next task from
+ * the queue and decodes it into EventStructs. NextEvent hands the events back in
+ * file order, the workers are only allowed to run a bounded number of tasks ahead
+ * of the consumer so memory use stays fixed. The tasks are recycled, the events
+ * handed out are swapped with the consumer's so no buffers are allocated once
+ * the decode is running. The worker statistics travel with
+ * each task and are added to the consumer's as the task is handed out.
+ *
+ * When estimating pedestals each task starts from a copy of the consumer's table
+ * and its new sums are merged back as the task is handed out, so the table ends up
+ * with every decoded waveform the workers accepted.
+ */
+class ParallelDecoder {
+public:
+    ParallelDecoder(std::vector<std::unique_ptr<ProcessEvents>> workers, const EventIndex &event_index,
+                    size_t first_event, size_t end_event, size_t events_per_task,
+                    PedestalTracker *pedestals = nullptr);
+    ~ParallelDecoder();
+
+    ParallelDecoder(const ParallelDecoder &) = delete;
+    ParallelDecoder &operator=(const ParallelDecoder &) = delete;
+
+    // Returns false once all events have been handed out. An exception thrown by a worker's decode
+    // is thrown from here in place of its event.
+    bool NextEvent(EventStruct &event, size_t &event_number, DecoderStats &stats);
+
+private:
+    struct Task {
+        std::vector<EventStruct> events;
+        std::vector<uint8_t> rejected; // by the worker's event filter or not decoded, not handed out
+        DecoderStats stats;
+        PedestalTracker pedestals; // the sums added by this task
+        // Thrown by the decode of event error_event of the task, rethrown when it is reached
+        std::exception_ptr error;
+        size_t error_event = 0;
+    };
+
+    void WorkerLoop(ProcessEvents *worker);
+
+    const EventIndex &event_index_;
+    const size_t first_event_;
+    const size_t end_event_;
+    const size_t events_per_task_;
+    const size_t num_tasks_;
+    const size_t max_tasks_ahead_;
+    // The consumer's pedestal table, only read or written under mutex_ while the workers run
+    PedestalTracker *pedestals_;
+
+    std::vector<std::unique_ptr<ProcessEvents>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable task_cv_;
+    std::condition_variable result_cv_;
+    bool stop_ = false;
+    size_t next_task_ = 0;
+    size_t consume_task_ = 0;
+    std::map<size_t, Task> done_tasks_;
+    // Tasks handed out, reused so the event buffers keep their capacity
+    std::vector<Task> free_tasks_;
+
+    // The task currently being handed out, only touched by the consumer
+    Task current_task_;
+    size_t current_idx_ = 0;
+    bool have_task_ = false;
+};
+
+#endif //PARALLEL_DECODER_H
@@ -0,0 +1,135 @@
+#include "pedestal_tracker.h"
+#include "adc_kernels.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+double ChannelPedestal::Pedestal() const {
+    return num_samples > 0 ? static_cast<double>(sum) / static_cast<double>(num_samples) : 0.;
+}
+
+double ChannelPedestal::Variance() const {
+    if (num_samples == 0) return 0.;
+    const double pedestal = Pedestal();
+    return std::max(static_cast<double>(sum_sq) / static_cast<double>(num_samples) - pedestal * pedestal, 0.);
+}
+
+double ChannelPedestal::Rms() const {
+    return std::sqrt(Variance());
+}
+
+ChannelPedestal &ChannelPedestal::operator+=(const ChannelPedestal &other) {
+    num_events += other.num_events;
+    num_rejected += other.num_rejected;
+    num_samples += other.num_samples;
+    sum += other.sum;
+    sum_sq += other.sum_sq;
+    return *this;
+}
+
+ChannelPedestal &ChannelPedestal::operator-=(const ChannelPedestal &other) {
+    num_events -= other.num_events;
+    num_rejected -= other.num_rejected;
+    num_samples -= other.num_samples;
+    sum -= other.sum;
+    sum_sq -= other.sum_sq;
+    return *this;
+}
+
+void PedestalTracker::Add(const uint16_t slot, const size_t channel, const uint16_t *samples, const size_t num_samples) {
+    if (num_samples == 0 || !InRange(slot, channel)) return;
+    uint64_t sum, sum_sq;
+    decoder::kernels::SumAndSquares(samples, num_samples, sum, sum_sq);
+
+    ChannelPedestal &pedestal = channels_[slot * num_channels_ + channel];
+    if (pedestal.num_events >= min_events_) {
+        const double mean = static_cast<double>(sum) / static_cast<double>(num_samples);
+        const double variance = static_cast<double>(sum_sq) / static_cast<double>(num_samples) - mean * mean;
+        // Floor the variance at 1 ADC count^2 so a very quiet channel doesn't reject everything
+        if (variance > max_variance_ratio_ * std::max(pedestal.Variance(), 1.)) {
+            pedestal.num_rejected++;
+            return;
+        }
+    }
+    pedestal.num_events++;
+    pedestal.num_samples += num_samples;
+    pedestal.sum += sum;
+    pedestal.sum_sq += sum_sq;
+}
+
+void PedestalTracker::Reset() {
+    channels_.assign(num_slots_ * num_channels_, ChannelPedestal{});
+}
+
+void PedestalTracker::Merge(const PedestalTracker &other) {
+    for (size_t i = 0; i < channels_.size(); i++) channels_[i] += other.channels_[i];
+}
+
+void PedestalTracker::Remove(const PedestalTracker &other) {
+    for (size_t i = 0; i < channels_.size(); i++) channels_[i] -= other.channels_[i];
+}
+
+bool PedestalTracker::Ready(const uint16_t slot, const size_t channel) const {
+    return InRange(slot, channel) && At(slot, channel).num_events >= min_events_;
+}
+
+uint16_t PedestalTracker::Threshold(const uint16_t slot, const size_t channel, const double num_rms) const {
+    if (!InRange(slot, channel)) return UINT16_MAX;
+    const ChannelPedestal &pedestal = At(slot, channel);
+    const double threshold = std::ceil(pedestal.Pedestal() + num_rms * pedestal.Rms());
+    return static_cast<uint16_t>(std::clamp(threshold, 0., static_cast<double>(UINT16_MAX)));
+}
+
+bool PedestalTracker::Save(const std::string &file_name) const {
+    std::ofstream file(file_name);
+    if (!file) {
+        std::cerr << "Could not write pedestals: " << file_name << std::endl;
+        return false;
+    }
+    // The sums are kept so loading the table carries on the estimate exactly, the pedestal
+    // and RMS are only there to read
+    file << "# slot channel num_events num_rejected num_samples sum sum_sq pedestal rms\n";
+    for (uint16_t slot = 0; slot < num_slots_; slot++) {
+        for (size_t channel = 0; channel < num_channels_; channel++) {
+            const ChannelPedestal &pedestal = At(slot, channel);
+            if (pedestal.num_events == 0) continue;
+            file << slot << " " << channel << " " << pedestal.num_events << " " << pedestal.num_rejected << " "
+                 << pedestal.num_samples << " " << pedestal.sum << " " << pedestal.sum_sq << " "
+                 << pedestal.Pedestal() << " " << pedestal.Rms() << "\n";
+        }
+    }
+    if (!file) {
+        std::cerr << "Could not write pedestals: " << file_name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool PedestalTracker::Load(const std::string &file_name) {
+    std::ifstream file(file_name);
+    if (!file) {
+        std::cerr << "Could not open pedestals: " << file_name << std::endl;
+        return false;
+    }
+    std::vector<ChannelPedestal> channels(num_slots_ * num_channels_);
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        uint16_t slot;
+        size_t channel;
+        ChannelPedestal pedestal;
+        if (!(fields >> slot >> channel >> pedestal.num_events >> pedestal.num_rejected >> pedestal.num_samples >>
+              pedestal.sum >> pedestal.sum_sq) || !InRange(slot, channel)) {
+            std::cerr << "Bad pedestal line " << line_number << " in " << file_name << std::endl;
+            return false;
+        }
+        channels[slot * num_channels_ + channel] = pedestal;
+    }
+    channels_ = std::move(channels);
+    std::cout << "Loaded pedestals from " << file_name << std::endl;
+    return true;
+}
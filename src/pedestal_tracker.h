@@ -0,0 +1,75 @@
+#ifndef PEDESTAL_TRACKER_H
+#define PEDESTAL_TRACKER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Running pedestal (baseline) and RMS noise of every charge channel, keyed by
+ * (slot, channel within the FEM).
+ *
+ * Each full waveform adds its sample sum and sum of squares (one SIMD pass, see
+ * decoder::kernels::SumAndSquares) so the estimate is exact over all the samples
+ * accepted so far. A waveform with a pulse has a much larger spread than the noise,
+ * once a channel has min_events waveforms any whose variance is more than
+ * max_variance_ratio times the channel's is left out and only counted as rejected.
+ *
+ * Since only raw sums are kept, tables filled from different events (e.g. by parallel
+ * workers) merge exactly.
+ *
+ * The ROI threshold of a channel is pedestal + num_rms * RMS. The table can be saved
+ * to and loaded from a text file, one line per channel, so the next run starts with
+ * the thresholds of the last.
+ */
+struct ChannelPedestal {
+    uint64_t num_events = 0;
+    uint64_t num_rejected = 0;
+    uint64_t num_samples = 0;
+    uint64_t sum = 0;
+    uint64_t sum_sq = 0;
+
+    double Pedestal() const;
+    double Variance() const;
+    double Rms() const;
+
+    ChannelPedestal &operator+=(const ChannelPedestal &other);
+    ChannelPedestal &operator-=(const ChannelPedestal &other);
+};
+
+class PedestalTracker {
+public:
+    static constexpr size_t num_slots_ = 32;
+    static constexpr size_t num_channels_ = 64;
+
+    PedestalTracker() : channels_(num_slots_ * num_channels_) {}
+
+    void Add(uint16_t slot, size_t channel, const uint16_t *samples, size_t num_samples);
+    void Reset();
+    // Add the sums of another table, or take out those of a table this one started from
+    void Merge(const PedestalTracker &other);
+    void Remove(const PedestalTracker &other);
+
+    // A channel has a threshold once it has at least min_events waveforms
+    bool Ready(uint16_t slot, size_t channel) const;
+    uint16_t Threshold(uint16_t slot, size_t channel, double num_rms) const;
+    const ChannelPedestal &At(uint16_t slot, size_t channel) const { return channels_[slot * num_channels_ + channel]; }
+
+    void SetMinEvents(const size_t min_events) { min_events_ = std::max<size_t>(min_events, 1); }
+    size_t GetMinEvents() const { return min_events_; }
+    void SetMaxVarianceRatio(const double max_variance_ratio) { max_variance_ratio_ = max_variance_ratio; }
+
+    bool Save(const std::string &file_name) const;
+    bool Load(const std::string &file_name);
+
+private:
+    static bool InRange(const uint16_t slot, const size_t channel) { return slot < num_slots_ && channel < num_channels_; }
+
+    std::vector<ChannelPedestal> channels_;
+    size_t min_events_ = 10;
+    double max_variance_ratio_ = 4.;
+};
+
+#endif //PEDESTAL_TRACKER_H
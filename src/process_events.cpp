@@ -4,7 +4,11 @@
 
 #include "process_events.h"
 #include "charge_light_decoder.h"
-#include <cerrno>
+#include "adc_kernels.h"
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <thread>
 
 
 ProcessEvents::ProcessEvents(const uint16_t light_slot,
@@ -16,85 +20,370 @@ ProcessEvents::ProcessEvents(const uint16_t light_slot,
     skip_beam_roi_(skip_beam_roi),
     charge_light_decoder_(nullptr), light_slot_(light_slot) {
     charge_light_decoder_ = std::make_unique<decoder::Decoder>();
-    channel_full_waveform_.reserve(num_light_channels_);
-    channel_full_axis_.reserve(num_light_channels_);
+    light_fem_ = charge_light_decoder_->GetSlotNumber() == light_slot_;
+    data_buffer_ = std::make_shared<DataBuffer>();
 }
 
 ProcessEvents::~ProcessEvents() {
+    // Stop the workers before the buffer they are reading goes away
+    ResetPrefetch();
+    parallel_decoder_.reset(nullptr);
 
-    if (data_file_) {
+    // The workers share the buffer with their owner, only the owner closes it
+    if (!is_worker_ && data_buffer_->IsOpen()) {
         std::cout << "Closing data file!" << std::endl;
         open_file_name_ = "";
-        file_buffer_.reset(nullptr);
-        fclose(data_file_);
-        //delete[] data_file_; // FIXME memory freed twice!
-        data_file_ = nullptr;
+        file_buffer_ = nullptr;
+        file_open_ = false;
+        data_buffer_->Close();
     }
     charge_light_decoder_.reset(nullptr);
 }
 
+void ProcessEvents::CloseFile() {
+    ResetPrefetch();
+    parallel_decoder_.reset(nullptr);
+    run_reader_.reset(nullptr);
+    word_idx_ = 0;
+    event_number_ = 0;
+    end_word_ = SIZE_MAX;
+    resync_pending_ = false;
+    binary_32b_word_counter_ = 0;
+    if (data_buffer_->IsOpen()) {
+        std::cout << "Closing data file!" << std::endl;
+        file_buffer_ = nullptr;
+        file_num_words_ = 0;
+        file_open_ = false;
+        data_buffer_->Close();
+        event_index_.Clear();
+        open_file_name_ = "";
+    }
+}
+
+void ProcessEvents::SetDataBuffer(std::shared_ptr<DataBuffer> data_buffer) {
+    data_buffer_ = std::move(data_buffer);
+    file_buffer_ = data_buffer_->Data();
+    file_num_words_ = data_buffer_->NumWords();
+    file_open_ = true;
+    open_file_name_ = data_buffer_->FileName();
+    event_index_.Clear();
+    word_idx_ = 0;
+    binary_32b_word_counter_ = 0;
+}
+
 bool ProcessEvents::OpenFile(const std::string &file_name) {
 
-    if (open_file_name_ == file_name) {
+    if (open_file_name_ == file_name && !run_reader_) {
         std::cout << "File already opened!" << std::endl;
         return true;
     }
     // Check if the file is already open
     // In case there's a file already open
-    word_idx_ = 0;
-    event_number_ = 0;
-    binary_32b_word_counter_ = 0;
-    if (data_file_) {
-        file_buffer_.reset(nullptr);
-        std::cout << "Closing data file!" << std::endl;
-        fclose(data_file_);
-        //delete[] data_file_; // FIXME memory freed twice!
-        data_file_ = nullptr;
-        open_file_name_ = "";
-    }
+    CloseFile();
 
     std::cout << "Opening file " << file_name << std::endl;
-    data_file_ = fopen(file_name.c_str(), "rb");
-    if(data_file_ == nullptr) {
-        std::cerr << "Could not open file: " << file_name << std::endl;
+    // The buffer is either a view of the mapped file or, if mapping is disabled
+    // or fails, the whole file read into memory.
+    if (!data_buffer_->Open(file_name, use_mmap_)) {
         return false;
     }
+    file_buffer_ = data_buffer_->Data();
+    file_num_words_ = data_buffer_->NumWords();
+    file_open_ = true;
+    open_file_name_ = file_name;
+    return true;
+}
 
-    // Get file size
-    const long lCurPos = ftell(data_file_);
-    fseek(data_file_, 0, 2);
-    const long fileSize = ftell(data_file_);
-    fseek(data_file_, lCurPos, 0);
-    file_num_words_ = fileSize / sizeof(uint32_t);
-    std::cout << "File size: " << fileSize << std::endl;
-
-    // allocate space in the buffer for the whole file
-
-    file_buffer_ = std::make_unique<uint32_t[]>(file_num_words_);
-    std::cout << "Allocated file buffer.." << std::endl;
+bool ProcessEvents::OpenRun(const size_t run_number, const std::string &directory) {
+    const auto file_names = RunReader::FindRunFiles(directory, run_number);
+    if (file_names.empty()) {
+        std::cerr << "No files found for run " << run_number << " in " << directory << std::endl;
+        return false;
+    }
+    return OpenRunFiles(file_names);
+}
 
-    fread(file_buffer_.get(), fileSize, 1, data_file_);
-    if (ferror(data_file_)) {
-        std::cerr << "Error reading file: " << file_name << std::endl;
-        std::cerr << "Error code: [" << errno << "]" << std::endl;
+bool ProcessEvents::OpenRunFiles(const std::vector<std::string> &file_names) {
+    CloseFile();
+    std::cout << "Opening run of " << file_names.size() << " files" << std::endl;
+    run_reader_ = std::make_unique<RunReader>(file_names, use_mmap_);
+    auto data_buffer = run_reader_->OpenFirst();
+    if (!data_buffer) {
+        std::cerr << "Could not open any file of the run!" << std::endl;
+        run_reader_.reset(nullptr);
         return false;
     }
-    std::cout << "Read file.." << std::endl;
-    open_file_name_ = file_name;
+    SetDataBuffer(std::move(data_buffer));
+    return true;
+}
+
+bool ProcessEvents::NextRunFile() {
+    if (!run_reader_) return false;
+    auto data_buffer = run_reader_->OpenNext();
+    if (!data_buffer) return false;
+    std::cout << "Continuing run with file " << data_buffer->FileName() << std::endl;
+    SetDataBuffer(std::move(data_buffer));
     return true;
 }
 
 void ProcessEvents::RestartFile() {
-    // Restart at the beginning of the file.
+    // Restart at the beginning of the file (or the first file of a run).
     // Avoid reloading file but restart processing from beginning
+    ResetPrefetch();
+    parallel_decoder_.reset(nullptr);
+    if (run_reader_ && run_reader_->FileNumber() != 0) {
+        if (auto data_buffer = run_reader_->OpenFirst()) SetDataBuffer(std::move(data_buffer));
+    }
     word_idx_ = 0;
     event_number_ = 0;
+    resync_pending_ = false;
     binary_32b_word_counter_ = 0;
 }
 
+bool ProcessEvents::BuildEventIndex(const bool use_sidecar) {
+    if (!data_buffer_->IsOpen()) {
+        std::cerr << "No file open to index!" << std::endl;
+        return false;
+    }
+    const std::string index_file = EventIndex::IndexFileName(open_file_name_);
+    const DataFileId data_file = use_sidecar ? DataFileId::Of(open_file_name_, data_buffer_->FileSize(),
+                                                               file_buffer_, file_num_words_) : DataFileId{};
+    if (use_sidecar && event_index_.Load(index_file, data_file)) {
+        return true;
+    }
+    event_index_.Build(file_buffer_, file_num_words_);
+    // Failing to write the sidecar (e.g. read-only data directory) is not fatal
+    if (use_sidecar) event_index_.Save(index_file, data_file);
+    return true;
+}
+
+bool ProcessEvents::ScanHeaders(FemHeaderTable &table) const {
+    if (!data_buffer_->IsOpen()) {
+        std::cerr << "No file open to scan!" << std::endl;
+        return false;
+    }
+    table.Scan(file_buffer_, file_num_words_);
+    return true;
+}
+
+bool ProcessEvents::SeekEvent(const size_t event) {
+    if (event_index_.Empty() && !BuildEventIndex()) {
+        return false;
+    }
+    if (event > event_index_.NumEvents()) {
+        std::cerr << "Event " << event << " out of range, file has "
+                  << event_index_.NumEvents() << " events" << std::endl;
+        return false;
+    }
+    // A parallel decode restarts from here on the next GetEvent
+    ResetPrefetch();
+    parallel_decoder_.reset(nullptr);
+    word_idx_ = event < event_index_.NumEvents() ? event_index_.At(event).start_word : file_num_words_;
+    event_number_ = event;
+    resync_pending_ = false;
+    return true;
+}
+
+bool ProcessEvents::SetEndEvent(const size_t event) {
+    if (run_reader_) {
+        std::cerr << "An end event needs a single file, not a run" << std::endl;
+        return false;
+    }
+    if (event_index_.Empty() && !BuildEventIndex()) {
+        return false;
+    }
+    // The parallel decode picks up the new end on the next GetEvent
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    end_word_ = event < event_index_.NumEvents() ? event_index_.At(event).start_word : SIZE_MAX;
+    return true;
+}
+
+bool ProcessEvents::GetEventAt(const size_t event) {
+    if (event_index_.Empty() && !BuildEventIndex()) {
+        return false;
+    }
+    if (event >= event_index_.NumEvents()) {
+        std::cerr << "Event " << event << " out of range, file has "
+                  << event_index_.NumEvents() << " events" << std::endl;
+        return false;
+    }
+    // Jump straight to the event, GetEvent then decodes until its end marker
+    SeekEvent(event);
+    const size_t num_threads = num_threads_;
+    num_threads_ = 1;
+    single_event_ = true;
+    const bool ret = GetEvent();
+    single_event_ = false;
+    num_threads_ = num_threads;
+    return ret;
+}
+
+void ProcessEvents::SetNumThreads(const size_t num_threads) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    num_threads_ = std::max<size_t>(num_threads, 1);
+}
+
+// The workers and the prefetch thread copy or read the decode settings while they run, a change
+// stops them and the decode carries on with the new settings from the next event not yet decoded
+
+void ProcessEvents::SetEventsPerTask(const size_t events_per_task) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    events_per_task_ = events_per_task;
+}
+
+void ProcessEvents::UseEventStride(const bool use_event_stride) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    use_event_stride_ = use_event_stride;
+}
+
+void ProcessEvents::SetEventStride(const size_t event_stride) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    event_stride_ = std::max<size_t>(event_stride, 1);
+}
+
+void ProcessEvents::SetEventFilter(const EventFilter &event_filter) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    event_filter_ = event_filter;
+}
+
+void ProcessEvents::EnableTiming(const bool enable_timing) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    enable_timing_ = enable_timing;
+}
+
+void ProcessEvents::VerifyChecksum(const bool verify_checksum) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    verify_checksum_ = verify_checksum;
+}
+
+void ProcessEvents::PackAdcWords(const bool pack_adc_words) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    pack_adc_words_ = pack_adc_words;
+}
+
+void ProcessEvents::ResyncOnError(const bool resync_on_error) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    resync_on_error_ = resync_on_error;
+}
+
+void ProcessEvents::EstimatePedestals(const bool estimate_pedestals) {
+    // The workers copy the settings and the table when they start
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    estimate_pedestals_ = estimate_pedestals;
+}
+
+void ProcessEvents::UsePedestalThresholds(const bool use_pedestal_thresholds, const double num_rms) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    use_pedestal_thresholds_ = use_pedestal_thresholds;
+    pedestal_num_rms_ = num_rms;
+}
+
+void ProcessEvents::ResetPedestals() {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    pedestals_.Reset();
+}
+
+void ProcessEvents::SetPedestalMinEvents(const size_t min_events) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    pedestals_.SetMinEvents(min_events);
+}
+
+bool ProcessEvents::LoadPedestals(const std::string &file_name) {
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    return pedestals_.Load(file_name);
+}
+
+std::unique_ptr<ProcessEvents> ProcessEvents::MakeWorker() const {
+    auto worker = std::make_unique<ProcessEvents>(light_slot_, use_charge_roi_, channel_threshold_, skip_beam_roi_);
+    worker->is_worker_ = true;
+    worker->fill_py_dict_ = false;
+    worker->use_event_stride_ = use_event_stride_;
+    worker->event_stride_ = event_stride_;
+    worker->event_filter_ = event_filter_;
+    worker->single_event_ = true;
+    worker->enable_timing_ = enable_timing_;
+    worker->verify_checksum_ = verify_checksum_;
+    worker->pack_adc_words_ = pack_adc_words_;
+    worker->resync_on_error_ = resync_on_error_;
+    worker->estimate_pedestals_ = estimate_pedestals_;
+    worker->pedestals_ = pedestals_;
+    worker->use_pedestal_thresholds_ = use_pedestal_thresholds_;
+    worker->pedestal_num_rms_ = pedestal_num_rms_;
+    worker->data_buffer_ = data_buffer_;
+    worker->file_buffer_ = file_buffer_;
+    worker->file_num_words_ = file_num_words_;
+    worker->open_file_name_ = open_file_name_;
+    return worker;
+}
+
+bool ProcessEvents::GetEventParallel() {
+    if (!parallel_decoder_) {
+        if (event_index_.Empty() && !BuildEventIndex()) return false;
+        // Pick up from wherever the serial decoding left off
+        const auto &entries = event_index_.Entries();
+        const auto next = std::lower_bound(entries.begin(), entries.end(), word_idx_,
+            [](const EventIndexEntry &entry, const size_t word) { return entry.end_word < word; });
+        const size_t first_event = std::distance(entries.begin(), next);
+        const auto end = std::lower_bound(entries.begin(), entries.end(), end_word_,
+            [](const EventIndexEntry &entry, const size_t word) { return entry.start_word < word; });
+        const size_t end_event = std::distance(entries.begin(), end);
+
+        std::vector<std::unique_ptr<ProcessEvents>> workers;
+        for (size_t i = 0; i < num_threads_; i++) workers.push_back(MakeWorker());
+        parallel_decoder_ = std::make_unique<ParallelDecoder>(std::move(workers), event_index_,
+                                                              first_event, end_event, events_per_task_,
+                                                              estimate_pedestals_ ? &pedestals_ : nullptr);
+    }
+
+    size_t event;
+    bool have_event;
+    try {
+        have_event = parallel_decoder_->NextEvent(event_struct_, event, stats_);
+    } catch (...) {
+        // As the serial decode the error is thrown to the caller, the next call starts again from the event
+        parallel_decoder_.reset(nullptr);
+        throw;
+    }
+    if (!have_event) {
+        parallel_decoder_.reset(nullptr);
+        word_idx_ = file_num_words_;
+        file_open_ = false;
+        std::cout << "event_number_: " << event_number_ << std::endl;
+        return false;
+    }
+    event_number_ = event;
+    word_idx_ = event_index_.At(event).end_word + 1;
+    if ((event_number_ % 500) == 0) std::cout << "+++ Event [" << event_number_ << "]" << std::endl;
+#ifdef USE_PYBIND11
+    // The prefetch thread leaves the python objects to the owning thread
+    if (!prefetching_ && fill_py_dict_) {
+        StageTimer export_timer(enable_timing_, stats_.export_seconds);
+        FillPyDict(event_struct_, event_number_);
+    }
+#endif
+    data_buffer_->Release(event_index_.At(event).start_word);
+    event_number_++;
+    return true;
+}
+
 std::vector<uint32_t> ProcessEvents::GetBinaryData(size_t num_words) {
 
-    if (data_file_ == nullptr) { // Do nothing if file is not open
+    if (!file_open_) { // Do nothing if file is not open
         return {};
     }
     // If requesting more than the remaining file data, only return the remaining words
@@ -112,7 +401,105 @@ std::vector<uint32_t> ProcessEvents::GetBinaryData(size_t num_words) {
 }
 
 
+void ProcessEvents::FollowFile(const bool follow, const double poll_seconds, const double timeout_seconds) {
+    // The parallel decoder works from the event index, which is fixed once built
+    StopPrefetch();
+    parallel_decoder_.reset(nullptr);
+    follow_ = follow;
+    follow_poll_seconds_ = std::max(poll_seconds, 0.001);
+    follow_timeout_seconds_ = std::max(timeout_seconds, 0.);
+}
+
+bool ProcessEvents::WaitForData() {
+    using Clock = std::chrono::steady_clock;
+    const auto deadline = Clock::now() + std::chrono::duration<double>(follow_timeout_seconds_);
+    const auto poll = std::chrono::duration<double>(follow_poll_seconds_);
+    while (true) {
+        if (data_buffer_->Refresh()) {
+            // The buffer may have moved
+            file_buffer_ = data_buffer_->Data();
+            file_num_words_ = data_buffer_->NumWords();
+            return true;
+        }
+        const auto now = Clock::now();
+        if (now >= deadline) return false;
+        std::this_thread::sleep_for(std::min<std::chrono::duration<double>>(poll, deadline - now));
+    }
+}
+
+void ProcessEvents::StartPrefetch(const size_t max_events_ahead) {
+    if (!data_buffer_->IsOpen()) return;
+    if (event_prefetcher_) {
+        event_prefetcher_->Start();
+        return;
+    }
+    event_prefetcher_ = std::make_unique<EventPrefetcher>(*this, max_events_ahead);
+    prefetching_ = true;
+    event_prefetcher_->Start();
+}
+
+void ProcessEvents::StopPrefetch() {
+    if (event_prefetcher_) event_prefetcher_->Stop();
+}
+
+void ProcessEvents::ResetPrefetch() {
+    if (!event_prefetcher_) return;
+    event_prefetcher_->Stop();
+    prefetching_ = false;
+    event_prefetcher_.reset(nullptr);
+}
+
 bool ProcessEvents::GetEvent() {
+    if (event_prefetcher_) return GetEventPrefetched();
+    return DecodeEvent();
+}
+
+bool ProcessEvents::GetEventPrefetched() {
+    bool have_event;
+    {
+#ifdef USE_PYBIND11
+        // Let other python threads run while waiting for the decode
+        std::optional<py::gil_scoped_release> release;
+        if (PyGILState_Check()) release.emplace();
+#endif
+        try {
+            have_event = event_prefetcher_->NextEvent(prefetch_event_, prefetch_event_index_, prefetch_stats_);
+        } catch (...) {
+            // Thrown by the decode on the prefetch thread, the next call decodes on this thread
+            ResetPrefetch();
+            throw;
+        }
+    }
+    if (!have_event) {
+        // Everything decoded ahead was handed out. Stopped early, the decoding carries on here.
+        const bool finished = event_prefetcher_->Finished();
+        ResetPrefetch();
+        return finished ? false : DecodeEvent();
+    }
+#ifdef USE_PYBIND11
+    if (fill_py_dict_) FillPyDict(prefetch_event_, prefetch_event_index_);
+#endif
+    return true;
+}
+
+bool ProcessEvents::DecodeEvent() {
+
+    if (num_threads_ > 1 && !follow_ && !run_reader_) return GetEventParallel();
+
+    // The ROI and export stages are timed separately, they are taken out of the decode time on return
+    size_t start_word = word_idx_;
+    const double nested_seconds = stats_.roi_seconds + stats_.export_seconds;
+    double wait_seconds = 0;
+    StageTimer decode_timer(enable_timing_, stats_.decode_seconds);
+
+    // When following a file an event can be cut off by the end of the data written so far. If no
+    // more arrives in time the event is given up and decoded again from its start on the next call.
+    size_t event_start_word = word_idx_;
+    DecoderStats follow_stats{};
+    size_t follow_event_number = event_number_;
+    size_t follow_num_spans = resync_spans_.size();
+    const bool follow_resync_pending = resync_pending_;
+    if (follow_) follow_stats = stats_;
 
     bool read_charge_channel = false;
     bool read_light_channel = false;
@@ -122,68 +509,225 @@ bool ProcessEvents::GetEvent() {
 
     // Make sure the ADC vector is cleared and ready
     charge_light_decoder_->ResetAdcWordVector();
+    event_rejected_ = false;
+    const bool filter_events = FiltersEvents();
+
+    // The same buffer viewed as 16b words for the bulk charge sample extraction
+    auto *short_buffer = reinterpret_cast<const uint16_t *>(file_buffer_);
+    size_t file_num_shorts = file_num_words_ * 2;
 
     // This will run from the start of the event until
     // end of event marker is reached or if all words are
-    // read from file.
+    // read from file (or, following a file, no more words
+    // are written in time).
 
-    while (word_idx_ < file_num_words_) {
-        process_event_ = true;
-        const uint32_t word_32 = file_buffer_[word_idx_];
+    // At the end of the buffer move on to the next file of a run, or wait for a followed
+    // file to grow. Returns false if there is no more data.
+    auto next_data = [&]() {
+        while (word_idx_ >= file_num_words_) {
+            const size_t num_words = file_num_words_;
+            // Sum the FEM payload in this file while it is still open
+            SumFemPayload(num_words);
+            if (NextRunFile()) {
+                // The event carries on in the next file of the run, the decode state is kept
+                stats_.words_scanned += num_words - start_word;
+                CountSlotWords(num_words);
+                fem_start_word_ = 0;
+                fem_payload_word_ = 0;
+                start_word = 0;
+                event_start_word = 0;
+                continue;
+            }
+            StageTimer wait_timer(enable_timing_, wait_seconds);
+            if (!follow_ || !WaitForData()) return false;
+        }
+        short_buffer = reinterpret_cast<const uint16_t *>(file_buffer_);
+        file_num_shorts = file_num_words_ * 2;
+        return true;
+    };
+
+    while (word_idx_ < file_num_words_ || next_data()) {
+        // A resync that ran off the end of the data carries on in what comes next
+        if (resync_pending_ && !FindEventStart()) continue;
+        uint32_t word_32 = file_buffer_[word_idx_];
         word_idx_++;
         if (decoder::Decoder::IsEventStart(word_32)) {
             // Reset the FEM header decoder state machine
             ClearFemVectors();
+            event_start_word = word_idx_ - 1;
+            if (event_start_word >= end_word_) {
+                // The rest of the file is past the end event, the next call stops here again
+                word_idx_ = event_start_word;
+                stats_.words_scanned += word_idx_ - start_word;
+                stats_.decode_seconds -= stats_.roi_seconds + stats_.export_seconds - nested_seconds + wait_seconds;
+                return false;
+            }
+            if (!filter_events) continue;
+
+            // Read the event's FEM headers ahead and jump straight to its end marker if it is rejected
+            const size_t end_word = decoder::Decoder::WalkFemHeaders(file_buffer_, file_num_words_, word_idx_,
+                [this](const size_t word) {
+                    header_decoder_.DecodeFemHeader(&file_buffer_[word]);
+                    NoteFemHeader(header_decoder_);
+                });
+            if (end_word >= file_num_words_ || AcceptEvent()) continue;
+            stats_.events_skipped++;
+            stats_.words_skipped += end_word + 1 - word_idx_;
+            word_idx_ = end_word + 1;
+            event_number_++;
+            if (!is_worker_) data_buffer_->Release(word_idx_);
+            if (single_event_) {
+                event_rejected_ = true;
+                stats_.words_scanned += word_idx_ - start_word;
+                return false;
+            }
             continue;
         }
         if (decoder::Decoder::IsEventEnd(word_32)) {
-            if ((event_number_ % 500) == 0) std::cout << "+++ Event [" << event_number_ << "]" << std::endl;
+            CountSlotWords(word_idx_ - 1);
+            CheckFemChecksum(word_idx_ - 1);
+            fem_open_ = false;
+            if (filter_events && !AcceptEvent()) {
+                // The headers did not allow skipping the event, it was decoded and is dropped now
+                stats_.events_skipped++;
+                event_number_++;
+                if (!is_worker_) data_buffer_->Release(word_idx_);
+                if (single_event_) {
+                    event_rejected_ = true;
+                    stats_.words_scanned += word_idx_ - start_word;
+                    return false;
+                }
+                continue;
+            }
+            if (!is_worker_ && (event_number_ % 500) == 0) std::cout << "+++ Event [" << event_number_ << "]" << std::endl;
+            stats_.events++;
+            stats_.words_scanned += word_idx_ - start_word;
             FillFemDict();
+            // Hand the decoded pages back so memory use does not grow with the file size
+            if (!is_worker_) data_buffer_->Release(word_idx_);
             event_number_++;
+            stats_.decode_seconds -= stats_.roi_seconds + stats_.export_seconds - nested_seconds + wait_seconds;
             return true;
         }
-        if (use_event_stride_ && ((event_number_ % event_stride_) != 0)) {
-            process_event_ = false;
-        }
+        process_event_ = ProcessFem();
 
         if (decoder::Decoder::IsHeaderWord(word_32)) {
-            // returns true when the last FEM header word is reached, so set the FEM data
-            if (charge_light_decoder_->FemHeaderDecode(word_32)) SetFemData();
+            // The 6 header words normally arrive together with all their header nibbles set so they
+            // are decoded in one go. Otherwise step through them with the header state machine,
+            // which returns true when the last FEM header word is reached.
+            bool fem_header_done;
+            const uint32_t *header_words = &file_buffer_[word_idx_ - 1];
+            const bool all_header_words = word_idx_ + 5 <= file_num_words_;
+            const bool whole_header = charge_light_decoder_->HeaderWord == 0 && all_header_words &&
+                                      decoder::Decoder::IsFemHeader(header_words);
+            if (whole_header) {
+                charge_light_decoder_->DecodeFemHeader(header_words);
+                word_idx_ += 5;
+                fem_header_done = true;
+            } else {
+                if (charge_light_decoder_->HeaderWord == 0 && all_header_words) {
+                    stats_.bad_fem_headers++;
+                    if (resync_on_error_) {
+                        if (Resync(event_start_word, word_idx_ - 1)) continue;
+                        stats_.words_scanned += word_idx_ - start_word;
+                        return false;
+                    }
+                }
+                fem_header_done = charge_light_decoder_->FemHeaderDecode(word_32);
+            }
+            // The FEM's ADC word count has to land on the next FEM header or the event end
+            if (whole_header && resync_on_error_ &&
+                !FemEndsOnBoundary(word_idx_ - 6, charge_light_decoder_->GetNumAdcWords())) {
+                if (Resync(event_start_word, word_idx_ - 6)) continue;
+                stats_.words_scanned += word_idx_ - start_word;
+                return false;
+            }
+            if (fem_header_done) {
+                SetFemData();
+                // A new FEM, nothing carries over from a channel or ROI left open by the previous one
+                read_charge_channel = false;
+                read_light_channel = false;
+                light_word_header_done = false;
+                reading_light_channel_roi = false;
+                charge_light_decoder_->LightWord = 0;
+                charge_light_decoder_->ResetAdcWordVector();
+                // A charge FEM of known geometry is decoded in one go, the word by word decode below
+                // takes over if it does not have the expected layout
+                const size_t payload_end = word_idx_ +
+                    decoder::Decoder::FemPayloadWords(charge_light_decoder_->GetNumAdcWords());
+                if (charge_fem_decoder_ != nullptr && ProcessFem() && payload_end <= file_num_words_ &&
+                    (this->*charge_fem_decoder_)(&short_buffer[word_idx_ * 2])) {
+                    word_idx_ = payload_end;
+                }
+                // Jump over the payload of a FEM the filter rejects if it ends where its header says
+                if (skip_fem_) {
+                    const size_t fem_end = fem_start_word_ + 6 +
+                        decoder::Decoder::FemPayloadWords(charge_light_decoder_->GetNumAdcWords());
+                    if (fem_end < file_num_words_ && (decoder::Decoder::IsEventEnd(file_buffer_[fem_end]) ||
+                        (fem_end + 6 <= file_num_words_ && decoder::Decoder::IsFemHeader(&file_buffer_[fem_end])))) {
+                        stats_.words_skipped += fem_end - word_idx_;
+                        word_idx_ = fem_end;
+                    }
+                }
+            }
             continue;
         }
 
-        const uint16_t slot_number = charge_light_decoder_->GetSlotNumber();
-        for (size_t j = 0; j < 2; j++) {
+        // The FEM type is known from its header so each loop only deals with the words its FEM can hold,
+        // the type of each word comes from a table lookup on its top nibble
+        if (!light_fem_) {
+            for (size_t j = 0; j < 2; j++) {
 
-            // FIXME The 16b words should be aligned as a 32b word at this point but should add check
-            // 32b word & 0xFFFF is 1R the 1st word
-            // (32b word >> 16) & 0xFFFF is 1L the 2nd word
-            uint16_t word = j == 0 ? word_32 & 0xFFFF : (word_32 >> 16) & 0xFFFF;
-            if (word == 0x0) continue;
+                // FIXME The 16b words should be aligned as a 32b word at this point but should add check
+                // 32b word & 0xFFFF is 1R the 1st word
+                // (32b word >> 16) & 0xFFFF is 1L the 2nd word
+                const uint16_t word = j == 0 ? word_32 & 0xFFFF : (word_32 >> 16) & 0xFFFF;
+                if (word == 0x0) continue;
 
-            if (decoder::Decoder::ChargeChannelStart(word) && !read_charge_channel && slot_number != light_slot_) {
-                // std::cout << "ChargeChannel Start " << (word & 0x3F) << "\n";
-                read_charge_channel = true;
-            }
-            else if (decoder::Decoder::ChargeChannelEnd(word) && read_charge_channel && slot_number != light_slot_) {
-                read_charge_channel = false;
-                if (process_event_) {
-                    if (use_charge_roi_) {
-                        ChargeRoi(charge_channel_number_++, charge_light_decoder_->GetAdcWords());
-                    } else {
-                        charge_adc_.push_back(charge_light_decoder_->GetAdcWords());
-                        charge_channel_.push_back(charge_channel_number_++);
-                   }
+                const decoder::WordType word_type = decoder::ChargeWordType(word);
+                if (!read_charge_channel) {
+                    // Anything between channels other than a channel start is ignored
+                    if (word_type == decoder::WordType::ChargeChannelStart) read_charge_channel = true;
+                    continue;
                 }
-                charge_light_decoder_->ResetAdcWordVector();
-            }
-            else if (read_charge_channel) {
+                if (word_type == decoder::WordType::ChargeChannelEnd) {
+                    read_charge_channel = false;
+                    if (process_event_) {
+                        stats_.charge_channels++;
+                        const std::vector<uint16_t> &samples = charge_light_decoder_->GetAdcWords();
+                        ChargeChannel(samples.data(), samples.size());
+                    }
+                    charge_light_decoder_->ResetAdcWordVector();
+                    continue;
+                }
+
                 charge_light_decoder_->DecodeAdcWord(word);
-                // charge_light_decoder_->GetChargeAdcChunk<595>(word_idx_, j, file_buffer_, &charge_adc_arr_);
-                // j = 1; // we are guaranteed to have the chunk aligned to the 32b word so break the loop
-                // break; // we are guaranteed to have the chunk aligned to the 32b word so break the loop
+                // Everything up to the channel end marker is a plain sample so take the
+                // whole run at once instead of feeding it word by word through this loop.
+                const size_t next_short = (word_idx_ - 1) * 2 + j + 1;
+                const size_t num_samples = charge_light_decoder_->GetChargeAdcChunk(&short_buffer[next_short],
+                                                                                     file_num_shorts - next_short);
+                if (num_samples > 0) {
+                    const size_t resume_short = next_short + num_samples;
+                    word_idx_ = resume_short / 2;
+                    // Resume on a fresh 32b word, it gets the full event/header word checks
+                    if ((resume_short & 0x1) == 0) break;
+                    // Otherwise the right 16b word was a sample, resume on the left word
+                    word_32 = file_buffer_[word_idx_++];
+                    j = 0;
+                }
             }
-            else if (decoder::Decoder::LightChannelStart(word) && slot_number == light_slot_) {
+            continue;
+        }
+
+        // ROIs within a light FEM
+        for (size_t j = 0; j < 2; j++) {
+            const uint16_t word = j == 0 ? word_32 & 0xFFFF : (word_32 >> 16) & 0xFFFF;
+            if (word == 0x0) continue;
+
+            const uint8_t word_class = decoder::LightWordClass(word);
+            const auto word_type = static_cast<decoder::WordType>(word_class & decoder::word_type_mask_);
+            if (word_type == decoder::WordType::LightChannelStart) {
                 read_light_channel = true;
                 // Initialize everything just to make sure nothing persists from the previous
                 // event. A fresh event should have a fresh start
@@ -191,136 +735,224 @@ bool ProcessEvents::GetEvent() {
                 charge_light_decoder_->ResetAdcWordVector();
                 light_word_header_done = false;
                 reading_light_channel_roi = false;
+                continue;
             }
-            else if (decoder::Decoder::LightChannelEnd(word) && slot_number == light_slot_) {
+            if (word_type == decoder::WordType::LightChannelEnd) {
                 read_light_channel = false;
+                continue;
             }
-            // ROIs within a light FEM
-            else if (read_light_channel) {
-                // std::cout <<  std::hex << word << ",";
-                if (!decoder::Decoder::LightChannelIntmed(word)) {
-                    // std::cerr << "Unexpected word ID!" << std::endl;
-                }
-                if (decoder::Decoder::LightRoiHeader1(word) || !light_word_header_done) {
+            if (!read_light_channel) continue;
+
+            // std::cout <<  std::hex << word << ",";
+            if (word_class & decoder::non_intermediate_word_) {
+                // std::cerr << "Unexpected word ID!" << std::endl;
+                stats_.non_intermediate_light_words++;
+            }
+            switch (word_type) {
+                case decoder::WordType::LightRoiHeader1: {
                     // We need to check first in case there was no ROI end marker in which case we
                     // need to reset the ROI header state machine and clear the sample array.
-                    if (decoder::Decoder::LightRoiHeader1(word)) {
+                    if (reading_light_channel_roi) {
                         // If there was no end of ROI marker, drop data, reset and keep going
-                        if (reading_light_channel_roi) {
-                            charge_light_decoder_->LightWord = 0;
-                            charge_light_decoder_->ResetAdcWordVector();
-                        }
-                        reading_light_channel_roi = true;
-                    }
-                    if (decoder::Decoder::LightValidRoiHeader(word)) light_word_header_done = charge_light_decoder_->FemLightDecode(word);
-                    // Unexpected end ROI marker, reset everything
-                    if (decoder::Decoder::LightRoiEnd(word)) {
+                        stats_.light_rois_missing_end++;
                         charge_light_decoder_->LightWord = 0;
                         charge_light_decoder_->ResetAdcWordVector();
-                        reading_light_channel_roi = false;
-                        light_word_header_done = false;
                     }
+                    reading_light_channel_roi = true;
+                    light_word_header_done = charge_light_decoder_->FemLightDecode(word);
                     // std::cout << " RH1" << std::dec << " [" << tmp_counter << "] ";
+                    break;
                 }
-                else if (decoder::Decoder::LightRoiHeader2(word) && reading_light_channel_roi) {
-                    tmp_counter++;
-                    charge_light_decoder_->DecodeAdcWord(word);
-                    // std::cout << " RH2" << std::dec << " [" << tmp_counter << "] ";
+                case decoder::WordType::LightRoiHeader2: {
+                    if (!light_word_header_done) {
+                        light_word_header_done = charge_light_decoder_->FemLightDecode(word);
+                    }
+                    else if (reading_light_channel_roi) {
+                        tmp_counter++;
+                        charge_light_decoder_->DecodeAdcWord(word);
+                        // std::cout << " RH2" << std::dec << " [" << tmp_counter << "] ";
+                    }
+                    else stats_.unexpected_light_words++;
+                    break;
                 }
-                else if (decoder::Decoder::LightRoiEnd(word) && reading_light_channel_roi) {
-                    // std::cout << " RE" << std::dec << " ["<< tmp_counter << "] ";
-                    charge_light_decoder_->LightWord = 0;
-                    uint16_t disc_id = charge_light_decoder_->GetLightTriggerId();
-                    if(process_event_ && (!skip_beam_roi_ || (disc_id != 0x4)) && reading_light_channel_roi) {
-                        light_adc_.push_back(charge_light_decoder_->GetAdcWords());
-                        light_channel_.push_back(charge_light_decoder_->GetLightChannel());
-                        light_trigger_id_.push_back(disc_id);
-                        light_header_tag_.push_back(charge_light_decoder_->GetLightHeaderTag());
-                        light_word_tag_.push_back(charge_light_decoder_->GetLightWordTag());
-                        light_frame_number_.push_back(charge_light_decoder_->GetLightFrameNumber());
-                        light_sample_number_.push_back(charge_light_decoder_->GetLightSampleNumber());
+                case decoder::WordType::LightRoiEnd: {
+                    if (!light_word_header_done) {
+                        // Unexpected end ROI marker, reset everything
+                        charge_light_decoder_->FemLightDecode(word);
+                        stats_.light_rois_truncated_header++;
+                        charge_light_decoder_->LightWord = 0;
+                        charge_light_decoder_->ResetAdcWordVector();
+                        reading_light_channel_roi = false;
+                        light_word_header_done = false;
                     }
-                    charge_light_decoder_->ResetAdcWordVector();
-                    light_word_header_done = false;
-                    reading_light_channel_roi = false;
-                    tmp_counter = 0;
+                    else if (reading_light_channel_roi) {
+                        // std::cout << " RE" << std::dec << " ["<< tmp_counter << "] ";
+                        charge_light_decoder_->LightWord = 0;
+                        uint16_t disc_id = charge_light_decoder_->GetLightTriggerId();
+                        if (process_event_ && (!skip_beam_roi_ || (disc_id != 0x4))) {
+                            light_adc_.AppendRow(charge_light_decoder_->GetAdcWords());
+                            light_channel_.push_back(charge_light_decoder_->GetLightChannel());
+                            light_trigger_id_.push_back(disc_id);
+                            light_header_tag_.push_back(charge_light_decoder_->GetLightHeaderTag());
+                            light_word_tag_.push_back(charge_light_decoder_->GetLightWordTag());
+                            light_frame_number_.push_back(charge_light_decoder_->GetLightFrameNumber());
+                            light_sample_number_.push_back(charge_light_decoder_->GetLightSampleNumber());
+                            stats_.light_rois_kept++;
+                        }
+                        else if (!process_event_) stats_.light_rois_stride_skipped++;
+                        else stats_.light_rois_beam_skipped++;
+                        charge_light_decoder_->ResetAdcWordVector();
+                        light_word_header_done = false;
+                        reading_light_channel_roi = false;
+                        tmp_counter = 0;
+                    }
+                    else stats_.unexpected_light_words++;
+                    break;
                 }
-                else {
-                    // std::cout << "Unexpected light word! " << (word & 0x3000)  << " "
-                    // << light_word_header_done << std::endl;
+                default: {
+                    // Neither a ROI header nor a sample, only harmless while still in the ROI header
+                    if (light_word_header_done) {
+                        // std::cout << "Unexpected light word! " << (word & 0x3000)  << " "
+                        // << light_word_header_done << std::endl;
+                        stats_.unexpected_light_words++;
+                    }
+                    break;
                 }
             }
         }
     }
 
-    if (data_file_ != nullptr) {
-        fclose(data_file_);
-        data_file_ = nullptr;
+    if (follow_) {
+        // Nothing new within the timeout, the file stays open and the partial event is left for the next call
+        word_idx_ = event_start_word;
+        stats_ = follow_stats;
+        // An event dropped by a resync is found corrupt again, only a search left over from an
+        // earlier call carries on from where it got to
+        event_number_ = follow_event_number;
+        resync_spans_.resize(follow_num_spans);
+        resync_pending_ = follow_resync_pending;
+        stats_.decode_seconds -= wait_seconds;
+        return false;
     }
 
+    if (file_open_) {
+        data_buffer_->Release(file_num_words_);
+        file_open_ = false;
+    }
+
+    stats_.words_scanned += word_idx_ - start_word;
+    stats_.decode_seconds -= stats_.roi_seconds + stats_.export_seconds - nested_seconds + wait_seconds;
     std::cout << "event_number_: " << event_number_ << std::endl;
     return false;
 }
 
-void ProcessEvents::ChargeRoi(const uint16_t channel, const std::vector<uint16_t> &charge_words) {
-    const size_t pre_samples = 10;
-    const size_t num_samples = 40;
-    const uint16_t thresh = channel_threshold_.at(channel);
-    bool is_roi_window = false;
-    size_t end_idx = 0;
+ProcessEvents::ChargeFemDecoder ProcessEvents::SelectChargeFemDecoder(const uint32_t num_adc_words) {
+    switch (num_adc_words) {
+        case decoder::ChargeReadout595::num_adc_words: return &ProcessEvents::DecodeChargeFem<decoder::ChargeReadout595>;
+        case decoder::ChargeReadout763::num_adc_words: return &ProcessEvents::DecodeChargeFem<decoder::ChargeReadout763>;
+        default: return nullptr;
+    }
+}
 
-    std::vector<uint16_t> tmp_charge_words;
-    std::vector<uint16_t> tmp_charge_idx;
+template <typename Readout>
+bool ProcessEvents::DecodeChargeFem(const uint16_t *payload) {
+    constexpr size_t num_samples = Readout::samples_per_channel;
+    constexpr size_t channel_words = Readout::channel_words;
 
-    // Construct a channel empty vector and note which channel it is
-    // charge_channel_.push_back(channel);
-    // charge_adc_.emplace_back();
-    // charge_adc_idx_.emplace_back();
+    // Check the whole payload first so a FEM which doesn't fit is left untouched for the word by word decode
+    for (size_t channel = 0; channel < Readout::channels_per_fem; channel++) {
+        const uint16_t *words = payload + channel * channel_words;
+        if (decoder::ChargeWordType(words[0]) != decoder::WordType::ChargeChannelStart ||
+            decoder::ChargeWordType(words[channel_words - 1]) != decoder::WordType::ChargeChannelEnd ||
+            !decoder::kernels::AllPlainSamples<num_samples>(words + 1)) {
+            return false;
+        }
+    }
+    // The samples have an empty top nibble so they are copied as is
+    for (size_t channel = 0; channel < Readout::channels_per_fem; channel++) {
+        ChargeChannel(payload + channel * channel_words + 1, num_samples);
+    }
+    stats_.charge_channels += Readout::channels_per_fem;
+    return true;
+}
+
+uint16_t ProcessEvents::ChargeThreshold(const size_t fem_channel) const {
+    if (use_pedestal_thresholds_ && pedestals_.Ready(fem_slot_, fem_channel)) {
+        return pedestals_.Threshold(fem_slot_, fem_channel, pedestal_num_rms_);
+    }
+    return channel_threshold_.at(fem_channel);
+}
+
+void ProcessEvents::ChargeChannel(const uint16_t *samples, const size_t num_samples) {
+    const size_t fem_channel = charge_channel_number_ - fem_first_channel_;
+    if (estimate_pedestals_) pedestals_.Add(fem_slot_, fem_channel, samples, num_samples);
+    if (use_charge_roi_) {
+        ChargeRoi(charge_channel_number_++, samples, num_samples, ChargeThreshold(fem_channel));
+    } else {
+        std::copy_n(samples, num_samples, charge_adc_.AllocateRow(num_samples));
+        charge_channel_.push_back(charge_channel_number_++);
+    }
+}
+
+void ProcessEvents::ChargeRoi(const uint16_t channel, const uint16_t *charge_words, const size_t num_words,
+                              const uint16_t thresh) {
+    const size_t pre_samples = 10;
+    const size_t num_samples = 40;
+    const uint16_t *words = charge_words;
+    StageTimer roi_timer(enable_timing_, stats_.roi_seconds);
 
     // The idea is to find when a channel crosses a threshold based on each channel's measured
     // baseline and RMS. When the channel goes above threshold M samples before the crossing
-    // are saved and when it goes below threshold N samples are saved after. The absolute index
-    // is also saved so the full waveform can be reconstructed from ROIs.
-    for (size_t sample = 0; sample < charge_words.size(); sample++) {
-        if (charge_words.at(sample) > thresh && !is_roi_window) {
-            // Make sure we don't run off the front of the vector and don't repeat samples that
-            // are from a close pulses.
-            size_t start_idx = (sample < pre_samples) ? 0 : sample - pre_samples;
-            start_idx -= (sample < end_idx + pre_samples + 1) && (sample > pre_samples-1) ? (sample - end_idx) : 0;
-            for (size_t pre = start_idx; pre < sample+1; pre++) {
-                tmp_charge_words.push_back(charge_words.at(pre));
-                tmp_charge_idx.push_back(pre);
-            }
-            is_roi_window = true;
-            end_idx = sample;
-        } else {
-            if (is_roi_window && (sample < end_idx+num_samples)) {
-                tmp_charge_words.push_back(charge_words.at(sample));
-                tmp_charge_idx.push_back(sample);
-                if (sample == (end_idx+num_samples-1)) {
-                    charge_adc_.emplace_back(tmp_charge_words);
-                    charge_adc_idx_.emplace_back(tmp_charge_idx);
-                    charge_channel_.push_back(channel);
-                    tmp_charge_words.clear();
-                    tmp_charge_idx.clear();
-                    is_roi_window = false;
-                    end_idx = sample;
-                }
-            } else {
-                // continue;
-                end_idx = sample;
-            }
+    // are saved and N samples after it. The absolute index is also saved so the full waveform
+    // can be reconstructed from ROIs.
+    //
+    // Only the crossings are searched for (a block of samples at a time), the ROI is then a
+    // single contiguous span copied in one go. The window bounds reproduce the original
+    // sample-by-sample implementation exactly, including its quirks: the pre-samples span
+    // pre_samples+1 samples before the crossing, a crossing at exactly sample pre_samples keeps
+    // no pre-samples (nor the crossing) and samples inside a window are never re-tested.
+    size_t sample = decoder::kernels::FindAboveThreshold(words, 0, num_words, thresh);
+    while (sample < num_words) {
+        size_t start_idx;
+        if (sample < pre_samples) start_idx = 0;
+        else if (sample == pre_samples) start_idx = sample + 1;
+        else start_idx = sample - pre_samples - 1;
+        const size_t end_idx = std::min(sample + num_samples, num_words);
+
+        if (start_idx < end_idx) {
+            const size_t roi_size = end_idx - start_idx;
+            charge_adc_.AppendRow(words + start_idx, roi_size);
+            uint16_t *roi_idx = charge_adc_idx_.AllocateRow(roi_size);
+            for (size_t i = 0; i < roi_size; i++) roi_idx[i] = static_cast<uint16_t>(start_idx + i);
+            charge_channel_.push_back(channel);
+            stats_.charge_rois++;
         }
-    }
-    // In case there is a partial ROI
-    if (!tmp_charge_words.empty()) {
-        charge_adc_.emplace_back(tmp_charge_words);
-        charge_adc_idx_.emplace_back(tmp_charge_idx);
-        charge_channel_.push_back(channel);
+        // The window closes on its last sample and the search resumes after it
+        sample = decoder::kernels::FindAboveThreshold(words, sample + num_samples, num_words, thresh);
     }
 }
 
 void ProcessEvents::SetFemData() {
+    // Called on the last of the 6 header words, the FEM starts at the first
+    const size_t fem_start_word = word_idx_ >= 6 ? word_idx_ - 6 : 0;
+    CountSlotWords(fem_start_word);
+    CheckFemChecksum(fem_start_word);
+    NoteFemHeader(*charge_light_decoder_);
+    fem_start_word_ = fem_start_word;
+    fem_slot_ = charge_light_decoder_->GetSlotNumber();
+    light_fem_ = fem_slot_ == light_slot_;
+    charge_fem_decoder_ = light_fem_ ? nullptr : SelectChargeFemDecoder(charge_light_decoder_->GetNumAdcWords());
+    skip_fem_ = !event_filter_.AcceptSlot(fem_slot_);
+    fem_open_ = !skip_fem_;
+    if (skip_fem_) {
+        stats_.fems_skipped++;
+        return;
+    }
+    fem_payload_word_ = word_idx_;
+    fem_checksum_ = 0;
+    fem_first_channel_ = charge_channel_number_;
+    stats_.fems++;
+
     slot_number_v_.push_back(charge_light_decoder_->GetSlotNumber());
     event_number_v_.push_back(charge_light_decoder_->GetEventNumber());
     num_adc_word_v_.push_back(charge_light_decoder_->GetNumAdcWords());
@@ -328,11 +960,121 @@ void ProcessEvents::SetFemData() {
     trigger_frame_number_v_.push_back(charge_light_decoder_->GetTriggerFrameNumber());
     check_sum_v_.push_back(charge_light_decoder_->GetCheckSum());
     trigger_sample_v_.push_back(charge_light_decoder_->GetTriggerSample());
+    check_sum_valid_v_.push_back(1);
+}
+
+void ProcessEvents::NoteFemHeader(const decoder::Decoder &decoder) {
+    if (event_first_fem_) {
+        event_first_fem_ = false;
+        event_header_number_ = decoder.GetEventNumber();
+        event_trigger_frame_ = decoder.GetTriggerFrameNumber();
+    }
+    // Anything past the light channel start and end words
+    if (decoder.GetSlotNumber() == light_slot_ && decoder.GetNumAdcWords() > 1) event_light_rois_ = true;
+}
+
+bool ProcessEvents::AcceptEvent() const {
+    if (use_event_stride_ && (event_number_ % event_stride_) != 0) return false;
+    if (event_first_fem_) return !event_filter_.FiltersEvents();
+    return event_filter_.AcceptEvent(event_header_number_, event_trigger_frame_, event_light_rois_);
+}
+
+bool ProcessEvents::FemEndsOnBoundary(const size_t fem_start_word, const uint32_t num_adc_words) const {
+    const size_t fem_end = fem_start_word + 6 + decoder::Decoder::FemPayloadWords(num_adc_words);
+    // Cut off by the end of the data so far, there is nothing to check against
+    if (fem_end >= file_num_words_) return true;
+    if (decoder::Decoder::IsEventEnd(file_buffer_[fem_end])) return true;
+    if (fem_end + 6 > file_num_words_) return decoder::Decoder::IsHeaderWord(file_buffer_[fem_end]);
+    return decoder::Decoder::IsFemHeader(&file_buffer_[fem_end]);
+}
+
+bool ProcessEvents::Resync(const size_t event_start_word, const size_t error_word) {
+    // Whatever was decoded of the event goes
+    ClearFemVectors();
+    stats_.events_resynced++;
+    event_number_++;
+    if (single_event_) {
+        // Only this event is decoded, the event index already knows where the next one starts
+        event_rejected_ = true;
+        return false;
+    }
+    const uint32_t file_number = run_reader_ ? run_reader_->FileNumber() : 0;
+    if (resync_spans_.size() < max_resync_spans_) {
+        resync_spans_.push_back({event_start_word, error_word, file_num_words_, file_number, file_number});
+    }
+    resync_pending_ = true;
+    FindEventStart();
+    return true;
+}
+
+bool ProcessEvents::FindEventStart() {
+    const size_t next_event = decoder::kernels::FindWord(file_buffer_, word_idx_, file_num_words_,
+                                                         decoder::Decoder::event_start_);
+    stats_.words_resynced += next_event - word_idx_;
+    word_idx_ = next_event;
+    if (!is_worker_) data_buffer_->Release(word_idx_);
+    if (next_event >= file_num_words_) return false;
+
+    resync_pending_ = false;
+    if (stats_.events_resynced <= max_resync_spans_ && !resync_spans_.empty()) {
+        resync_spans_.back().end_word = next_event;
+        resync_spans_.back().end_file_number = run_reader_ ? run_reader_->FileNumber() : 0;
+    }
+    return true;
+}
+
+void ProcessEvents::CountSlotWords(const size_t fem_end_word) {
+    if (!fem_open_ || fem_end_word < fem_start_word_) return;
+    stats_.slot_words[fem_slot_ % DecoderStats::num_slots_] += fem_end_word - fem_start_word_;
+}
+
+void ProcessEvents::SumFemPayload(const size_t end_word) {
+    if (!verify_checksum_ || !fem_open_ || end_word <= fem_payload_word_) return;
+    // The padding words are zero so they don't change the sum
+    const auto *payload = reinterpret_cast<const uint16_t *>(file_buffer_ + fem_payload_word_);
+    fem_checksum_ += decoder::kernels::SumWords(payload, (end_word - fem_payload_word_) * 2);
+    fem_payload_word_ = end_word;
+}
+
+void ProcessEvents::CheckFemChecksum(const size_t fem_end_word) {
+    if (!verify_checksum_ || !fem_open_) return;
+    // The FEM was just read so its payload is still in cache
+    SumFemPayload(fem_end_word);
+    stats_.checksums_verified++;
+    if ((fem_checksum_ & 0xFFFFFF) == check_sum_v_.back()) return;
+    stats_.bad_checksums++;
+    check_sum_valid_v_.back() = 0;
+}
+
+DecoderStats ProcessEvents::GetStats() const {
+    // The prefetch thread is still writing the counters, give them as of the last event handed out
+    if (IsPrefetching()) return prefetch_stats_;
+    return CurrentStats();
+}
+
+DecoderStats ProcessEvents::CurrentStats() const {
+    // The header state machines keep their own count of unknown states
+    DecoderStats stats = stats_;
+    stats.unknown_header_states += charge_light_decoder_->GetNumUnknownHeaderStates();
+    stats.unknown_light_states += charge_light_decoder_->GetNumUnknownLightStates();
+    return stats;
+}
+
+void ProcessEvents::ResetStats() {
+    StopPrefetch();
+    stats_.Reset();
+    resync_spans_.clear();
+    charge_light_decoder_->ResetUnknownStateCounts();
 }
 
 void ProcessEvents::ClearFemVectors() {
     charge_light_decoder_->HeaderWord = 0;
+    fem_open_ = false;
+    skip_fem_ = false;
+    event_first_fem_ = true;
+    event_light_rois_ = false;
     charge_channel_number_ = 0;
+    fem_first_channel_ = 0;
     charge_channel_.clear();
     charge_adc_.clear();
     charge_adc_idx_.clear();
@@ -350,6 +1092,39 @@ void ProcessEvents::ClearFemVectors() {
     trigger_frame_number_v_.clear();
     check_sum_v_.clear();
     trigger_sample_v_.clear();
+    check_sum_valid_v_.clear();
+}
+
+size_t ProcessEvents::GetEvents(const size_t num_events, EventBatch &batch) {
+    batch.Clear();
+    // The batch replaces the per event dict, don't pay for building it. The batch
+    // holds plain samples, an event file packs them itself.
+    StopPrefetch();
+    const bool fill_py_dict = fill_py_dict_;
+    const bool pack_adc_words = pack_adc_words_;
+    fill_py_dict_ = false;
+    pack_adc_words_ = false;
+    while (batch.NumEvents() < num_events && GetEvent()) {
+        batch.Append(GetEventStruct(), event_prefetcher_ ? prefetch_event_index_ : event_number_ - 1);
+    }
+    fill_py_dict_ = fill_py_dict;
+    pack_adc_words_ = pack_adc_words;
+    return batch.NumEvents();
+}
+
+bool ProcessEvents::WriteEventFile(const std::string &file_name, const size_t events_per_chunk,
+                                   const bool pack_adc_words, const size_t max_events) {
+    EventFileWriter writer;
+    if (!writer.Open(file_name, pack_adc_words)) return false;
+
+    EventBatch batch;
+    while (writer.NumEvents() < max_events &&
+           GetEvents(std::min(std::max<size_t>(events_per_chunk, 1), max_events - writer.NumEvents()), batch) > 0) {
+        if (!writer.WriteChunk(batch)) return false;
+    }
+    std::cout << "Wrote " << writer.NumEvents() << " events in " << writer.NumChunks() << " chunks to "
+              << file_name << std::endl;
+    return writer.Close();
 }
 
 bool ProcessEvents::GetNumEvents(const size_t num_events) {
@@ -358,121 +1133,258 @@ bool ProcessEvents::GetNumEvents(const size_t num_events) {
         event_count++;
     }
 
-    if (data_file_ != nullptr) {
-        fclose(data_file_);
-        data_file_ = nullptr;
-    }
+    file_open_ = false;
     return true;
 }
 
 void ProcessEvents::FillFemDict() {
+    StageTimer export_timer(enable_timing_, stats_.export_seconds);
 
-    // Clear and then init the vectors
-    channel_full_waveform_.clear();
-    channel_full_axis_.clear();
-    for (size_t i = 0; i < num_light_channels_; i++) {
-        channel_full_waveform_.emplace_back();
-        channel_full_axis_.emplace_back();
-    }
     // All ROIs should have the same number of samples but the hardware can fail
     // and cause samples to be dropped. Since numpy cannot handle ragged arrays
     // we set all the ROIs to the same length filling the missing samples with
     // 2^16 values which is obviously not an actual ADC value
-    size_t max_size = 0;
-    for (const auto & roi : light_adc_) { // for each ROI
-        max_size = std::max(max_size, roi.size()); // num ROI samples
-    }
+    light_adc_.PadRows(light_adc_.MaxRowLength(), UINT16_MAX);
 
-    for (auto & roi : light_adc_) { // for each ROI
-        roi.resize(max_size, UINT16_MAX); // ensure they are all the same length
+    // Swap rather than move so the buffers on both sides keep their capacity
+    auto swap_out = [](auto &event_field, auto &decoded) {
+        event_field.swap(decoded);
+        decoded.clear();
+    };
+    swap_out(event_struct_.slot_number, slot_number_v_);
+    swap_out(event_struct_.num_adc_word, num_adc_word_v_);
+    swap_out(event_struct_.event_number, event_number_v_);
+    swap_out(event_struct_.event_frame_number, event_frame_number_v_);
+    swap_out(event_struct_.trigger_frame_number, trigger_frame_number_v_);
+    swap_out(event_struct_.check_sum, check_sum_v_);
+    swap_out(event_struct_.trigger_sample, trigger_sample_v_);
+    swap_out(event_struct_.check_sum_valid, check_sum_valid_v_);
+    swap_out(event_struct_.light_channel, light_channel_);
+    swap_out(event_struct_.light_trigger_id, light_trigger_id_);
+    swap_out(event_struct_.light_header_tag, light_header_tag_);
+    swap_out(event_struct_.light_word_tag, light_word_tag_);
+    swap_out(event_struct_.light_frame_number, light_frame_number_);
+    swap_out(event_struct_.light_sample_number, light_sample_number_);
+    swap_out(event_struct_.light_adc, light_adc_);
+    swap_out(event_struct_.charge_channel, charge_channel_);
+    swap_out(event_struct_.charge_adc, charge_adc_);
+    swap_out(event_struct_.charge_adc_idx, charge_adc_idx_);
+    if (pack_adc_words_) {
+        event_struct_.charge_adc_packed.Pack(event_struct_.charge_adc);
+        event_struct_.charge_adc.clear();
+    } else {
+        event_struct_.charge_adc_packed.clear();
     }
 
 #ifdef USE_PYBIND11
+    // Worker threads must not touch python objects, the owning thread builds the dict
+    if (!prefetching_ && fill_py_dict_) FillPyDict(event_struct_, event_number_);
+#endif
+}
+
+#ifdef USE_PYBIND11
+void ProcessEvents::FillPyDict(EventStruct &event, const size_t event_index) {
+    // The arrays take ownership of the decoded vectors so nothing is copied,
+    // this leaves the EventStruct empty when running from python.
     pybind11::dict fem_dict_;
     // FEM header
-    fem_dict_["event_index"] = event_number_;
-    fem_dict_["slot_number"] = vector_to_numpy_array_1d(slot_number_v_);
-    fem_dict_["num_adc_word"] = vector_to_numpy_array_1d(num_adc_word_v_);
-    fem_dict_["event_number"] = vector_to_numpy_array_1d(event_number_v_);
-    fem_dict_["event_frame_number"] = vector_to_numpy_array_1d(event_frame_number_v_);
-    fem_dict_["trigger_frame_number"] = vector_to_numpy_array_1d(trigger_frame_number_v_);
-    fem_dict_["check_sum"] = vector_to_numpy_array_1d(check_sum_v_);
-    fem_dict_["trigger_sample"] = vector_to_numpy_array_1d(trigger_sample_v_);
+    fem_dict_["event_index"] = event_index;
+    fem_dict_["slot_number"] = vector_to_numpy_array_1d(std::move(event.slot_number));
+    fem_dict_["num_adc_word"] = vector_to_numpy_array_1d(std::move(event.num_adc_word));
+    fem_dict_["event_number"] = vector_to_numpy_array_1d(std::move(event.event_number));
+    fem_dict_["event_frame_number"] = vector_to_numpy_array_1d(std::move(event.event_frame_number));
+    fem_dict_["trigger_frame_number"] = vector_to_numpy_array_1d(std::move(event.trigger_frame_number));
+    fem_dict_["check_sum"] = vector_to_numpy_array_1d(std::move(event.check_sum));
+    fem_dict_["trigger_sample"] = vector_to_numpy_array_1d(std::move(event.trigger_sample));
+    fem_dict_["check_sum_valid"] = vector_to_numpy_array_1d(std::move(event.check_sum_valid));
     // Light
-    fem_dict_["light_channel"] = vector_to_numpy_array_1d(light_channel_);
-    fem_dict_["light_trigger_id"] = vector_to_numpy_array_1d(light_trigger_id_);
-    fem_dict_["light_header_tag"] = vector_to_numpy_array_1d(light_header_tag_);
-    fem_dict_["light_word_tag"] = vector_to_numpy_array_1d(light_word_tag_);
-    fem_dict_["light_frame_number"] = vector_to_numpy_array_1d(light_frame_number_);
-    fem_dict_["light_readout_sample"] = vector_to_numpy_array_1d(light_sample_number_);
-    fem_dict_["light_adc_words"] = vector_to_numpy_array_2d(light_adc_);
+    fem_dict_["light_channel"] = vector_to_numpy_array_1d(std::move(event.light_channel));
+    fem_dict_["light_trigger_id"] = vector_to_numpy_array_1d(std::move(event.light_trigger_id));
+    fem_dict_["light_header_tag"] = vector_to_numpy_array_1d(std::move(event.light_header_tag));
+    fem_dict_["light_word_tag"] = vector_to_numpy_array_1d(std::move(event.light_word_tag));
+    fem_dict_["light_frame_number"] = vector_to_numpy_array_1d(std::move(event.light_frame_number));
+    fem_dict_["light_readout_sample"] = vector_to_numpy_array_1d(std::move(event.light_sample_number));
+    fem_dict_["light_adc_words"] = arena_to_numpy_array_2d(event.light_adc);
     // Charge
-    fem_dict_["charge_channel"] = vector_to_numpy_array_1d(charge_channel_);
-    fem_dict_["charge_adc_words"] = vector_to_numpy_array_2d(charge_adc_);
-    fem_dict_["charge_adc_idx"] = vector_to_numpy_array_2d(charge_adc_idx_);
+    fem_dict_["charge_channel"] = vector_to_numpy_array_1d(std::move(event.charge_channel));
+    fem_dict_["charge_adc_words"] = arena_to_numpy_array_2d(event.charge_adc);
+    fem_dict_["charge_adc_idx"] = arena_to_numpy_array_2d(event.charge_adc_idx);
+    if (pack_adc_words_) {
+        std::vector<uint8_t> packed;
+        std::vector<uint64_t> packed_offset;
+        std::vector<uint64_t> sample_offset;
+        event.charge_adc_packed.Release(packed, packed_offset, sample_offset);
+        fem_dict_["charge_adc_packed"] = vector_to_numpy_array_1d(std::move(packed));
+        fem_dict_["charge_adc_packed_offset"] = vector_to_numpy_array_1d(std::move(packed_offset));
+        fem_dict_["charge_adc_sample_offset"] = vector_to_numpy_array_1d(std::move(sample_offset));
+    }
 
     event_dict_ = fem_dict_;
+}
+#endif
 
-#else
-
-    event_struct_.clear_event();
-    event_struct_.slot_number = std::move(slot_number_v_);
-    event_struct_.num_adc_word = std::move(num_adc_word_v_);
-    event_struct_.event_number = std::move(event_number_v_);
-    event_struct_.event_frame_number = std::move(event_frame_number_v_);
-    event_struct_.trigger_frame_number = std::move(trigger_frame_number_v_);
-    event_struct_.check_sum = std::move(check_sum_v_);
-    event_struct_.trigger_sample = std::move(trigger_sample_v_);
-    event_struct_.light_channel = std::move(light_channel_);
-    event_struct_.light_trigger_id = std::move(light_trigger_id_);
-    event_struct_.light_header_tag = std::move(light_header_tag_);
-    event_struct_.light_word_tag = std::move(light_word_tag_);
-    event_struct_.light_frame_number = std::move(light_frame_number_);
-    event_struct_.light_sample_number = std::move(light_sample_number_);
-    event_struct_.light_adc = std::move(light_adc_);
-    event_struct_.charge_channel = std::move(charge_channel_);
-    event_struct_.charge_adc = std::move(charge_adc_);
-    event_struct_.charge_adc_idx = std::move(charge_adc_idx_);
+#ifdef USE_PYBIND11
+pybind11::dict ProcessEvents::ScanHeadersDict() const {
+    FemHeaderTable table;
+    bool scanned;
+    {
+        py::gil_scoped_release release;
+        scanned = ScanHeaders(table);
+    }
+    if (!scanned) return {};
+    pybind11::dict table_dict;
+    table_dict["event_start_word"] = vector_to_numpy_array_1d(std::move(table.event_start_word));
+    table_dict["fem_offset"] = vector_to_numpy_array_1d(std::move(table.fem_offset));
+    table_dict["fem_start_word"] = vector_to_numpy_array_1d(std::move(table.fem_start_word));
+    table_dict["slot_number"] = vector_to_numpy_array_1d(std::move(table.slot_number));
+    table_dict["num_adc_word"] = vector_to_numpy_array_1d(std::move(table.num_adc_word));
+    table_dict["event_number"] = vector_to_numpy_array_1d(std::move(table.event_number));
+    table_dict["event_frame_number"] = vector_to_numpy_array_1d(std::move(table.event_frame_number));
+    table_dict["trigger_frame_number"] = vector_to_numpy_array_1d(std::move(table.trigger_frame_number));
+    table_dict["check_sum"] = vector_to_numpy_array_1d(std::move(table.check_sum));
+    table_dict["trigger_sample"] = vector_to_numpy_array_1d(std::move(table.trigger_sample));
+    table_dict["num_incomplete_events"] = table.num_incomplete_events;
+    return table_dict;
+}
 
-#endif
+pybind11::dict ProcessEvents::GetPedestalsDict() const {
+    constexpr size_t num_slots = PedestalTracker::num_slots_;
+    constexpr size_t num_channels = PedestalTracker::num_channels_;
+    std::vector<double> pedestal(num_slots * num_channels);
+    std::vector<double> rms(num_slots * num_channels);
+    std::vector<uint64_t> num_events(num_slots * num_channels);
+    std::vector<uint64_t> num_rejected(num_slots * num_channels);
+    std::vector<uint16_t> threshold(num_slots * num_channels);
+    for (uint16_t slot = 0; slot < num_slots; slot++) {
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            const size_t idx = slot * num_channels + channel;
+            const ChannelPedestal &channel_pedestal = pedestals_.At(slot, channel);
+            pedestal[idx] = channel_pedestal.Pedestal();
+            rms[idx] = channel_pedestal.Rms();
+            num_events[idx] = channel_pedestal.num_events;
+            num_rejected[idx] = channel_pedestal.num_rejected;
+            threshold[idx] = pedestals_.Threshold(slot, channel, pedestal_num_rms_);
+        }
+    }
+    // Indexed [slot, channel within the FEM]
+    pybind11::dict pedestals_dict;
+    pedestals_dict["pedestal"] = vector_to_numpy_array_2d(std::move(pedestal), num_slots, num_channels);
+    pedestals_dict["rms"] = vector_to_numpy_array_2d(std::move(rms), num_slots, num_channels);
+    pedestals_dict["num_events"] = vector_to_numpy_array_2d(std::move(num_events), num_slots, num_channels);
+    pedestals_dict["num_rejected"] = vector_to_numpy_array_2d(std::move(num_rejected), num_slots, num_channels);
+    pedestals_dict["threshold"] = vector_to_numpy_array_2d(std::move(threshold), num_slots, num_channels);
+    pedestals_dict["min_events"] = pedestals_.GetMinEvents();
+    return pedestals_dict;
 }
 
-// py::array_t<double> ReconstructLightAxis() {
-//     constexpr int samples_per_frame = 255 * 32; // timesize * 32MHz
-//     constexpr double light_sample_interval = 15.625;
-//
-//     const auto min_it = std::min_element(light_frame_number_.begin(), light_frame_number_.end());
-//     uint32_t min_frame_number = min_it != light_frame_number_.end() ? *min_it : 0;
-//
-//     const double frame_offset = (charge_light_decoder_->GetTriggerFrameNumber() - min_frame_number) * light_sample_interval;
-//     const double trigger_index = frame_offset + (charge_light_decoder_->GetTriggerSample() * 32);
-//
-//     std::array<double, 10 * samples_per_frame> light_axis{};
-//     double tick_idx = 0;
-//     for (auto &tick : light_axis) {
-//         tick = (tick_idx - trigger_index) * light_sample_interval;
-//         tick_idx++;
-//     }
-//     return py::array_t(light_axis.size(), &light_axis[0]);
-// }
-
-// void ProcessEvents::ReconstructLightWaveforms() {
-//     constexpr size_t samples_per_frame = 255 * 32; // timesize * 32MHz
-//
-//     const auto min_it = std::min_element(light_frame_number_.begin(), light_frame_number_.end());
-//     uint32_t min_frame_number = min_it != light_frame_number_.end() ? *min_it : 0;
-//
-//     for (size_t roi = 0; roi < light_channel_.size(); roi++) {
-//         size_t channel = light_channel_.at(roi);
-//         if (channel > 31) continue;
-//         size_t frame_offset = (light_frame_number_.at(roi) - min_frame_number) * samples_per_frame;
-//         size_t start_idx = light_sample_number_.at(roi) + frame_offset;
-//         size_t end_idx = std::min((start_idx + light_adc_.at(roi).size()), samples_per_frame*8);
-//         for (size_t idx = start_idx; idx < end_idx; idx++) {
-//             // channel_full_waveform.at(channel).at(idx) = light_adc_.at(roi).at(idx - start_idx);
-//             channel_full_waveform_[channel].push_back(light_adc_.at(roi).at(idx - start_idx));
-//             channel_full_axis_[channel].push_back(idx);
-//         }
-//     }
-// }
+pybind11::dict ProcessEvents::GetResyncSpansDict() const {
+    std::vector<uint64_t> event_start_word;
+    std::vector<uint64_t> error_word;
+    std::vector<uint64_t> end_word;
+    std::vector<uint32_t> file_number;
+    std::vector<uint32_t> end_file_number;
+    for (const ResyncSpan &span : resync_spans_) {
+        event_start_word.push_back(span.event_start_word);
+        error_word.push_back(span.error_word);
+        end_word.push_back(span.end_word);
+        file_number.push_back(span.file_number);
+        end_file_number.push_back(span.end_file_number);
+    }
+    pybind11::dict spans_dict;
+    spans_dict["event_start_word"] = vector_to_numpy_array_1d(std::move(event_start_word));
+    spans_dict["error_word"] = vector_to_numpy_array_1d(std::move(error_word));
+    spans_dict["end_word"] = vector_to_numpy_array_1d(std::move(end_word));
+    spans_dict["file_number"] = vector_to_numpy_array_1d(std::move(file_number));
+    spans_dict["end_file_number"] = vector_to_numpy_array_1d(std::move(end_file_number));
+    return spans_dict;
+}
+
+pybind11::dict ProcessEvents::GetEventsDict(const size_t num_events) {
+    EventBatch batch;
+    GetEvents(num_events, batch);
+
+    // All the columns are moved into the arrays, nothing is copied
+    StageTimer export_timer(enable_timing_, stats_.export_seconds);
+    pybind11::dict batch_dict;
+    batch_dict["event_index"] = vector_to_numpy_array_1d(std::move(batch.event_index));
+    batch_dict["fem_offset"] = vector_to_numpy_array_1d(std::move(batch.fem_offset));
+    batch_dict["light_roi_offset"] = vector_to_numpy_array_1d(std::move(batch.light_roi_offset));
+    batch_dict["charge_offset"] = vector_to_numpy_array_1d(std::move(batch.charge_offset));
+    // FEM header
+    batch_dict["slot_number"] = vector_to_numpy_array_1d(std::move(batch.slot_number));
+    batch_dict["num_adc_word"] = vector_to_numpy_array_1d(std::move(batch.num_adc_word));
+    batch_dict["event_number"] = vector_to_numpy_array_1d(std::move(batch.event_number));
+    batch_dict["event_frame_number"] = vector_to_numpy_array_1d(std::move(batch.event_frame_number));
+    batch_dict["trigger_frame_number"] = vector_to_numpy_array_1d(std::move(batch.trigger_frame_number));
+    batch_dict["check_sum"] = vector_to_numpy_array_1d(std::move(batch.check_sum));
+    batch_dict["trigger_sample"] = vector_to_numpy_array_1d(std::move(batch.trigger_sample));
+    batch_dict["check_sum_valid"] = vector_to_numpy_array_1d(std::move(batch.check_sum_valid));
+    // Light
+    batch_dict["light_channel"] = vector_to_numpy_array_1d(std::move(batch.light_channel));
+    batch_dict["light_trigger_id"] = vector_to_numpy_array_1d(std::move(batch.light_trigger_id));
+    batch_dict["light_header_tag"] = vector_to_numpy_array_1d(std::move(batch.light_header_tag));
+    batch_dict["light_word_tag"] = vector_to_numpy_array_1d(std::move(batch.light_word_tag));
+    batch_dict["light_frame_number"] = vector_to_numpy_array_1d(std::move(batch.light_frame_number));
+    batch_dict["light_readout_sample"] = vector_to_numpy_array_1d(std::move(batch.light_sample_number));
+    batch_dict["light_adc_offset"] = vector_to_numpy_array_1d(std::move(batch.light_adc_offset));
+    batch_dict["light_adc_words"] = vector_to_numpy_array_1d(std::move(batch.light_adc_words));
+    // Charge
+    batch_dict["charge_channel"] = vector_to_numpy_array_1d(std::move(batch.charge_channel));
+    batch_dict["charge_adc_offset"] = vector_to_numpy_array_1d(std::move(batch.charge_adc_offset));
+    batch_dict["charge_adc_words"] = vector_to_numpy_array_1d(std::move(batch.charge_adc_words));
+    batch_dict["charge_adc_idx"] = vector_to_numpy_array_1d(std::move(batch.charge_adc_idx));
 
+    return batch_dict;
+}
+
+pybind11::dict ProcessEvents::GetStatsDict() const {
+    const DecoderStats stats = GetStats();
+    pybind11::dict stats_dict;
+    stats_dict["words_scanned"] = stats.words_scanned;
+    stats_dict["bytes_scanned"] = stats.words_scanned * sizeof(uint32_t);
+    stats_dict["events"] = stats.events;
+    stats_dict["fems"] = stats.fems;
+    stats_dict["events_skipped"] = stats.events_skipped;
+    stats_dict["fems_skipped"] = stats.fems_skipped;
+    stats_dict["words_skipped"] = stats.words_skipped;
+    stats_dict["slot_words"] = vector_to_numpy_array_1d(std::vector<uint64_t>(stats.slot_words.begin(), stats.slot_words.end()));
+    stats_dict["charge_channels"] = stats.charge_channels;
+    stats_dict["charge_rois"] = stats.charge_rois;
+    stats_dict["light_rois_kept"] = stats.light_rois_kept;
+    stats_dict["light_rois_missing_end"] = stats.light_rois_missing_end;
+    stats_dict["light_rois_truncated_header"] = stats.light_rois_truncated_header;
+    stats_dict["light_rois_beam_skipped"] = stats.light_rois_beam_skipped;
+    stats_dict["light_rois_stride_skipped"] = stats.light_rois_stride_skipped;
+    stats_dict["unexpected_light_words"] = stats.unexpected_light_words;
+    stats_dict["non_intermediate_light_words"] = stats.non_intermediate_light_words;
+    stats_dict["bad_fem_headers"] = stats.bad_fem_headers;
+    stats_dict["events_resynced"] = stats.events_resynced;
+    stats_dict["words_resynced"] = stats.words_resynced;
+    stats_dict["unknown_header_states"] = stats.unknown_header_states;
+    stats_dict["unknown_light_states"] = stats.unknown_light_states;
+    stats_dict["checksums_verified"] = stats.checksums_verified;
+    stats_dict["bad_checksums"] = stats.bad_checksums;
+    stats_dict["decode_seconds"] = stats.decode_seconds;
+    stats_dict["roi_seconds"] = stats.roi_seconds;
+    stats_dict["export_seconds"] = stats.export_seconds;
+    stats_dict["bytes_per_second"] = stats.BytesPerSecond();
+    return stats_dict;
+}
+#endif
+
+uint32_t ProcessEvents::ReconstructLightWaveforms(std::vector<uint16_t> &waveforms,
+                                                 const decoder::light::Geometry &geometry) const {
+    const EventStruct &event = GetEventStruct();
+    decoder::light::Rois rois;
+    rois.channel = event.light_channel.data();
+    rois.frame_number = event.light_frame_number.data();
+    rois.sample_number = event.light_sample_number.data();
+    rois.adc_words = event.light_adc.Samples().data();
+    rois.adc_offset = event.light_adc.Offsets().data();
+    rois.num_rois = std::min(event.light_channel.size(), event.light_adc.size());
+
+    const uint32_t first_frame = decoder::light::FirstFrame(rois.frame_number, rois.num_rois);
+    waveforms.resize(geometry.NumWaveformSamples());
+    decoder::light::Reconstruct(rois, first_frame, geometry, waveforms.data());
+    return first_frame;
+}
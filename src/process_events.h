@@ -6,6 +6,22 @@
 #define PROCESS_EVENTS_H
 
 #include "charge_light_decoder.h"
+#include "data_buffer.h"
+#include "decoder_stats.h"
+#include "event_batch.h"
+#include "event_file.h"
+#include "event_filter.h"
+#include "event_index.h"
+#include "event_prefetcher.h"
+#include "header_table.h"
+#include "light_waveforms.h"
+#include "packed_waveforms.h"
+#include "parallel_decoder.h"
+#include "pedestal_tracker.h"
+#include "readout_config.h"
+#include "run_reader.h"
+#include "waveform_arena.h"
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <memory>
@@ -15,11 +31,14 @@
     #include "process_events_py.h"
 #endif
 
+// The waveforms are stored flat, one sample buffer and an offsets table per
+// WaveformArena, indexing them gives a view of each channel/ROI.
 struct EventStruct {
     // Charge
     std::vector<uint16_t> charge_channel;
-    std::vector<std::vector<uint16_t>> charge_adc;
-    std::vector<std::vector<uint16_t>> charge_adc_idx;
+    WaveformArena charge_adc;
+    WaveformArena charge_adc_idx;
+    PackedWaveforms charge_adc_packed; // charge_adc compressed, in place of it when packing
     // Light
     std::vector<uint16_t> light_channel;
     std::vector<uint8_t> light_trigger_id;
@@ -27,7 +46,7 @@ struct EventStruct {
     std::vector<uint8_t> light_word_tag;
     std::vector<uint32_t> light_frame_number;
     std::vector<uint16_t> light_sample_number; // 32b
-    std::vector<std::vector<uint16_t>> light_adc;
+    WaveformArena light_adc;
     // FEM data
     std::vector<uint16_t> slot_number;
     std::vector<uint32_t> num_adc_word;
@@ -36,12 +55,14 @@ struct EventStruct {
     std::vector<uint32_t> trigger_frame_number; //32b
     std::vector<uint32_t> check_sum; //32b
     std::vector<uint32_t> trigger_sample; //32b
+    std::vector<uint8_t> check_sum_valid; // 1 unless the checksum was verified and did not match
 
     void clear_event() {
         // Charge
         charge_channel.clear();
         charge_adc.clear();
         charge_adc_idx.clear();
+        charge_adc_packed.clear();
         // Light
         light_channel.clear();
         light_trigger_id.clear();
@@ -58,52 +79,261 @@ struct EventStruct {
         trigger_frame_number.clear(); //32b
         check_sum.clear(); //32b
         trigger_sample.clear(); //32b
+        check_sum_valid.clear();
     }
 };
 
+// The words dropped to get back in step after a corrupt FEM, from the start of the event
+// it was found in up to the next event start marker. In a run the marker can be in a later
+// file, the words are counted from the start of their file.
+struct ResyncSpan {
+    uint64_t event_start_word;
+    uint64_t error_word;  // the bad or inconsistent FEM header
+    uint64_t end_word;    // the next event start marker, or the end of the data
+    uint32_t file_number;     // file of the run with the error
+    uint32_t end_file_number; // file of the run with end_word
+};
+
 class ProcessEvents {
 public:
     explicit ProcessEvents(uint16_t light_slot, bool use_charge_roi, const std::vector<uint16_t> &channel_threshold, bool skip_beam_roi);
     ~ProcessEvents();
 
     bool OpenFile(const std::string &file_name);
+    // Open the files of a run (pGRAMS_bin_<run>_<N>.dat in directory) or a list of files as one
+    // stream of events. Each file is opened in the background while the one before it is decoded
+    // and events split across two files are decoded as one. A run is decoded on the calling thread.
+    bool OpenRun(size_t run_number, const std::string &directory);
+    bool OpenRunFiles(const std::vector<std::string> &file_names);
     bool GetNumEvents(size_t num_events);
     bool GetEvent();
+    // Decode ahead on a background thread, up to max_events_ahead events (see EventPrefetcher).
+    // GetEvent then hands out the decoded events in order. Changing a decode setting stops it,
+    // opening or repositioning in the file drops the events decoded ahead.
+    void StartPrefetch(size_t max_events_ahead = 8);
+    // Stop the background thread, GetEvent returns the events already decoded before decoding more
+    void StopPrefetch();
+    bool IsPrefetching() const { return event_prefetcher_ && event_prefetcher_->Running(); }
 
     void FillFemDict();
     void SetFemData();
     void ClearFemVectors();
-    void ReconstructLightWaveforms();
-    void ChargeRoi(uint16_t channel, const std::vector<uint16_t> &charge_words);
-    void UseEventStride(const bool use_event_stride) { use_event_stride_ = use_event_stride; }
-    void SetEventStride(const size_t event_stride) { event_stride_ = event_stride; }
-    EventStruct &GetEventStruct() { return event_struct_; }
+    // The full light waveform of every channel of the last event (see decoder::light), in C++ where
+    // the EventStruct still holds the event. Returns the frame the waveforms start at.
+    uint32_t ReconstructLightWaveforms(std::vector<uint16_t> &waveforms, const decoder::light::Geometry &geometry = {}) const;
+    void ChargeRoi(uint16_t channel, const std::vector<uint16_t> &charge_words) {
+        ChargeRoi(channel, charge_words.data(), charge_words.size());
+    }
+    // The threshold is the constructor's channel_threshold at channel
+    void ChargeRoi(uint16_t channel, const uint16_t *charge_words, size_t num_words) {
+        ChargeRoi(channel, charge_words, num_words, channel_threshold_.at(channel));
+    }
+    void ChargeRoi(uint16_t channel, const uint16_t *charge_words, size_t num_words, uint16_t threshold);
+    // Estimate each charge channel's pedestal and RMS from its full waveforms while decoding (see
+    // PedestalTracker). With pedestal thresholds the ROI threshold of a channel is its pedestal +
+    // num_rms * RMS once it has enough events, until then the constructor's channel_threshold for
+    // its channel within the FEM. With several threads each task of events starts from the table
+    // as it is and its sums are merged back in order. Changing the table restarts a parallel decode.
+    void EstimatePedestals(bool estimate_pedestals);
+    void UsePedestalThresholds(bool use_pedestal_thresholds, double num_rms = 5.);
+    const PedestalTracker &GetPedestals() const { return pedestals_; }
+    void ResetPedestals();
+    void SetPedestalMinEvents(size_t min_events);
+    bool SavePedestals(const std::string &file_name) const { return pedestals_.Save(file_name); }
+    bool LoadPedestals(const std::string &file_name);
+    // Only decode every event_stride-th event, the others are skipped like events the filter rejects
+    void UseEventStride(bool use_event_stride);
+    void SetEventStride(size_t event_stride);
+    // Decode only the events and FEMs the filter accepts (see EventFilter), GetEvent returns the next
+    // accepted event. What is rejected is jumped over using the FEM headers.
+    void SetEventFilter(const EventFilter &event_filter);
+    const EventFilter &GetEventFilter() const { return event_filter_; }
+    EventStruct &GetEventStruct() { return event_prefetcher_ ? prefetch_event_ : event_struct_; }
+    const EventStruct &GetEventStruct() const { return event_prefetcher_ ? prefetch_event_ : event_struct_; }
     std::vector<uint32_t> GetBinaryData(size_t num_words);
     bool IsFileOpen(const std::string &file_name) { return file_name == open_file_name_; }
     void RestartFile();
+    // Memory map the file (default) instead of reading it all into memory on open
+    void UseMemoryMap(const bool use_mmap) { use_mmap_ = use_mmap; }
+
+    // Random access to events, the index is built (or loaded from the sidecar file) on first use
+    bool BuildEventIndex(bool use_sidecar = true);
+    bool GetEventAt(size_t event);
+    // Carry on decoding from the event, the next GetEvent decodes it. The number of events seeks to the end.
+    bool SeekEvent(size_t event);
+    // Stop decoding before the event, GetEvent returns false once the next event starts at or past
+    // its start word. Bounds a range of events by where they are in the file rather than by how many
+    // are decoded, as events dropped as corrupt are not counted. The number of events decodes to the end.
+    bool SetEndEvent(size_t event);
+    size_t GetNumIndexedEvents() const { return event_index_.NumEvents(); }
+    const EventIndex &GetEventIndex() const { return event_index_; }
+    // The FEM headers of the whole open file in one table without decoding any payload (see
+    // FemHeaderTable). The decoding carries on from where it was.
+    bool ScanHeaders(FemHeaderTable &table) const;
+
+    // Decode events on several threads, each with its own decoder. Events are still
+    // returned in file order by GetEvent. 0 or 1 threads decodes on the calling thread.
+    void SetNumThreads(size_t num_threads);
+    void SetEventsPerTask(size_t events_per_task);
+
+    // Decode a file which is still being written. At the end of the data GetEvent waits for
+    // more to be appended, checking every poll_seconds. If nothing arrives within timeout_seconds
+    // it returns false without losing its place, calling it again picks up from there. The file
+    // is decoded on the calling thread while following.
+    void FollowFile(bool follow, double poll_seconds = 0.5, double timeout_seconds = 10.);
+
+    // Decode up to num_events events into one columnar batch, returns the number decoded
+    size_t GetEvents(size_t num_events, EventBatch &batch);
+    // Decode the rest of the file, or the next max_events events, into a columnar event file (see
+    // EventFileWriter), events_per_chunk at a time
+    bool WriteEventFile(const std::string &file_name, size_t events_per_chunk = 1000, bool pack_adc_words = false,
+                        size_t max_events = SIZE_MAX);
+
+    // Counts of what was decoded and dropped since the last reset. The stage timers
+    // are only filled with timing enabled, with several threads they are summed over
+    // the threads so the decode time is CPU time rather than wall time.
+    DecoderStats GetStats() const;
+    void ResetStats();
+    void EnableTiming(bool enable_timing);
+
+    // Check each FEM checksum (the 24b sum of its 16b payload words) against its payload while
+    // decoding. A mismatch clears the FEM's check_sum_valid flag and is counted in the stats.
+    void VerifyChecksum(bool verify_checksum);
+    // Keep the charge waveforms of each event compressed (see decoder::codec), they are in
+    // EventStruct::charge_adc_packed and charge_adc is left empty. Batches are not packed.
+    void PackAdcWords(bool pack_adc_words);
+    // On a bad FEM header, or a FEM whose ADC word count does not end on the next FEM header or
+    // event end marker, drop the event and search ahead for the next event start marker instead
+    // of decoding what follows word by word (on by default). Counted in the stats, the first
+    // max_resync_spans_ spans since the last stats reset are kept (serial decoding only).
+    void ResyncOnError(bool resync_on_error);
+    const std::vector<ResyncSpan> &GetResyncSpans() const { return resync_spans_; }
+    static constexpr size_t max_resync_spans_ = 1000;
 
 #ifdef USE_PYBIND11
     // For each FEM fill a python dictionary
     py::dict event_dict_;
 
     pybind11::dict GetEventDict() { return event_dict_; };
-    pybind11::array_t<double> ReconstructLightAxis();
+    pybind11::dict GetEventsDict(size_t num_events);
+    pybind11::dict GetStatsDict() const;
+    pybind11::dict ScanHeadersDict() const;
+    pybind11::dict GetPedestalsDict() const;
+    pybind11::dict GetResyncSpansDict() const;
 #endif
 
 private:
+    friend class ParallelDecoder;
+    friend class EventPrefetcher;
+
+    bool DecodeEvent();
+    bool GetEventParallel();
+    bool GetEventPrefetched();
+    // Join the prefetch thread and drop the events it decoded ahead
+    void ResetPrefetch();
+    DecoderStats CurrentStats() const;
+    void CloseFile();
+    void SetDataBuffer(std::shared_ptr<DataBuffer> data_buffer);
+    bool NextRunFile();
+    bool WaitForData();
+    bool FiltersEvents() const { return event_filter_.FiltersEvents() || (use_event_stride_ && event_stride_ > 1); }
+    bool AcceptEvent() const;
+    void NoteFemHeader(const decoder::Decoder &decoder);
+    bool ProcessFem() const { return !skip_fem_ && !(use_event_stride_ && (event_number_ % event_stride_) != 0); }
+    // The decode of a charge FEM of known geometry (see readout_config.h), nullptr for the word
+    // by word decode. Returns false without decoding anything if the payload isn't as expected.
+    using ChargeFemDecoder = bool (ProcessEvents::*)(const uint16_t *payload);
+    static ChargeFemDecoder SelectChargeFemDecoder(uint32_t num_adc_words);
+    template <typename Readout>
+    bool DecodeChargeFem(const uint16_t *payload);
+    // ROI threshold of a channel of the current FEM, counted from its first channel
+    uint16_t ChargeThreshold(size_t fem_channel) const;
+    void ChargeChannel(const uint16_t *samples, size_t num_samples);
+    bool FemEndsOnBoundary(size_t fem_start_word, uint32_t num_adc_words) const;
+    bool Resync(size_t event_start_word, size_t error_word);
+    // Jump to the next event start marker in the data mapped now, false if it isn't there
+    bool FindEventStart();
+    void CountSlotWords(size_t fem_end_word);
+    void SumFemPayload(size_t end_word);
+    void CheckFemChecksum(size_t fem_end_word);
+    std::unique_ptr<ProcessEvents> MakeWorker() const;
+#ifdef USE_PYBIND11
+    void FillPyDict(EventStruct &event, size_t event_index);
+#endif
 
     bool process_event_;
     bool use_charge_roi_;
-    static constexpr size_t num_light_channels_ = 32;
+    bool pack_adc_words_ = false;
 
     // If set to false, only decode every N events (based on event start/end)
     bool use_event_stride_ = false;
     size_t event_stride_ = 1;
 
+    // Event filter, the event level fields come from the first FEM header of the event, either
+    // walking the headers at the event start or as the FEMs are decoded
+    EventFilter event_filter_{};
+    decoder::Decoder header_decoder_{};
+    bool skip_fem_ = false;
+    bool event_first_fem_ = true;
+    uint32_t event_header_number_ = 0;
+    uint32_t event_trigger_frame_ = 0;
+    bool event_light_rois_ = false;
+    // Decode only the event at word_idx_ (a worker or GetEventAt), a rejected event returns false
+    bool single_event_ = false;
+    bool event_rejected_ = false;
+
     std::unique_ptr<decoder::Decoder> charge_light_decoder_;
-    FILE *data_file_{};
-    std::unique_ptr<uint32_t[]> file_buffer_{};
+    std::shared_ptr<DataBuffer> data_buffer_;
+    std::unique_ptr<RunReader> run_reader_;
+    const uint32_t *file_buffer_ = nullptr;
+    bool file_open_ = false;
+    bool use_mmap_ = true;
     std::string open_file_name_;
+    bool follow_ = false;
+    double follow_poll_seconds_ = 0.5;
+    double follow_timeout_seconds_ = 10.;
+    EventIndex event_index_{};
+    // Decoding stops at an event starting here, see SetEndEvent
+    size_t end_word_ = SIZE_MAX;
+
+    // Parallel decoding, workers share the data buffer but nothing else
+    bool is_worker_ = false;
+    bool fill_py_dict_ = true;
+    size_t num_threads_ = 1;
+    size_t events_per_task_ = 16;
+    std::unique_ptr<ParallelDecoder> parallel_decoder_;
+
+    // Prefetching, the decode state and event_struct_ belong to the prefetch thread while it runs
+    // and the events are handed out through prefetch_event_ with their stats
+    std::unique_ptr<EventPrefetcher> event_prefetcher_;
+    // Set before the prefetch thread starts and cleared only after it is joined, the decode reads
+    // this rather than event_prefetcher_ which the owning thread replaces
+    bool prefetching_ = false;
+    EventStruct prefetch_event_{};
+    size_t prefetch_event_index_ = 0;
+    DecoderStats prefetch_stats_{};
+
+    // Statistics, the words of each FEM are counted from its first header word
+    DecoderStats stats_{};
+    bool enable_timing_ = false;
+    bool fem_open_ = false;
+    size_t fem_start_word_ = 0;
+    uint16_t fem_slot_ = 0;
+
+    // Checksum verification, the payload is summed up to fem_payload_word_ so far
+    bool verify_checksum_ = false;
+    size_t fem_payload_word_ = 0;
+    uint32_t fem_checksum_ = 0;
+    // Resynchronization after a corrupt FEM
+    bool resync_on_error_ = true;
+    // Still searching for the next event start, it carries on in the next file of a run or
+    // the data written next to a followed file
+    bool resync_pending_ = false;
+    std::vector<ResyncSpan> resync_spans_;
+    // The FEM being decoded is the light FEM, set from its header
+    bool light_fem_ = false;
+    // Set from the charge FEM header, see SelectChargeFemDecoder
+    ChargeFemDecoder charge_fem_decoder_ = nullptr;
 
     size_t file_num_words_{};
     size_t word_idx_ = 0;
@@ -116,11 +346,18 @@ private:
     uint16_t light_slot_ = 0;
     std::vector<uint16_t> channel_threshold_;
     bool skip_beam_roi_;
+    // Online pedestals, the channels of the current FEM start at fem_first_channel_
+    PedestalTracker pedestals_{};
+    bool estimate_pedestals_ = false;
+    bool use_pedestal_thresholds_ = false;
+    double pedestal_num_rms_ = 5.;
+    size_t fem_first_channel_ = 0;
 
-    std::array<std::array<uint16_t, 595>, 64> charge_adc_arr_{};
-    std::vector<std::vector<uint16_t>> charge_adc_{};
-    std::vector<std::vector<uint16_t>> charge_adc_idx_{};
-    std::vector<std::vector<uint16_t>> light_adc_{};
+    // The per event buffers, these and the EventStruct swap contents at the end of each
+    // event so both keep their capacity and a steady state run does not allocate.
+    WaveformArena charge_adc_{};
+    WaveformArena charge_adc_idx_{};
+    WaveformArena light_adc_{};
     std::vector<uint16_t> charge_channel_{};
     std::vector<uint16_t> light_channel_{};
     std::vector<uint8_t> light_trigger_id_{};
@@ -128,8 +365,6 @@ private:
     std::vector<uint8_t> light_word_tag_{};
     std::vector<uint32_t> light_frame_number_{};
     std::vector<uint16_t> light_sample_number_{}; // 32b
-    std::vector<std::vector<uint16_t>> channel_full_waveform_{};
-    std::vector<std::vector<size_t>> channel_full_axis_{};
 
     // FEM data
     std::vector<uint16_t> slot_number_v_;
@@ -139,6 +374,7 @@ private:
     std::vector<uint32_t> trigger_frame_number_v_; //32b
     std::vector<uint32_t> check_sum_v_; //32b
     std::vector<uint32_t> trigger_sample_v_; //32b
+    std::vector<uint8_t> check_sum_valid_v_;
 
     // The event struct for when using within C++
     EventStruct event_struct_{};
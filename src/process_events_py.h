@@ -7,6 +7,9 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include "waveform_arena.h"
+#include <algorithm>
+#include <vector>
 
 namespace py = pybind11;
 
@@ -16,6 +19,23 @@ namespace py = pybind11;
         return py::array_t(vec.size(), vec.data());
     }
 
+    // Hand the vector's memory to NumPy without copying. The vector is moved onto
+    // the heap and freed by the capsule when the array is garbage collected.
+    template <typename T>
+    static py::array_t<T> vector_to_numpy_array_1d(std::vector<T>&& vec) {
+        auto *owned = new std::vector<T>(std::move(vec));
+        py::capsule free_when_done(owned, [](void *ptr) { delete static_cast<std::vector<T> *>(ptr); });
+        return py::array_t<T>({owned->size()}, {sizeof(T)}, owned->data(), free_when_done);
+    }
+
+    // Same as above, viewing the flat vector as a rows x cols array
+    template <typename T>
+    static py::array_t<T> vector_to_numpy_array_2d(std::vector<T>&& flat, size_t rows, size_t cols) {
+        auto *owned = new std::vector<T>(std::move(flat));
+        py::capsule free_when_done(owned, [](void *ptr) { delete static_cast<std::vector<T> *>(ptr); });
+        return py::array_t<T>({rows, cols}, {cols * sizeof(T), sizeof(T)}, owned->data(), free_when_done);
+    }
+
     // template <typename T>
     static py::array_t<uint16_t> vector_to_numpy_array_2d(const std::vector<std::vector<uint16_t>>& vec) {
         if (vec.empty()) {
@@ -23,17 +43,34 @@ namespace py = pybind11;
         }
 
         size_t rows = vec.size();
-        size_t cols = vec.back().size();
+        size_t cols = 0;
+        for (const auto &row : vec) cols = std::max(cols, row.size());
 
-        // Flatten 2D vector into 1D buffer
-        std::vector<uint16_t> flat_data;
-        flat_data.reserve(rows * cols);
-        for (const auto& row : vec) {
-            flat_data.insert(flat_data.end(), row.begin(), row.end());
+        // Flatten the rows once straight into the buffer NumPy will own, shorter
+        // rows are padded to the length of the longest with 2^16-1
+        std::vector<uint16_t> flat_data(rows * cols, UINT16_MAX);
+        for (size_t row = 0; row < rows; row++) {
+            std::copy(vec[row].begin(), vec[row].end(), flat_data.begin() + row * cols);
+        }
+
+        return vector_to_numpy_array_2d(std::move(flat_data), rows, cols);
+    }
+
+    // The arena is already one flat buffer so a rectangular set of waveforms is handed
+    // over to NumPy as is. Ragged rows, e.g. charge ROIs cut short by the start or end of
+    // their waveform, are padded to the length of the longest row with 2^16-1.
+    static py::array_t<uint16_t> arena_to_numpy_array_2d(WaveformArena& arena) {
+        if (arena.empty()) {
+            return py::array_t<uint16_t>({0});  // Return empty array if input is empty
         }
 
-        // Create NumPy array with the correct shape, sharing the memory with `flat_data`
-        return py::array_t({rows, cols}, flat_data.data());
+        const size_t rows = arena.size();
+        const size_t cols = arena.MaxRowLength();
+        arena.PadRows(cols, UINT16_MAX);
+        std::vector<uint16_t> samples;
+        std::vector<uint64_t> offsets;
+        arena.Release(samples, offsets);
+        return vector_to_numpy_array_2d(std::move(samples), rows, cols);
     }
 
     template <size_t M>
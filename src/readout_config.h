@@ -0,0 +1,36 @@
+#ifndef READOUT_CONFIG_H
+#define READOUT_CONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The charge readout geometries the decoder has a specialized decode for.
+ *
+ * A charge FEM payload is channels_per_fem channels, each a channel start word,
+ * samples_per_channel samples and a channel end word. The FEM header's ADC word
+ * count (one less than the payload length) tells them apart. A FEM of a known
+ * geometry is checked and copied out a whole channel at a time with the sizes fixed
+ * at compile time. Anything else, or a FEM which does not match the layout its count
+ * implies, goes through the word by word decode.
+ *
+ * To add a geometry define its ChargeReadout and add it to
+ * ProcessEvents::SelectChargeFemDecoder.
+ */
+namespace decoder {
+
+    template <size_t SamplesPerChannel, size_t ChannelsPerFem>
+    struct ChargeReadout {
+        static constexpr size_t samples_per_channel = SamplesPerChannel;
+        static constexpr size_t channels_per_fem = ChannelsPerFem;
+        // The samples and the channel start and end words
+        static constexpr size_t channel_words = SamplesPerChannel + 2;
+        static constexpr uint32_t num_adc_words = ChannelsPerFem * channel_words - 1;
+    };
+
+    using ChargeReadout595 = ChargeReadout<595, 64>;
+    using ChargeReadout763 = ChargeReadout<763, 64>;
+
+} // decoder namespace
+
+#endif //READOUT_CONFIG_H
@@ -0,0 +1,82 @@
+#include "run_reader.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+RunReader::RunReader(std::vector<std::string> file_names, const bool use_mmap) :
+    file_names_(std::move(file_names)),
+    use_mmap_(use_mmap) {}
+
+RunReader::~RunReader() {
+    // Don't leave the prefetch thread running with nothing to pick up the buffer
+    if (prefetch_.valid()) prefetch_.wait();
+}
+
+std::vector<std::string> RunReader::FindRunFiles(const std::string &directory, const size_t run_number) {
+    namespace fs = std::filesystem;
+    const std::string prefix = "pGRAMS_bin_" + std::to_string(run_number) + "_";
+    const std::string suffix = ".dat";
+
+    std::vector<std::pair<size_t, std::string>> files;
+    std::error_code error;
+    for (const auto &entry : fs::directory_iterator(directory, error)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() <= prefix.size() + suffix.size()) continue;
+        if (name.compare(0, prefix.size(), prefix) != 0) continue;
+        if (name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+        // Only the file number between the prefix and suffix, e.g. not the .dat.idx sidecars
+        const std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (!std::all_of(number.begin(), number.end(), [](const char c) { return c >= '0' && c <= '9'; })) continue;
+        files.emplace_back(std::strtoul(number.c_str(), nullptr, 10), entry.path().string());
+    }
+    if (error) std::cerr << "Could not list directory: " << directory << " [" << error.message() << "]" << std::endl;
+
+    std::sort(files.begin(), files.end());
+    std::vector<std::string> file_names;
+    for (auto &file : files) file_names.push_back(std::move(file.second));
+    return file_names;
+}
+
+std::shared_ptr<DataBuffer> RunReader::Open(const size_t file_number) {
+    auto buffer = std::make_shared<DataBuffer>();
+    if (!buffer->Open(file_names_.at(file_number), use_mmap_)) return nullptr;
+    return buffer;
+}
+
+void RunReader::Prefetch(const size_t file_number) {
+    if (file_number >= file_names_.size()) return;
+    prefetch_number_ = file_number;
+    prefetch_ = std::async(std::launch::async, [this, file_number] {
+        auto buffer = Open(file_number);
+        if (buffer) buffer->WillNeed();
+        return buffer;
+    });
+}
+
+std::shared_ptr<DataBuffer> RunReader::OpenFirst() {
+    if (prefetch_.valid()) prefetch_.wait();
+    prefetch_ = {};
+    for (file_number_ = 0; file_number_ < file_names_.size(); file_number_++) {
+        auto buffer = Open(file_number_);
+        if (!buffer) continue;
+        Prefetch(file_number_ + 1);
+        return buffer;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<DataBuffer> RunReader::OpenNext() {
+    while (++file_number_ < file_names_.size()) {
+        std::shared_ptr<DataBuffer> buffer;
+        if (prefetch_.valid() && prefetch_number_ == file_number_) {
+            buffer = prefetch_.get();
+        } else {
+            buffer = Open(file_number_);
+        }
+        if (!buffer) continue;
+        Prefetch(file_number_ + 1);
+        return buffer;
+    }
+    return nullptr;
+}
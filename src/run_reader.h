@@ -0,0 +1,49 @@
+#ifndef RUN_READER_H
+#define RUN_READER_H
+
+#include "data_buffer.h"
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * The files of one run, pGRAMS_bin_<run>_0.dat, pGRAMS_bin_<run>_1.dat, ...,
+ * opened one after the other. While the decoder works through file k the next
+ * file is opened (mapped, or read if mapping is disabled) on a background thread
+ * and the start of it paged in, so moving on to it does not stall on I/O.
+ */
+class RunReader {
+public:
+    RunReader(std::vector<std::string> file_names, bool use_mmap);
+    ~RunReader();
+
+    RunReader(const RunReader &) = delete;
+    RunReader &operator=(const RunReader &) = delete;
+
+    // The files of the run in directory, in file number order
+    static std::vector<std::string> FindRunFiles(const std::string &directory, size_t run_number);
+
+    // Open the first file, or the file after the current one. Files which can not be
+    // opened are skipped, nullptr once there are no files left.
+    std::shared_ptr<DataBuffer> OpenFirst();
+    std::shared_ptr<DataBuffer> OpenNext();
+
+    size_t NumFiles() const { return file_names_.size(); }
+    size_t FileNumber() const { return file_number_; }
+    const std::vector<std::string> &FileNames() const { return file_names_; }
+
+private:
+    std::shared_ptr<DataBuffer> Open(size_t file_number);
+    void Prefetch(size_t file_number);
+
+    const std::vector<std::string> file_names_;
+    const bool use_mmap_;
+    size_t file_number_ = 0;
+
+    // The next file being opened in the background
+    size_t prefetch_number_ = 0;
+    std::future<std::shared_ptr<DataBuffer>> prefetch_{};
+};
+
+#endif //RUN_READER_H
@@ -0,0 +1,83 @@
+#include "waveform_arena.h"
+#include <algorithm>
+#include <stdexcept>
+
+uint16_t WaveformArena::View::at(const size_t idx) const {
+    if (idx >= size_) throw std::out_of_range("WaveformArena::View::at");
+    return data_[idx];
+}
+
+WaveformArena::View WaveformArena::at(const size_t row) const {
+    if (row >= size()) throw std::out_of_range("WaveformArena::at");
+    return (*this)[row];
+}
+
+size_t WaveformArena::MaxRowLength() const {
+    size_t max_length = 0;
+    for (size_t row = 0; row < size(); row++) {
+        max_length = std::max(max_length, RowLength(row));
+    }
+    return max_length;
+}
+
+bool WaveformArena::IsRectangular() const {
+    for (size_t row = 1; row < size(); row++) {
+        if (RowLength(row) != RowLength(0)) return false;
+    }
+    return true;
+}
+
+void WaveformArena::AppendRow(const uint16_t *data, const size_t num_samples) {
+    samples_.insert(samples_.end(), data, data + num_samples);
+    offsets_.push_back(samples_.size());
+}
+
+uint16_t *WaveformArena::AllocateRow(const size_t num_samples) {
+    const size_t offset = samples_.size();
+    samples_.resize(offset + num_samples);
+    offsets_.push_back(samples_.size());
+    return samples_.data() + offset;
+}
+
+void WaveformArena::PadRows(size_t length, const uint16_t pad_value) {
+    const size_t num_rows = size();
+    if (IsRectangular() && (empty() || RowLength(0) == length)) return;
+    // Rows are only ever padded, never cut
+    length = std::max(length, MaxRowLength());
+
+    // Work from the last row back so each row only moves towards the end of the buffer
+    std::vector<uint64_t> old_offsets = offsets_;
+    samples_.resize(std::max(samples_.size(), length * num_rows), pad_value);
+    for (size_t row = num_rows; row-- > 0;) {
+        const size_t old_start = old_offsets[row];
+        const size_t num = std::min<size_t>(old_offsets[row + 1] - old_start, length);
+        const size_t new_start = row * length;
+        std::copy_backward(samples_.begin() + old_start, samples_.begin() + old_start + num,
+                           samples_.begin() + new_start + num);
+        std::fill(samples_.begin() + new_start + num, samples_.begin() + new_start + length, pad_value);
+    }
+    samples_.resize(length * num_rows);
+    for (size_t row = 0; row <= num_rows; row++) offsets_[row] = row * length;
+}
+
+void WaveformArena::Reserve(const size_t num_rows, const size_t num_samples) {
+    offsets_.reserve(num_rows + 1);
+    samples_.reserve(num_samples);
+}
+
+void WaveformArena::Release(std::vector<uint16_t> &samples, std::vector<uint64_t> &offsets) {
+    samples.swap(samples_);
+    offsets.swap(offsets_);
+    samples_.clear();
+    offsets_.assign(1, 0);
+}
+
+void WaveformArena::clear() {
+    samples_.clear();
+    offsets_.resize(1);
+}
+
+void WaveformArena::swap(WaveformArena &other) noexcept {
+    samples_.swap(other.samples_);
+    offsets_.swap(other.offsets_);
+}
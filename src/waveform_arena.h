@@ -0,0 +1,83 @@
+#ifndef WAVEFORM_ARENA_H
+#define WAVEFORM_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * All the waveforms (charge channels, charge ROIs or light ROIs) of an event
+ * in one contiguous sample buffer, with an offsets table marking where each
+ * waveform starts, i.e. waveform i is samples[offsets[i], offsets[i+1]).
+ *
+ * Clear() keeps the capacity, so once the arena has grown to the size of the
+ * largest event it is reused without allocating. Rows are read as lightweight
+ * views so existing code looping over the waveforms works unchanged.
+ */
+class WaveformArena {
+public:
+    class View {
+    public:
+        View(const uint16_t *data, const size_t size) : data_(data), size_(size) {}
+        const uint16_t *data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        const uint16_t *begin() const { return data_; }
+        const uint16_t *end() const { return data_ + size_; }
+        uint16_t operator[](const size_t idx) const { return data_[idx]; }
+        uint16_t at(size_t idx) const;
+    private:
+        const uint16_t *data_;
+        size_t size_;
+    };
+
+    class Iterator {
+    public:
+        Iterator(const WaveformArena *arena, const size_t row) : arena_(arena), row_(row) {}
+        View operator*() const { return (*arena_)[row_]; }
+        Iterator &operator++() { row_++; return *this; }
+        bool operator!=(const Iterator &other) const { return row_ != other.row_; }
+    private:
+        const WaveformArena *arena_;
+        size_t row_;
+    };
+
+    WaveformArena() : offsets_(1, 0) {}
+
+    // Number of waveforms
+    size_t size() const { return offsets_.size() - 1; }
+    bool empty() const { return offsets_.size() == 1; }
+    View operator[](const size_t row) const {
+        return {samples_.data() + offsets_[row], static_cast<size_t>(offsets_[row + 1] - offsets_[row])};
+    }
+    View at(size_t row) const;
+    View back() const { return (*this)[size() - 1]; }
+    Iterator begin() const { return {this, 0}; }
+    Iterator end() const { return {this, size()}; }
+
+    size_t RowLength(const size_t row) const { return offsets_[row + 1] - offsets_[row]; }
+    size_t MaxRowLength() const;
+    bool IsRectangular() const;
+
+    // The flat storage
+    const std::vector<uint16_t> &Samples() const { return samples_; }
+    const std::vector<uint64_t> &Offsets() const { return offsets_; }
+    // Hand the storage over (e.g. to NumPy), leaving the arena empty
+    void Release(std::vector<uint16_t> &samples, std::vector<uint64_t> &offsets);
+
+    void AppendRow(const uint16_t *data, size_t num_samples);
+    void AppendRow(const std::vector<uint16_t> &row) { AppendRow(row.data(), row.size()); }
+    // Add a row of num_samples and return where to write them
+    uint16_t *AllocateRow(size_t num_samples);
+    // Make every row the same length (at least the longest row), padding short rows with pad_value
+    void PadRows(size_t length, uint16_t pad_value);
+    void Reserve(size_t num_rows, size_t num_samples);
+    void clear();
+    void swap(WaveformArena &other) noexcept;
+
+private:
+    std::vector<uint16_t> samples_;
+    std::vector<uint64_t> offsets_;
+};
+
+#endif //WAVEFORM_ARENA_H
@@ -0,0 +1,128 @@
+#include "adc_codec.h"
+#include "fem_data_generator.h"
+#include "packed_waveforms.h"
+#include "test_utils.h"
+#include <random>
+
+/*
+ * The ADC codec must give back exactly what it was given: raw and delta coded
+ * blocks, the 12b extremes, any 16b value, a partial last block and no samples
+ * at all. Also whole events packed by the decoder.
+ */
+namespace {
+    // Encode and decode, returns the encoding
+    std::vector<uint8_t> RoundTrip(const std::vector<uint16_t> &samples) {
+        std::vector<uint8_t> bytes;
+        const size_t num_bytes = decoder::codec::EncodeAdc(samples.data(), samples.size(), bytes);
+        CHECK(num_bytes == bytes.size());
+        CHECK(num_bytes <= decoder::codec::MaxEncodedSize(samples.size()));
+        std::vector<uint16_t> decoded(samples.size(), 0xDEAD);
+        CHECK(decoder::codec::DecodeAdc(bytes.data(), bytes.size(), samples.size(), decoded.data()));
+        CHECK(decoded == samples);
+        return bytes;
+    }
+
+    bool DeltaCoded(const uint8_t block_header) { return (block_header & 0x80) != 0; }
+
+    bool SameArena(const WaveformArena &a, const WaveformArena &b) {
+        return a.Samples() == b.Samples() && a.Offsets() == b.Offsets();
+    }
+}
+
+int main() {
+    std::mt19937 rng(7);
+    std::normal_distribution<double> noise(0., 1.5);
+    using decoder::codec::block_size_;
+
+    // No samples
+    CHECK(RoundTrip({}).empty());
+
+    // A flat baseline is delta coded, uniform 12b noise is smaller packed as is
+    std::vector<uint16_t> baseline(block_size_);
+    for (auto &sample : baseline) sample = static_cast<uint16_t>(2048 + noise(rng));
+    const std::vector<uint8_t> baseline_bytes = RoundTrip(baseline);
+    CHECK(DeltaCoded(baseline_bytes[0]));
+    CHECK(baseline_bytes.size() < baseline.size() * 2 / 3);
+
+    std::vector<uint16_t> uniform(block_size_);
+    for (auto &sample : uniform) sample = rng() & 0xFFF;
+    const std::vector<uint8_t> uniform_bytes = RoundTrip(uniform);
+    CHECK(!DeltaCoded(uniform_bytes[0]));
+    CHECK((uniform_bytes[0] & 0x7F) == 12);
+
+    // The 12b extremes, as constant blocks and swinging from one to the other every sample
+    RoundTrip(std::vector<uint16_t>(block_size_, 0));
+    RoundTrip(std::vector<uint16_t>(block_size_, 0xFFF));
+    std::vector<uint16_t> swing(block_size_);
+    for (size_t i = 0; i < swing.size(); i++) swing[i] = i % 2 ? 0xFFF : 0;
+    RoundTrip(swing);
+    for (size_t i = 0; i < swing.size(); i++) swing[i] = i % 2 ? 0xFFFF : 0;
+    RoundTrip(swing);
+    // Light ROIs are padded with UINT16_MAX
+    std::vector<uint16_t> padded(baseline.begin(), baseline.begin() + 40);
+    padded.resize(block_size_ + 10, UINT16_MAX);
+    RoundTrip(padded);
+
+    // Partial last blocks, with a block of each kind in one waveform
+    for (const size_t num_samples : {size_t{1}, size_t{2}, block_size_ - 1, block_size_, block_size_ + 1,
+                                     3 * block_size_ + 17, size_t{763}}) {
+        std::vector<uint16_t> samples(num_samples);
+        for (size_t i = 0; i < num_samples; i++) {
+            const bool flat = (i / block_size_) % 2 == 0;
+            samples[i] = flat ? static_cast<uint16_t>(400 + noise(rng)) : static_cast<uint16_t>(rng() & 0xFFF);
+        }
+        RoundTrip(samples);
+    }
+
+    // A cut off encoding is not a valid one
+    CHECK(!decoder::codec::DecodeAdc(baseline_bytes.data(), baseline_bytes.size() - 1, baseline.size(), baseline.data()));
+
+    // Whole waveform tables, including empty rows
+    WaveformArena arena;
+    arena.AppendRow(baseline);
+    arena.AppendRow(nullptr, 0);
+    arena.AppendRow(uniform);
+    arena.AppendRow(padded);
+    PackedWaveforms packed;
+    packed.Pack(arena);
+    CHECK(packed.size() == arena.size());
+    CHECK(packed.NumSamples() == arena.Samples().size());
+    WaveformArena unpacked;
+    CHECK(packed.Unpack(unpacked));
+    CHECK(SameArena(arena, unpacked));
+    std::vector<uint16_t> row(packed.RowLength(2));
+    CHECK(packed.UnpackRow(2, row.data()));
+    CHECK(row == uniform);
+
+    // Charge waveforms packed by the decoder unpack to what it decodes without packing
+    GeneratorConfig config;
+    config.num_events = 5;
+    config.num_charge_fems = 1;
+    config.pulse_probability = 0.3;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+    test::WriteWords("test_adc_codec.dat", words);
+    std::vector<WaveformArena> charge_adc;
+    {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        events.OpenFile("test_adc_codec.dat");
+        while (events.GetEvent()) charge_adc.push_back(events.GetEventStruct().charge_adc);
+    }
+    {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        events.PackAdcWords(true);
+        events.OpenFile("test_adc_codec.dat");
+        size_t event = 0;
+        while (events.GetEvent()) {
+            const EventStruct &event_struct = events.GetEventStruct();
+            CHECK(event_struct.charge_adc.empty());
+            CHECK(event < charge_adc.size() && !charge_adc[event].empty());
+            WaveformArena event_adc;
+            CHECK(event_struct.charge_adc_packed.Unpack(event_adc));
+            if (event < charge_adc.size()) CHECK(SameArena(charge_adc[event], event_adc));
+            event++;
+        }
+        CHECK(event == config.num_events);
+    }
+    return test::Result("test_adc_codec");
+}
@@ -0,0 +1,52 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <cstdio>
+
+/*
+ * Change one sample of one FEM and check checksum verification flags exactly that FEM,
+ * decoding on the calling thread and on several threads.
+ */
+int main() {
+    GeneratorConfig config;
+    config.num_events = 20;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+
+    FemHeaderTable table;
+    table.Scan(words.data(), words.size());
+    CHECK(table.NumEvents() == config.num_events);
+    // Event 7, FEM 1: the low bit of two samples of the first channel
+    const size_t bad_event = 7;
+    const size_t bad_fem = 1;
+    words[table.fem_start_word[table.fem_offset[bad_event] + bad_fem] + 6 + 10] ^= 0x1;
+    test::WriteWords("test_checksum.dat", words);
+    std::remove("test_checksum.dat.idx");
+
+    for (const bool verify_checksum : {false, true}) {
+        for (const size_t num_threads : {1, 4}) {
+            ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+            events.SetNumThreads(num_threads);
+            events.VerifyChecksum(verify_checksum);
+            CHECK(events.OpenFile("test_checksum.dat"));
+            size_t num_events = 0;
+            while (events.GetEvent()) {
+                const EventStruct &event = events.GetEventStruct();
+                CHECK(event.check_sum_valid.size() == config.num_charge_fems + 1);
+                for (size_t fem = 0; fem < event.check_sum_valid.size(); fem++) {
+                    const bool bad = verify_checksum && num_events == bad_event && fem == bad_fem;
+                    CHECK(event.check_sum_valid[fem] == (bad ? 0 : 1));
+                }
+                num_events++;
+            }
+            CHECK(num_events == config.num_events);
+            const DecoderStats stats = events.GetStats();
+            CHECK(stats.bad_checksums == (verify_checksum ? 1 : 0));
+            CHECK(stats.checksums_verified == (verify_checksum ? config.num_events * (config.num_charge_fems + 1) : 0));
+        }
+    }
+
+    return test::Result("test_checksum");
+}
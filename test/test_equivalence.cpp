@@ -0,0 +1,237 @@
+#include "charge_light_decoder.h"
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <cstring>
+#include <random>
+
+/*
+ * The rewrites which were meant to leave the output alone, checked against what they replaced:
+ *  - the parallel decode gives the same events as the serial one
+ *  - the FEM header decode gives the same fields as the original bitfield structs
+ *  - the charge ROIs are the windows of the original sample by sample loop, quirks included
+ */
+namespace legacy {
+
+#pragma pack(push, 1)
+    // The FEM header structs the decoder started out with
+    struct FEMHeader1 {
+        uint16_t event_start : 16;
+        uint16_t slot_number : 5;
+        uint16_t fem_id : 4;
+        uint16_t test : 1;
+        uint16_t overflow : 1;
+        uint16_t full : 1;
+        uint16_t header_start_1 : 4;
+    };
+    struct FEMHeader24 {
+        uint32_t upper : 12;
+        uint16_t header_pack_0 : 4;
+        uint16_t lower : 12;
+        uint16_t header_pack_1 : 4;
+        uint32_t value() const { return ((upper << 12) & 0xFFF000) | (lower & 0xFFF); }
+    };
+    struct FEMHeader6 {
+        uint16_t trig_sample_number_upper : 4;
+        uint16_t trig_frame_number_lower : 4;
+        uint16_t pad0 : 4;
+        uint16_t header_pack_8 : 4;
+        uint16_t trig_sample_number_lower : 8;
+        uint16_t pad1 : 4;
+        uint16_t header_pack_9 : 4;
+        uint32_t trig_sample_number() const { return ((trig_sample_number_upper << 8) & 0xF00) | (trig_sample_number_lower & 0xFF); }
+    };
+#pragma pack(pop)
+
+    template <typename T>
+    T As(const uint32_t word) {
+        T header;
+        std::memcpy(&header, &word, sizeof(header));
+        return header;
+    }
+
+    struct Roi {
+        uint16_t channel;
+        std::vector<uint16_t> words;
+        std::vector<uint16_t> idx;
+        bool operator==(const Roi &other) const { return channel == other.channel && words == other.words && idx == other.idx; }
+    };
+
+    // The original ChargeRoi
+    void ChargeRoi(const uint16_t channel, const std::vector<uint16_t> &charge_words, const uint16_t thresh,
+                   std::vector<Roi> &rois) {
+        const size_t pre_samples = 10;
+        const size_t num_samples = 40;
+        bool is_roi_window = false;
+        size_t end_idx = 0;
+        std::vector<uint16_t> tmp_charge_words;
+        std::vector<uint16_t> tmp_charge_idx;
+        for (size_t sample = 0; sample < charge_words.size(); sample++) {
+            if (charge_words.at(sample) > thresh && !is_roi_window) {
+                size_t start_idx = (sample < pre_samples) ? 0 : sample - pre_samples;
+                start_idx -= (sample < end_idx + pre_samples + 1) && (sample > pre_samples - 1) ? (sample - end_idx) : 0;
+                for (size_t pre = start_idx; pre < sample + 1; pre++) {
+                    tmp_charge_words.push_back(charge_words.at(pre));
+                    tmp_charge_idx.push_back(pre);
+                }
+                is_roi_window = true;
+                end_idx = sample;
+            } else {
+                if (is_roi_window && (sample < end_idx + num_samples)) {
+                    tmp_charge_words.push_back(charge_words.at(sample));
+                    tmp_charge_idx.push_back(sample);
+                    if (sample == (end_idx + num_samples - 1)) {
+                        rois.push_back({channel, tmp_charge_words, tmp_charge_idx});
+                        tmp_charge_words.clear();
+                        tmp_charge_idx.clear();
+                        is_roi_window = false;
+                        end_idx = sample;
+                    }
+                } else {
+                    end_idx = sample;
+                }
+            }
+        }
+        if (!tmp_charge_words.empty()) rois.push_back({channel, tmp_charge_words, tmp_charge_idx});
+    }
+
+} // legacy namespace
+
+namespace {
+    constexpr uint16_t threshold_ = 2100;
+
+    void CheckHeaderDecode() {
+        std::mt19937 rng(11);
+        decoder::Decoder decoder;
+        for (size_t trial = 0; trial < 10000; trial++) {
+            // Random contents under the header nibbles
+            uint32_t words[6];
+            words[0] = 0xF000FFFF | (rng() & 0x0FFF0000);
+            for (size_t i = 1; i < 6; i++) words[i] = 0xF000F000 | (rng() & 0x0FFF0FFF);
+
+            const auto header1 = legacy::As<legacy::FEMHeader1>(words[0]);
+            const auto header6 = legacy::As<legacy::FEMHeader6>(words[5]);
+            const decoder::FemHeader expected{header1.slot_number, static_cast<uint8_t>(header1.fem_id),
+                static_cast<uint8_t>(header1.test), static_cast<uint8_t>(header1.overflow),
+                static_cast<uint8_t>(header1.full), legacy::As<legacy::FEMHeader24>(words[1]).value(),
+                legacy::As<legacy::FEMHeader24>(words[2]).value(), legacy::As<legacy::FEMHeader24>(words[3]).value(),
+                legacy::As<legacy::FEMHeader24>(words[4]).value(), header6.trig_sample_number(),
+                header6.trig_frame_number_lower};
+            for (size_t i = 1; i < 5; i++) CHECK(decoder::Decoder::Header24(words[i]) == legacy::As<legacy::FEMHeader24>(words[i]).value());
+
+            // In one go and word by word
+            for (const bool whole : {true, false}) {
+                if (whole) {
+                    CHECK(decoder::Decoder::IsFemHeader(words));
+                    decoder.DecodeFemHeader(words);
+                } else {
+                    for (size_t i = 0; i < 6; i++) CHECK(decoder.FemHeaderDecode(words[i]) == (i == 5));
+                }
+                const decoder::FemHeader &header = decoder.GetFemHeader();
+                CHECK(header.slot_number == expected.slot_number);
+                CHECK(header.fem_id == expected.fem_id);
+                CHECK(header.test == expected.test);
+                CHECK(header.overflow == expected.overflow);
+                CHECK(header.full == expected.full);
+                CHECK(header.num_adc_words == expected.num_adc_words);
+                CHECK(header.event_number == expected.event_number);
+                CHECK(header.event_frame_number == expected.event_frame_number);
+                CHECK(header.checksum == expected.checksum);
+                CHECK(header.trig_sample_number == expected.trig_sample_number);
+                CHECK(header.trig_frame_number_lower == expected.trig_frame_number_lower);
+            }
+        }
+    }
+
+    // Put crossings where the window bounds have their edge cases into the first charge FEM
+    // of the first event, samples_per_channel samples per channel
+    void AddCrossings(std::vector<uint32_t> &words, const size_t samples_per_channel) {
+        FemHeaderTable table;
+        table.Scan(words.data(), words.size());
+        auto *shorts = reinterpret_cast<uint16_t *>(words.data());
+        const size_t payload = (table.fem_start_word[0] + 6) * 2;
+        const size_t last = samples_per_channel - 1;
+        const std::vector<std::vector<size_t>> crossings = {
+            {10},                   // the pre-samples would start before the waveform
+            {0, 5},                 // at the start, the second inside the first window
+            {9, 11},
+            {100, 130, 140, 141},   // inside the window, on the sample it closes and right after
+            {100, 150, 155},        // the pre-samples of the second reach back into the first window
+            {last - 20, last},      // cut off by the end of the waveform
+            {last},
+        };
+        for (size_t channel = 0; channel < crossings.size(); channel++) {
+            const size_t first_sample = payload + channel * (samples_per_channel + 2) + 1;
+            for (const size_t sample : crossings[channel]) shorts[first_sample + sample] = 3000;
+        }
+    }
+
+    ProcessEvents MakeEvents(const bool use_charge_roi) {
+        return ProcessEvents(16, use_charge_roi, std::vector<uint16_t>(64, threshold_), false);
+    }
+
+    void CheckDecode(const size_t samples_per_channel) {
+        GeneratorConfig config;
+        config.num_events = 40;
+        config.num_charge_fems = 2;
+        config.samples_per_channel = samples_per_channel;
+        config.pulse_probability = 0.2;
+        std::vector<uint32_t> words;
+        GenerateFemData(config, words);
+        AddCrossings(words, samples_per_channel);
+        const std::string file_name = "test_equivalence_" + std::to_string(samples_per_channel) + ".dat";
+        test::WriteWords(file_name, words);
+        std::remove((file_name + ".idx").c_str());
+
+        for (const bool use_charge_roi : {false, true}) {
+            std::vector<std::string> serial;
+            {
+                ProcessEvents events = MakeEvents(use_charge_roi);
+                events.OpenFile(file_name);
+                serial = test::DecodeAll(events);
+                CHECK(serial.size() == config.num_events);
+            }
+            ProcessEvents events = MakeEvents(use_charge_roi);
+            events.OpenFile(file_name);
+            events.SetNumThreads(4);
+            events.SetEventsPerTask(3);
+            CHECK(test::DecodeAll(events) == serial);
+        }
+
+        // The ROIs of the original loop run over the full waveforms
+        ProcessEvents full_events = MakeEvents(false);
+        ProcessEvents roi_events = MakeEvents(true);
+        full_events.OpenFile(file_name);
+        roi_events.OpenFile(file_name);
+        size_t num_rois = 0;
+        while (full_events.GetEvent()) {
+            CHECK(roi_events.GetEvent());
+            const EventStruct &full = full_events.GetEventStruct();
+            const EventStruct &roi = roi_events.GetEventStruct();
+            std::vector<legacy::Roi> expected;
+            for (size_t row = 0; row < full.charge_adc.size(); row++) {
+                const auto waveform = full.charge_adc[row];
+                legacy::ChargeRoi(full.charge_channel[row], std::vector<uint16_t>(waveform.begin(), waveform.end()),
+                                  threshold_, expected);
+            }
+            std::vector<legacy::Roi> decoded;
+            for (size_t row = 0; row < roi.charge_adc.size(); row++) {
+                const auto samples = roi.charge_adc[row];
+                const auto idx = roi.charge_adc_idx[row];
+                decoded.push_back({roi.charge_channel[row], std::vector<uint16_t>(samples.begin(), samples.end()),
+                                   std::vector<uint16_t>(idx.begin(), idx.end())});
+            }
+            CHECK(decoded == expected);
+            num_rois += decoded.size();
+        }
+        CHECK(num_rois > 0);
+    }
+}
+
+int main() {
+    CheckHeaderDecode();
+    // 595 samples has a fixed layout decode, 300 goes word by word
+    CheckDecode(595);
+    CheckDecode(300);
+    return test::Result("test_equivalence");
+}
@@ -0,0 +1,191 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <cstdio>
+
+/*
+ * Decode with an event filter or stride and compare the accepted events with a full
+ * decode filtered afterwards. The rejected events and FEMs are jumped over using the
+ * FEM headers, an event whose headers do not chain is decoded and dropped instead.
+ */
+namespace {
+    constexpr uint16_t light_slot = 16;
+    constexpr size_t channels_per_fem = 64;
+
+    struct Decoded {
+        EventStruct event;
+        size_t index;
+    };
+
+    // The corrupt event is decoded word by word rather than dropped
+    struct Events : ProcessEvents {
+        Events() : ProcessEvents(light_slot, false, std::vector<uint16_t>(channels_per_fem, 0), false) {
+            ResyncOnError(false);
+        }
+    };
+
+    std::vector<Decoded> DecodeFull(const std::string &file_name) {
+        Events events;
+        events.OpenFile(file_name);
+        std::vector<Decoded> decoded;
+        for (size_t index = 0; events.GetEvent(); index++) decoded.push_back({events.GetEventStruct(), index});
+        return decoded;
+    }
+
+    // The event as decoded with only the FEMs of the slots in the mask, the charge channels are
+    // numbered on from the last accepted FEM
+    EventStruct KeepSlots(const EventStruct &event, const EventFilter &filter) {
+        EventStruct kept;
+        size_t charge_fem = 0;
+        for (size_t fem = 0; fem < event.slot_number.size(); fem++) {
+            const uint16_t slot = event.slot_number[fem];
+            const bool accept = filter.AcceptSlot(slot);
+            if (accept) {
+                kept.slot_number.push_back(slot);
+                kept.num_adc_word.push_back(event.num_adc_word[fem]);
+                kept.event_number.push_back(event.event_number[fem]);
+                kept.event_frame_number.push_back(event.event_frame_number[fem]);
+                kept.trigger_frame_number.push_back(event.trigger_frame_number[fem]);
+                kept.check_sum.push_back(event.check_sum[fem]);
+                kept.trigger_sample.push_back(event.trigger_sample[fem]);
+                kept.check_sum_valid.push_back(event.check_sum_valid[fem]);
+            }
+            if (slot == light_slot) {
+                if (!accept) continue;
+                kept.light_channel = event.light_channel;
+                kept.light_trigger_id = event.light_trigger_id;
+                kept.light_header_tag = event.light_header_tag;
+                kept.light_word_tag = event.light_word_tag;
+                kept.light_frame_number = event.light_frame_number;
+                kept.light_sample_number = event.light_sample_number;
+                kept.light_adc = event.light_adc;
+                continue;
+            }
+            for (size_t channel = 0; accept && channel < channels_per_fem; channel++) {
+                const size_t row = charge_fem * channels_per_fem + channel;
+                kept.charge_channel.push_back(static_cast<uint16_t>(kept.charge_channel.size()));
+                kept.charge_adc.AppendRow(event.charge_adc[row].data(), event.charge_adc[row].size());
+            }
+            charge_fem++;
+        }
+        return kept;
+    }
+
+    bool HasLightRois(const EventStruct &event) {
+        for (size_t fem = 0; fem < event.slot_number.size(); fem++) {
+            if (event.slot_number[fem] == light_slot && event.num_adc_word[fem] > 1) return true;
+        }
+        return false;
+    }
+
+    std::vector<std::string> Expected(const std::vector<Decoded> &full, const EventFilter &filter,
+                                      const size_t event_stride) {
+        std::vector<std::string> expected;
+        for (const Decoded &decoded : full) {
+            const EventStruct &event = decoded.event;
+            if (decoded.index % event_stride != 0 ||
+                !filter.AcceptEvent(event.event_number.front(), event.trigger_frame_number.front(),
+                                    HasLightRois(event))) {
+                continue;
+            }
+            expected.push_back(test::DumpEvent(KeepSlots(event, filter)));
+        }
+        return expected;
+    }
+
+    void CheckFilter(const std::string &file_name, const std::vector<Decoded> &full, const EventFilter &filter,
+                     const size_t event_stride = 1) {
+        const std::vector<std::string> expected = Expected(full, filter, event_stride);
+        CHECK(!expected.empty());
+        if (filter.FiltersEvents() || event_stride > 1) CHECK(expected.size() < full.size());
+        for (const size_t num_threads : {1, 4}) {
+            Events events;
+            events.SetNumThreads(num_threads);
+            events.SetEventFilter(filter);
+            events.UseEventStride(event_stride > 1);
+            events.SetEventStride(event_stride);
+            events.OpenFile(file_name);
+            CHECK(test::DecodeAll(events) == expected);
+            const DecoderStats stats = events.GetStats();
+            CHECK(stats.events == expected.size());
+            if (filter.FiltersEvents()) CHECK(stats.events_skipped == full.size() - expected.size());
+        }
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 40;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    config.light_rois_per_event = 0.7;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+
+    // Event 30: the ADC word count of FEM 0 is 4 too many so the FEM headers do not chain
+    FemHeaderTable table;
+    table.Scan(words.data(), words.size());
+    CHECK(table.NumEvents() == config.num_events);
+    words[table.fem_start_word[table.fem_offset[30]] + 1] += 4 << 16;
+    const std::string file_name = "test_event_filter.dat";
+    test::WriteWords(file_name, words);
+    std::remove((file_name + ".idx").c_str());
+
+    const std::vector<Decoded> full = DecodeFull(file_name);
+    CHECK(full.size() == config.num_events);
+    size_t num_light_rois = 0;
+    for (const Decoded &decoded : full) num_light_rois += HasLightRois(decoded.event);
+    CHECK(num_light_rois > 0 && num_light_rois < full.size());
+
+    // Event range, including the corrupt event
+    EventFilter filter;
+    filter.min_event_number = 5;
+    filter.max_event_number = 32;
+    CheckFilter(file_name, full, filter);
+    {
+        // The events rejected by the header walk are jumped over
+        Events events;
+        events.SetEventFilter(filter);
+        events.OpenFile(file_name);
+        test::DecodeAll(events);
+        CHECK(events.GetStats().words_skipped > 0);
+    }
+
+    // Trigger frames and light ROIs
+    filter = EventFilter{};
+    filter.min_trigger_frame = full[10].event.trigger_frame_number.front();
+    filter.require_light_rois = true;
+    CheckFilter(file_name, full, filter);
+
+    // Slots, without the second charge FEM and without the light FEM
+    filter = EventFilter{};
+    filter.slot_mask = EventFilter::SlotMask({13, light_slot});
+    CheckFilter(file_name, full, filter);
+    filter.slot_mask = EventFilter::SlotMask({13, 14});
+    filter.max_event_number = 35;
+    CheckFilter(file_name, full, filter);
+
+    // Every 3rd event
+    CheckFilter(file_name, full, EventFilter{}, 3);
+
+    // Set after a few events have been decoded
+    filter = EventFilter{};
+    filter.min_event_number = 25;
+    std::vector<std::string> expected;
+    for (size_t event = 0; event < 2; event++) expected.push_back(test::DumpEvent(full[event].event));
+    for (const std::string &event : Expected(full, filter, 1)) expected.push_back(event);
+    for (const size_t num_threads : {1, 4}) {
+        Events events;
+        events.SetNumThreads(num_threads);
+        events.OpenFile(file_name);
+        std::vector<std::string> decoded;
+        for (size_t event = 0; event < 2 && events.GetEvent(); event++) {
+            decoded.push_back(test::DumpEvent(events.GetEventStruct()));
+        }
+        events.SetEventFilter(filter);
+        for (const std::string &event : test::DecodeAll(events)) decoded.push_back(event);
+        CHECK(decoded == expected);
+    }
+
+    return test::Result("test_event_filter");
+}
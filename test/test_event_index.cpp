@@ -0,0 +1,100 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cstdio>
+
+/*
+ * The sidecar event index is only reused for the data file it was built from. A file
+ * rewritten with the same size, or an index file with a bad event count, is rebuilt.
+ */
+namespace {
+    bool SameEntries(const EventIndex &lhs, const EventIndex &rhs) {
+        if (lhs.NumEvents() != rhs.NumEvents()) return false;
+        for (size_t event = 0; event < lhs.NumEvents(); event++) {
+            const EventIndexEntry &a = lhs.At(event);
+            const EventIndexEntry &b = rhs.At(event);
+            if (a.start_word != b.start_word || a.end_word != b.end_word || a.event_number != b.event_number ||
+                a.num_fem != b.num_fem) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    EventIndex BuildIndex(const std::vector<uint32_t> &words) {
+        EventIndex index;
+        index.Build(words.data(), words.size());
+        return index;
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 20;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+    const EventIndex built = BuildIndex(words);
+    CHECK(built.NumEvents() == config.num_events);
+
+    // The index only loads for the same size, modification time and checksum
+    const DataFileId id = DataFileId::Of("test_event_index.dat", words.size() * sizeof(uint32_t), words.data(),
+                                         words.size());
+    CHECK(built.Save("test_event_index.idx", id));
+    {
+        EventIndex index;
+        CHECK(index.Load("test_event_index.idx", id));
+        CHECK(SameEntries(index, built));
+        DataFileId other = id;
+        other.size += sizeof(uint32_t);
+        CHECK(!index.Load("test_event_index.idx", other));
+        other = id;
+        other.mtime++;
+        CHECK(!index.Load("test_event_index.idx", other));
+        other = id;
+        other.checksum ^= 1;
+        CHECK(!index.Load("test_event_index.idx", other));
+        CHECK(index.Empty());
+    }
+
+    // A header claiming more events than the data file can hold, or than the index file holds
+    {
+        std::vector<char> bytes;
+        FILE *file = fopen("test_event_index.idx", "rb");
+        for (int c; (c = fgetc(file)) != EOF;) bytes.push_back(static_cast<char>(c));
+        fclose(file);
+        const size_t num_events_offset = bytes.size() - built.NumEvents() * sizeof(EventIndexEntry) - sizeof(uint64_t);
+        for (const uint64_t num_events : {uint64_t{1} << 60, uint64_t{config.num_events + 1}}) {
+            std::vector<char> bad = bytes;
+            std::copy_n(reinterpret_cast<const char *>(&num_events), sizeof(num_events), bad.begin() + num_events_offset);
+            file = fopen("test_event_index_bad.idx", "wb");
+            fwrite(bad.data(), 1, bad.size(), file);
+            fclose(file);
+            EventIndex index;
+            CHECK(!index.Load("test_event_index_bad.idx", id));
+        }
+    }
+
+    // Rewrite the data file with the first event moved to the end, the same size but other offsets
+    test::WriteWords("test_event_index.dat", words);
+    std::remove("test_event_index.dat.idx");
+    {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        CHECK(events.OpenFile("test_event_index.dat") && events.BuildEventIndex());
+        CHECK(SameEntries(events.GetEventIndex(), built));
+    }
+    std::vector<uint32_t> rotated(words.begin() + static_cast<std::ptrdiff_t>(built.At(1).start_word), words.end());
+    rotated.insert(rotated.end(), words.begin(), words.begin() + static_cast<std::ptrdiff_t>(built.At(1).start_word));
+    CHECK(rotated.size() == words.size());
+    test::WriteWords("test_event_index.dat", rotated);
+    {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        CHECK(events.OpenFile("test_event_index.dat") && events.BuildEventIndex());
+        CHECK(SameEntries(events.GetEventIndex(), BuildIndex(rotated)));
+        CHECK(!SameEntries(events.GetEventIndex(), built));
+    }
+
+    return test::Result("test_event_index");
+}
@@ -0,0 +1,92 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+/*
+ * Follow a file while it is written. An event cut off by the end of the data times out
+ * without losing its place and is decoded whole once the rest of it is appended, the
+ * events come out the same as from decoding the finished file.
+ */
+namespace {
+    const char *file_name = "test_follow.dat";
+
+    void AppendBytes(const std::vector<uint32_t> &words, const size_t first_byte, const size_t last_byte) {
+        std::ofstream file(file_name, std::ios::binary | std::ios::app);
+        file.write(reinterpret_cast<const char *>(words.data()) + first_byte,
+                   static_cast<std::streamsize>(last_byte - first_byte));
+        CHECK(static_cast<bool>(file));
+    }
+
+    // The byte half way through the given event
+    size_t MidEventByte(const FemHeaderTable &table, const size_t event) {
+        return (table.event_start_word[event] + table.event_start_word[event + 1]) / 2 * sizeof(uint32_t);
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 12;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+
+    FemHeaderTable table;
+    table.Scan(words.data(), words.size());
+    CHECK(table.NumEvents() == config.num_events);
+    const size_t num_bytes = words.size() * sizeof(uint32_t);
+
+    test::WriteWords(file_name, words);
+    std::vector<std::string> expected;
+    {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        events.OpenFile(file_name);
+        expected = test::DecodeAll(events);
+        CHECK(expected.size() == config.num_events);
+    }
+
+    // Threads are not used while following
+    for (const size_t num_threads : {1, 4}) {
+        // Written up to half way through event 5
+        const size_t first_cut = MidEventByte(table, 5);
+        test::WriteWords(file_name, words.data(), first_cut / sizeof(uint32_t));
+
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        events.SetNumThreads(num_threads);
+        events.FollowFile(true, 0.005, 0.05);
+        CHECK(events.OpenFile(file_name));
+        std::vector<std::string> decoded = test::DecodeAll(events);
+        CHECK(decoded.size() == 5);
+
+        // The partial event times out again, nothing of it is counted
+        CHECK(!events.GetEvent());
+        CHECK(events.GetStats().events == 5);
+
+        // The rest of event 5 and half of event 8, the last bytes not making a whole word
+        const size_t second_cut = MidEventByte(table, 8) + 2;
+        AppendBytes(words, first_cut, second_cut);
+        for (const std::string &event : test::DecodeAll(events)) decoded.push_back(event);
+        CHECK(decoded.size() == 8);
+
+        // The rest is appended while GetEvent waits for it
+        events.FollowFile(true, 0.005, 5.);
+        std::thread writer([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            AppendBytes(words, second_cut, num_bytes);
+        });
+        CHECK(events.GetEvent());
+        decoded.push_back(test::DumpEvent(events.GetEventStruct()));
+        writer.join();
+
+        events.FollowFile(true, 0.005, 0.05);
+        for (const std::string &event : test::DecodeAll(events)) decoded.push_back(event);
+        CHECK(decoded == expected);
+        CHECK(events.GetStats().events == config.num_events);
+    }
+    std::remove(file_name);
+
+    return test::Result("test_follow");
+}
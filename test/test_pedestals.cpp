@@ -0,0 +1,158 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+/*
+ * Pedestals estimated while decoding. Waveforms with a pulse are left out, the sums of the
+ * parallel workers merge into the same table as a serial decode, and a saved table carries
+ * on the estimate exactly once loaded again.
+ */
+namespace {
+    constexpr size_t num_events = 60;
+    constexpr size_t min_events = 10;
+    constexpr size_t num_charge_fems = 2;
+    constexpr uint16_t first_charge_slot = 13;
+    constexpr size_t channels_per_fem = 64;
+
+    bool SameSums(const ChannelPedestal &lhs, const ChannelPedestal &rhs) {
+        return lhs.num_events == rhs.num_events && lhs.num_rejected == rhs.num_rejected &&
+               lhs.num_samples == rhs.num_samples && lhs.sum == rhs.sum && lhs.sum_sq == rhs.sum_sq;
+    }
+
+    bool SameTable(const PedestalTracker &lhs, const PedestalTracker &rhs) {
+        for (uint16_t slot = 0; slot < PedestalTracker::num_slots_; slot++) {
+            for (size_t channel = 0; channel < PedestalTracker::num_channels_; channel++) {
+                if (!SameSums(lhs.At(slot, channel), rhs.At(slot, channel))) return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint32_t> Generate(const double pulse_probability) {
+        GeneratorConfig config;
+        config.num_events = num_events;
+        config.num_charge_fems = num_charge_fems;
+        config.samples_per_channel = 595;
+        config.pulse_probability = pulse_probability;
+        std::vector<uint32_t> words;
+        GenerateFemData(config, words);
+        return words;
+    }
+
+    std::string WriteData(const std::string &file_name, const std::vector<uint32_t> &words) {
+        test::WriteWords(file_name, words);
+        std::remove((file_name + ".idx").c_str());
+        return file_name;
+    }
+
+    // The table after decoding the events [first_event, end_event), starting from the one in
+    // load_file_name if given
+    PedestalTracker Estimate(const std::string &file_name, const size_t num_threads, const size_t first_event = 0,
+                             const size_t end_event = num_events, const std::string &load_file_name = "") {
+        ProcessEvents events(16, false, std::vector<uint16_t>(channels_per_fem, 0), false);
+        events.SetNumThreads(num_threads);
+        events.SetEventsPerTask(3);
+        events.EstimatePedestals(true);
+        events.SetPedestalMinEvents(min_events);
+        if (!load_file_name.empty()) CHECK(events.LoadPedestals(load_file_name));
+        CHECK(events.OpenFile(file_name) && events.SeekEvent(first_event) && events.SetEndEvent(end_event));
+        CHECK(test::DecodeAll(events).size() == end_event - first_event);
+        return events.GetPedestals();
+    }
+}
+
+int main() {
+    // A flat waveform is added, one with a pulse is rejected once the channel has min_events
+    {
+        PedestalTracker tracker;
+        tracker.SetMinEvents(3);
+        std::vector<uint16_t> samples(100);
+        for (size_t event = 0; event < 4; event++) {
+            for (size_t sample = 0; sample < samples.size(); sample++) samples[sample] = 2040 + (sample + event) % 5;
+            tracker.Add(first_charge_slot, 7, samples.data(), samples.size());
+        }
+        const ChannelPedestal flat = tracker.At(first_charge_slot, 7);
+        CHECK(flat.num_events == 4 && flat.num_rejected == 0 && flat.num_samples == 400);
+        CHECK(std::abs(flat.Pedestal() - 2042.) < 1e-9 && std::abs(flat.Rms() - std::sqrt(2.)) < 1e-9);
+        CHECK(tracker.Ready(first_charge_slot, 7) && !tracker.Ready(first_charge_slot, 8));
+        CHECK(tracker.Threshold(first_charge_slot, 7, 5.) == static_cast<uint16_t>(std::ceil(2042. + 5. * std::sqrt(2.))));
+
+        for (size_t sample = 40; sample < 60; sample++) samples[sample] += 300;
+        tracker.Add(first_charge_slot, 7, samples.data(), samples.size());
+        ChannelPedestal pulsed = tracker.At(first_charge_slot, 7);
+        CHECK(pulsed.num_rejected == 1);
+        pulsed.num_rejected = 0;
+        CHECK(SameSums(pulsed, flat));
+
+        // Out of range channels are ignored
+        tracker.Add(PedestalTracker::num_slots_, 0, samples.data(), samples.size());
+        tracker.Add(0, PedestalTracker::num_channels_, samples.data(), samples.size());
+        CHECK(tracker.Threshold(PedestalTracker::num_slots_, 0, 5.) == UINT16_MAX);
+    }
+
+    // The same noise with and without pulses. The pulses only start once every channel has
+    // min_events waveforms, from then on they are only counted as rejected.
+    const std::vector<uint32_t> clean_words = Generate(0.);
+    std::vector<uint32_t> pulse_words = Generate(0.2);
+    CHECK(pulse_words.size() == clean_words.size() && pulse_words != clean_words);
+    FemHeaderTable table;
+    table.Scan(clean_words.data(), clean_words.size());
+    CHECK(table.NumEvents() == num_events);
+    std::copy_n(clean_words.begin(), table.event_start_word[min_events], pulse_words.begin());
+    const std::string clean_file = WriteData("test_pedestals_clean.dat", clean_words);
+    const std::string pulse_file = WriteData("test_pedestals_pulses.dat", pulse_words);
+
+    const PedestalTracker clean = Estimate(clean_file, 1);
+    const PedestalTracker pulsed = Estimate(pulse_file, 1);
+    size_t num_rejected = 0;
+    for (uint16_t slot = first_charge_slot; slot < first_charge_slot + num_charge_fems; slot++) {
+        for (size_t channel = 0; channel < channels_per_fem; channel++) {
+            const ChannelPedestal &expected = clean.At(slot, channel);
+            const ChannelPedestal &pedestal = pulsed.At(slot, channel);
+            CHECK(expected.num_events == num_events && expected.num_rejected == 0);
+            CHECK(pedestal.num_events + pedestal.num_rejected == num_events);
+            CHECK(std::abs(pedestal.Pedestal() - expected.Pedestal()) < 0.5);
+            CHECK(pedestal.Rms() < 1.5 * expected.Rms());
+            num_rejected += pedestal.num_rejected;
+        }
+    }
+    CHECK(num_rejected > 0);
+
+    // Merged from the workers' sums. Without pulses nothing depends on the order the
+    // waveforms are added in, the table is the same as the serial one.
+    CHECK(SameTable(Estimate(clean_file, 4), clean));
+    // With pulses the workers start from a table which already has min_events waveforms
+    const std::string pedestal_file = "test_pedestals.txt";
+    CHECK(Estimate(pulse_file, 1, 0, min_events).Save(pedestal_file));
+    const PedestalTracker pulsed_parallel = Estimate(pulse_file, 4, min_events, num_events, pedestal_file);
+    for (uint16_t slot = first_charge_slot; slot < first_charge_slot + num_charge_fems; slot++) {
+        for (size_t channel = 0; channel < channels_per_fem; channel++) {
+            const ChannelPedestal &pedestal = pulsed_parallel.At(slot, channel);
+            CHECK(pedestal.num_events + pedestal.num_rejected == num_events);
+            CHECK(std::abs(pedestal.Pedestal() - pulsed.At(slot, channel).Pedestal()) < 0.5);
+            CHECK(pedestal.Rms() < 1.5 * clean.At(slot, channel).Rms());
+        }
+    }
+
+    // Saved and loaded the sums are the same, the estimate carries on from them as if not stopped
+    CHECK(clean.Save(pedestal_file));
+    PedestalTracker loaded;
+    CHECK(loaded.Load(pedestal_file) && SameTable(loaded, clean));
+    for (const size_t num_threads : {1, 4}) {
+        CHECK(Estimate(clean_file, num_threads, 0, 25).Save(pedestal_file));
+        CHECK(SameTable(Estimate(clean_file, num_threads, 25, num_events, pedestal_file), clean));
+    }
+
+    // A bad line leaves the table as it was
+    {
+        std::ofstream file(pedestal_file);
+        file << first_charge_slot << " 0 10 0 100\n";
+    }
+    CHECK(!loaded.Load(pedestal_file) && SameTable(loaded, clean));
+
+    std::remove(pedestal_file.c_str());
+    return test::Result("test_pedestals");
+}
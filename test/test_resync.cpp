@@ -0,0 +1,133 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cstdio>
+
+/*
+ * Corrupt a few events of a synthetic file and check the decoder drops exactly those,
+ * records where it jumped and decodes the rest as in the clean file. Also with the file
+ * split into a run across a corrupt event, and with several threads.
+ */
+namespace {
+    struct Corruption {
+        size_t event;          // in the clean file
+        size_t event_start_word;
+        size_t error_word;     // in the corrupt file
+        size_t resume_word;    // the error word the decoder resumes after
+        size_t end_word;       // the next event start in the corrupt file
+    };
+
+    ProcessEvents MakeEvents() {
+        return ProcessEvents(16, false, std::vector<uint16_t>(64, 0), false);
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 30;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> clean;
+    GenerateFemData(config, clean);
+
+    FemHeaderTable table;
+    table.Scan(clean.data(), clean.size());
+    CHECK(table.NumEvents() == config.num_events);
+    auto fem_word = [&](const size_t event, const size_t fem) { return table.fem_start_word[table.fem_offset[event] + fem]; };
+
+    // Event 5: the ADC word count of FEM 1 is 4 too many, event 12: header 4 of FEM 0 lost
+    // its header nibble, event 20: 20 words cut out of the payload of FEM 1
+    std::vector<uint32_t> corrupt = clean;
+    corrupt[fem_word(5, 1) + 1] += 4 << 16;
+    corrupt[fem_word(12, 0) + 3] &= 0x0FFFFFFF;
+    const size_t cut_word = fem_word(20, 1) + 50;
+    corrupt.erase(corrupt.begin() + cut_word, corrupt.begin() + cut_word + 20);
+    const auto shifted = [&](const size_t word) { return word >= cut_word ? word - 20 : word; };
+    const std::vector<Corruption> corruptions = {
+        {5, table.event_start_word[5], fem_word(5, 1), fem_word(5, 1) + 6, table.event_start_word[6]},
+        {12, table.event_start_word[12], fem_word(12, 0), fem_word(12, 0) + 1, table.event_start_word[13]},
+        {20, table.event_start_word[20], fem_word(20, 1), fem_word(20, 1) + 6, shifted(table.event_start_word[21])},
+    };
+    test::WriteWords("test_resync_clean.dat", clean);
+    test::WriteWords("test_resync.dat", corrupt);
+    // An index left by an earlier run could match the file size
+    std::remove("test_resync.dat.idx");
+
+    std::vector<std::string> clean_events;
+    {
+        ProcessEvents events = MakeEvents();
+        events.OpenFile("test_resync_clean.dat");
+        clean_events = test::DecodeAll(events);
+        CHECK(clean_events.size() == config.num_events);
+        CHECK(events.GetStats().events_resynced == 0);
+    }
+    std::vector<std::string> expected;
+    for (size_t event = 0; event < clean_events.size(); event++) {
+        if (event != 5 && event != 12 && event != 20) expected.push_back(clean_events[event]);
+    }
+    uint64_t expected_words = 0;
+    for (const Corruption &corruption : corruptions) expected_words += corruption.end_word - corruption.resume_word;
+
+    // One file
+    {
+        ProcessEvents events = MakeEvents();
+        events.OpenFile("test_resync.dat");
+        CHECK(test::DecodeAll(events) == expected);
+        const DecoderStats stats = events.GetStats();
+        CHECK(stats.events == expected.size());
+        CHECK(stats.events_resynced == corruptions.size());
+        CHECK(stats.words_resynced == expected_words);
+        CHECK(stats.bad_fem_headers == 1);
+        const std::vector<ResyncSpan> &spans = events.GetResyncSpans();
+        CHECK(spans.size() == corruptions.size());
+        for (size_t i = 0; i < std::min(spans.size(), corruptions.size()); i++) {
+            CHECK(spans[i].event_start_word == corruptions[i].event_start_word);
+            CHECK(spans[i].error_word == corruptions[i].error_word);
+            CHECK(spans[i].end_word == corruptions[i].end_word);
+            CHECK(spans[i].file_number == 0 && spans[i].end_file_number == 0);
+        }
+    }
+
+    // Split into a run right after where the corrupt FEM of event 20 claims to end, the error
+    // is found in the first file and the search for the next event start carries on in the second
+    {
+        const size_t split_word = fem_word(20, 2) + 1;
+        CHECK(split_word < corruptions[2].end_word);
+        test::WriteWords("test_resync_0.dat", corrupt.data(), split_word);
+        test::WriteWords("test_resync_1.dat", corrupt.data() + split_word, corrupt.size() - split_word);
+        ProcessEvents events = MakeEvents();
+        events.OpenRunFiles({"test_resync_0.dat", "test_resync_1.dat"});
+        CHECK(test::DecodeAll(events) == expected);
+        const DecoderStats stats = events.GetStats();
+        CHECK(stats.events_resynced == corruptions.size());
+        CHECK(stats.words_resynced == expected_words);
+        const std::vector<ResyncSpan> &spans = events.GetResyncSpans();
+        CHECK(spans.size() == corruptions.size());
+        if (spans.size() == corruptions.size()) {
+            CHECK(spans[2].error_word == corruptions[2].error_word);
+            CHECK(spans[2].file_number == 0);
+            CHECK(spans[2].end_word == corruptions[2].end_word - split_word);
+            CHECK(spans[2].end_file_number == 1);
+        }
+    }
+
+    // The workers drop the same events, they rely on the event index for the next one
+    {
+        ProcessEvents events = MakeEvents();
+        events.OpenFile("test_resync.dat");
+        events.SetNumThreads(4);
+        CHECK(test::DecodeAll(events) == expected);
+        CHECK(events.GetStats().events_resynced == corruptions.size());
+    }
+
+    // Without resync the corrupt events are decoded word by word and none are dropped
+    {
+        ProcessEvents events = MakeEvents();
+        events.ResyncOnError(false);
+        events.OpenFile("test_resync.dat");
+        test::DecodeAll(events);
+        CHECK(events.GetStats().events_resynced == 0);
+    }
+    return test::Result("test_resync");
+}
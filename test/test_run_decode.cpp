@@ -0,0 +1,106 @@
+#include "fem_data_generator.h"
+#include "header_table.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Decode a file with truncated FEMs with run_raw_decoder, once whole and once split into
+ * shards which are merged again. Each shard ends where the next one starts, so the merged
+ * file holds the same events as the whole decode, none of them twice.
+ */
+namespace {
+    // The columns of a one event chunk as text
+    std::string DumpChunk(const EventBatch &batch) {
+        std::ostringstream out;
+        EventBatch::ForEachColumn(batch, [&](const char *name, const auto &column) {
+            test::DumpValues(out, name, column);
+        });
+        return out.str();
+    }
+
+    std::vector<std::string> ReadEvents(const std::string &file_name) {
+        std::vector<std::string> events;
+        EventFileReader reader;
+        CHECK(reader.Open(file_name));
+        EventBatch batch;
+        for (size_t chunk = 0; chunk < reader.NumChunks(); chunk++) {
+            CHECK(reader.ReadChunk(chunk, batch));
+            CHECK(batch.NumEvents() == 1);
+            events.push_back(DumpChunk(batch));
+        }
+        return events;
+    }
+
+    std::vector<uint64_t> EventIndices(const std::string &file_name) {
+        std::vector<uint64_t> indices;
+        EventFileReader reader;
+        CHECK(reader.Open(file_name));
+        EventBatch batch;
+        for (size_t chunk = 0; chunk < reader.NumChunks() && reader.ReadChunk(chunk, batch); chunk++) {
+            indices.insert(indices.end(), batch.event_index.begin(), batch.event_index.end());
+        }
+        return indices;
+    }
+
+    int RunDecoder(const std::string &args) {
+        const std::string command = "./run_raw_decoder -j 4 --events-per-chunk 1 " + args + " > /dev/null";
+        return std::system(command.c_str());
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 50;
+    config.num_charge_fems = 3;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> data;
+    GenerateFemData(config, data);
+
+    FemHeaderTable table;
+    table.Scan(data.data(), data.size());
+    CHECK(table.NumEvents() == config.num_events);
+
+    // Cut 20 words out of the payload of a charge FEM of a few events, last first so the
+    // word offsets of the others still hold
+    const std::vector<size_t> corrupt_events = {41, 27, 14, 7};
+    for (const size_t event : corrupt_events) {
+        const size_t cut_word = table.fem_start_word[table.fem_offset[event] + 1] + 50;
+        data.erase(data.begin() + cut_word, data.begin() + cut_word + 20);
+    }
+    test::WriteWords("test_run_decode.dat", data);
+    std::remove("test_run_decode.dat.idx");
+    CHECK(data.size() * sizeof(uint32_t) > 8000000);
+
+    // Whole, then in shards of about 2 MB
+    CHECK(RunDecoder("--shard-mb 0 -o . --merge test_run_decode_whole.evf test_run_decode.dat") == 0);
+    const std::vector<std::string> whole = ReadEvents("test_run_decode_whole.evf");
+    CHECK(whole.size() == config.num_events - corrupt_events.size());
+
+    CHECK(RunDecoder("--shard-mb 2 -o . --merge test_run_decode_merged.evf test_run_decode.dat") == 0);
+    CHECK(ReadEvents("test_run_decode_merged.evf") == whole);
+
+    std::vector<uint64_t> expected_indices;
+    for (uint64_t event = 0; event < config.num_events; event++) {
+        if (std::find(corrupt_events.begin(), corrupt_events.end(), event) == corrupt_events.end()) {
+            expected_indices.push_back(event);
+        }
+    }
+    CHECK(EventIndices("test_run_decode_merged.evf") == expected_indices);
+
+    // An event range decodes the same serially and on several threads
+    std::vector<std::string> serial_range;
+    for (const size_t num_threads : {1, 4}) {
+        ProcessEvents events(16, false, std::vector<uint16_t>(64, 0), false);
+        events.SetNumThreads(num_threads);
+        CHECK(events.OpenFile("test_run_decode.dat") && events.SeekEvent(5) && events.SetEndEvent(30));
+        const std::vector<std::string> range = test::DecodeAll(events);
+        CHECK(range.size() == 25 - 3);
+        if (num_threads == 1) serial_range = range;
+        else CHECK(range == serial_range);
+        CHECK(!events.GetEvent());
+    }
+
+    return test::Result("test_run_decode");
+}
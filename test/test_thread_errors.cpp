@@ -0,0 +1,47 @@
+#include "fem_data_generator.h"
+#include "test_utils.h"
+#include <cstdio>
+#include <stdexcept>
+
+/*
+ * An exception thrown while decoding on a worker or prefetch thread reaches the caller of
+ * GetEvent as it does decoding on the calling thread. With fewer ROI thresholds than channels the
+ * threshold lookup of the first charge channel past them throws std::out_of_range.
+ */
+namespace {
+    // Returns true if GetEvent threw std::out_of_range
+    bool ThrowsOutOfRange(ProcessEvents &events) {
+        try {
+            events.GetEvent();
+        } catch (const std::out_of_range &) {
+            return true;
+        }
+        return false;
+    }
+}
+
+int main() {
+    GeneratorConfig config;
+    config.num_events = 20;
+    config.num_charge_fems = 2;
+    config.samples_per_channel = 595;
+    std::vector<uint32_t> words;
+    GenerateFemData(config, words);
+    test::WriteWords("test_thread_errors.dat", words);
+    std::remove("test_thread_errors.dat.idx");
+
+    for (const bool prefetch : {false, true}) {
+        for (const size_t num_threads : {1, 4}) {
+            ProcessEvents events(16, true, std::vector<uint16_t>(10, 2100), false);
+            events.SetNumThreads(num_threads);
+            CHECK(events.OpenFile("test_thread_errors.dat"));
+            if (prefetch) events.StartPrefetch();
+            CHECK(ThrowsOutOfRange(events));
+            CHECK(!events.IsPrefetching());
+            // Calling again fails the same way rather than hanging or skipping the event
+            CHECK(ThrowsOutOfRange(events));
+        }
+    }
+
+    return test::Result("test_thread_errors");
+}
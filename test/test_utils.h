@@ -0,0 +1,94 @@
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include "process_events.h"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Helpers shared by the tests, which run on synthetic data (see fem_data_generator.h)
+ * and return non-zero if any CHECK failed.
+ */
+namespace test {
+
+inline int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            test::failures++; \
+        } \
+    } while (false)
+
+inline bool WriteWords(const std::string &file_name, const uint32_t *words, const size_t num_words) {
+    std::ofstream file(file_name, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(words), static_cast<std::streamsize>(num_words * sizeof(uint32_t)));
+    return static_cast<bool>(file);
+}
+
+inline bool WriteWords(const std::string &file_name, const std::vector<uint32_t> &words) {
+    return WriteWords(file_name, words.data(), words.size());
+}
+
+template <typename T>
+void DumpRows(std::ostringstream &out, const char *name, const T &rows) {
+    out << name << ":";
+    for (const auto row : rows) {
+        for (size_t i = 0; i < row.size(); i++) out << row[i] << ",";
+        out << ";";
+    }
+    out << "\n";
+}
+
+template <typename T>
+void DumpValues(std::ostringstream &out, const char *name, const std::vector<T> &values) {
+    out << name << ":";
+    for (const auto value : values) out << +value << ",";
+    out << "\n";
+}
+
+// Everything decoded of an event as text, two events decoded the same give the same string
+inline std::string DumpEvent(const EventStruct &event) {
+    std::ostringstream out;
+    DumpValues(out, "charge_channel", event.charge_channel);
+    DumpRows(out, "charge_adc", event.charge_adc);
+    DumpRows(out, "charge_adc_idx", event.charge_adc_idx);
+    DumpValues(out, "light_channel", event.light_channel);
+    DumpValues(out, "light_trigger_id", event.light_trigger_id);
+    DumpValues(out, "light_header_tag", event.light_header_tag);
+    DumpValues(out, "light_word_tag", event.light_word_tag);
+    DumpValues(out, "light_frame_number", event.light_frame_number);
+    DumpValues(out, "light_sample_number", event.light_sample_number);
+    DumpRows(out, "light_adc", event.light_adc);
+    DumpValues(out, "slot_number", event.slot_number);
+    DumpValues(out, "num_adc_word", event.num_adc_word);
+    DumpValues(out, "event_number", event.event_number);
+    DumpValues(out, "event_frame_number", event.event_frame_number);
+    DumpValues(out, "trigger_frame_number", event.trigger_frame_number);
+    DumpValues(out, "check_sum", event.check_sum);
+    DumpValues(out, "trigger_sample", event.trigger_sample);
+    DumpValues(out, "check_sum_valid", event.check_sum_valid);
+    return out.str();
+}
+
+// Decode all (remaining) events
+inline std::vector<std::string> DecodeAll(ProcessEvents &events) {
+    std::vector<std::string> dumps;
+    while (events.GetEvent()) dumps.push_back(DumpEvent(events.GetEventStruct()));
+    return dumps;
+}
+
+inline int Result(const char *test_name) {
+    if (failures == 0) std::cout << test_name << " passed" << std::endl;
+    else std::cerr << test_name << ": " << failures << " checks failed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+} // namespace test
+
+#endif //TEST_UTILS_H
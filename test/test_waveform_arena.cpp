@@ -0,0 +1,62 @@
+#include "test_utils.h"
+#include "waveform_arena.h"
+#include <algorithm>
+
+/*
+ * Padding the rows of a ragged arena to one length, as the 2D NumPy exports do. Every row
+ * keeps its samples followed by the pad value, whichever row is the longest.
+ */
+namespace {
+    constexpr uint16_t pad = UINT16_MAX;
+
+    WaveformArena MakeArena(const std::vector<std::vector<uint16_t>> &rows) {
+        WaveformArena arena;
+        for (const std::vector<uint16_t> &row : rows) arena.AppendRow(row);
+        return arena;
+    }
+
+    // The rows padded by hand
+    bool IsPadded(const WaveformArena &arena, const std::vector<std::vector<uint16_t>> &rows, const size_t length) {
+        if (arena.size() != rows.size() || arena.Samples().size() != rows.size() * length) return false;
+        for (size_t row = 0; row < rows.size(); row++) {
+            std::vector<uint16_t> expected = rows[row];
+            expected.resize(length, pad);
+            if (arena.Offsets()[row] != row * length || arena.RowLength(row) != length) return false;
+            if (!std::equal(expected.begin(), expected.end(), arena[row].begin())) return false;
+        }
+        return true;
+    }
+}
+
+int main() {
+    // The longest row in the middle, the last row shorter than the rest
+    const std::vector<std::vector<uint16_t>> rows = {{1, 2, 3}, {4, 5, 6, 7, 8, 9}, {}, {10, 11, 12, 13}, {14}};
+    WaveformArena arena = MakeArena(rows);
+    CHECK(!arena.IsRectangular() && arena.MaxRowLength() == 6);
+
+    // Asked for the last row's length the rows are still padded to the longest, none is cut
+    arena.PadRows(arena.back().size(), pad);
+    CHECK(arena.IsRectangular() && IsPadded(arena, rows, 6));
+
+    // Padded further, the same again is left as it is
+    arena.PadRows(8, pad);
+    CHECK(IsPadded(arena, rows, 8));
+    arena.PadRows(8, pad);
+    CHECK(IsPadded(arena, rows, 8));
+
+    // Released for NumPy the storage is [rows x length]
+    std::vector<uint16_t> samples;
+    std::vector<uint64_t> offsets;
+    arena.Release(samples, offsets);
+    CHECK(arena.empty() && samples.size() == rows.size() * 8 && offsets.back() == samples.size());
+
+    // Equal rows are not touched, an empty arena stays empty
+    WaveformArena rectangular = MakeArena({{1, 2}, {3, 4}});
+    rectangular.PadRows(2, pad);
+    CHECK(IsPadded(rectangular, {{1, 2}, {3, 4}}, 2));
+    WaveformArena empty;
+    empty.PadRows(4, pad);
+    CHECK(empty.empty() && empty.Samples().empty());
+
+    return test::Result("test_waveform_arena");
+}